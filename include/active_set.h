@@ -0,0 +1,62 @@
+#pragma once
+#include <Arduino.h>
+
+// Set of small integer indices (e.g. LED groups) with O(1) insert, lookup and
+// removal, and iteration that only visits members. Members are kept in a
+// dense list; a bitmap answers "is this index already in the set".
+class ActiveSet {
+private:
+    int capacity = 0;
+    int count = 0;
+    uint16_t* members = nullptr;
+    uint32_t* bitmap = nullptr;
+
+    bool testBit(int index) const {
+        return bitmap[index >> 5] & (1UL << (index & 31));
+    }
+
+public:
+    ~ActiveSet() {
+        delete[] members;
+        delete[] bitmap;
+    }
+
+    void begin(int maxIndex) {
+        capacity = maxIndex;
+        members = new uint16_t[capacity];
+        bitmap = new uint32_t[(capacity + 31) / 32];
+        clear();
+    }
+
+    void clear() {
+        count = 0;
+        memset(bitmap, 0, ((capacity + 31) / 32) * sizeof(uint32_t));
+    }
+
+    int size() const {
+        return count;
+    }
+
+    bool contains(int index) const {
+        return testBit(index);
+    }
+
+    // Member at a position in the dense list (0 .. size() - 1)
+    int at(int position) const {
+        return members[position];
+    }
+
+    void insert(int index) {
+        if (index < 0 || index >= capacity || testBit(index)) return;
+        bitmap[index >> 5] |= 1UL << (index & 31);
+        members[count++] = index;
+    }
+
+    // Remove by list position; the last member moves into its place, so when
+    // iterating, revisit the same position instead of advancing.
+    void removeAt(int position) {
+        int index = members[position];
+        bitmap[index >> 5] &= ~(1UL << (index & 31));
+        members[position] = members[--count];
+    }
+};
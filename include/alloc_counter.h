@@ -0,0 +1,57 @@
+#pragma once
+#include <Arduino.h>
+
+// Counts heap allocations so the render loop and the command paths can be
+// checked for steady-state allocations. Only active in builds made with
+// TRACK_ALLOCATIONS and the linker wraps for malloc, calloc and realloc
+// (the esp32dev-alloc environment); otherwise count() stays at zero.
+//
+// The wrappers are plain definitions, so this header must only be included
+// from one translation unit (src/main.cpp).
+class AllocCounter {
+public:
+    static volatile uint32_t& counter() {
+        static volatile uint32_t allocations = 0;
+        return allocations;
+    }
+
+    static void record() {
+        __atomic_fetch_add(&counter(), 1, __ATOMIC_RELAXED);
+    }
+
+    static bool enabled() {
+#ifdef TRACK_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Allocations since boot
+    static uint32_t count() {
+        return counter();
+    }
+};
+
+#ifdef TRACK_ALLOCATIONS
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    AllocCounter::record();
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    AllocCounter::record();
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    AllocCounter::record();
+    return __real_realloc(ptr, size);
+}
+}
+#endif
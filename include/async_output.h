@@ -0,0 +1,244 @@
+#pragma once
+#include <Arduino.h>
+#include <FastLED.h>
+#include "config.h"
+#include "pixel_kernels.h"
+#include "event_trace.h"
+
+// Sends frames to the strip from a task on the other core, so rendering
+// frame N+1 overlaps the wire time of frame N (about 30 us per LED).
+//
+// The render loop keeps drawing into its own strip buffer (the back buffer).
+// show() waits only if the previous frame is still on the wire, copies the
+// LEDs that changed into the task's copy of the frame and returns while the
+// task sends it.
+//
+// With dithering on, the task applies brightness itself at 16-bit precision
+// and quantizes with temporal dithering (PixelKernels::scaleDither), so dim
+// output keeps the effect's full 256 levels instead of a handful. It also
+// resends the last frame every OUTPUT_DITHER_REFRESH_MS while no new one
+// arrives, since dithering only averages out at a high refresh rate; park()
+// stops that while the light is off. A resend holds the wire for a whole
+// frame, so it is skipped while frames are still coming and it would not be
+// done by the time the next one is due; show() never waits behind one.
+//
+// schedule() holds the next frame back until a given time, for a fan-out
+// leader showing its part together with its followers; the loop goes on
+// rendering meanwhile.
+class AsyncOutput {
+public:
+    // Sends one frame and returns when it is on the wire
+    typedef void (*SendFunction)(const CRGB* frame, int numLeds, uint8_t brightness);
+
+    // FastLED sends whatever was registered with addLeds: the front buffer
+    static void sendFastLED(const CRGB*, int, uint8_t brightness) {
+        FastLED.show(brightness);
+    }
+
+private:
+    const CRGB* source;
+    int numLeds;
+    CRGB* frame = nullptr;            // Latest frame at full brightness, owned by the task once handed over
+    CRGB* front = nullptr;            // What goes on the wire
+    uint8_t* ditherError = nullptr;   // Per-channel fraction carried between sends; null without dithering
+    SendFunction send = nullptr;
+
+    SemaphoreHandle_t frameReady = nullptr;   // Given by show(), taken by the task
+    SemaphoreHandle_t wireIdle = nullptr;     // Held while the task owns frame and front
+    TaskHandle_t task = nullptr;
+    volatile uint8_t frameBrightness = 255;
+    volatile bool stopping = false;
+    volatile bool parked = false;
+    volatile bool scheduled = false;
+    volatile uint32_t sendAt = 0;     // micros() the scheduled frame goes out at
+    bool nextScheduled = false;       // Set by schedule(), handed over with the next frame
+    uint32_t nextSendAt = 0;
+
+    uint32_t lastWaitUs = 0;
+    uint32_t totalWaitUs = 0;
+    uint32_t frames = 0;
+    volatile uint32_t lastSendAt = 0;      // micros() the last send started
+    volatile uint32_t lastSendUs = 0;
+    volatile uint32_t frameSendUs = 0;     // Send time of new frames, dither resends left out
+    volatile uint32_t framesSent = 0;
+    volatile uint32_t lastShowAt = 0;      // micros() of the last show()
+    volatile uint32_t frameIntervalUs = 0;  // Smoothed time between show() calls
+
+    void sendFrame() {
+        TRACE_SCOPE("wire", 0);
+        uint32_t start = micros();
+        lastSendAt = start;
+        if (ditherError) {
+            PixelKernels::scaleDither(front, frame, ditherError, numLeds, frameBrightness);
+            send(front, numLeds, 255);
+        } else {
+            memcpy(front, frame, numLeds * sizeof(CRGB));
+            send(front, numLeds, frameBrightness);
+        }
+        lastSendUs = micros() - start;
+    }
+
+    // Whether a dither resend would be off the wire, with OUTPUT_REFRESH_MARGIN_US
+    // to spare, before show() hands over the next frame. It starts once the wire
+    // frees up from the last send and holds it as long again. Once frames have
+    // stopped there is nothing to wait for; before the second frame there is no
+    // interval to go by yet.
+    bool refreshFits() {
+        uint32_t interval = frameIntervalUs;
+        if (interval == 0) return false;
+        uint32_t now = micros();
+        uint32_t sinceShow = now - lastShowAt;
+        if (sinceShow >= 2 * interval) return true;
+        int32_t busyFor = (int32_t)(lastSendAt + lastSendUs - now);
+        uint32_t start = sinceShow + (busyFor > 0 ? busyFor : 0);
+        return start + lastSendUs + OUTPUT_REFRESH_MARGIN_US <= interval;
+    }
+
+    // Hold a scheduled frame until its time
+    void waitForSchedule() {
+        if (!scheduled) return;
+        scheduled = false;
+        int32_t wait = (int32_t)(sendAt - micros());
+        if (wait <= 0) return;
+        delay(wait / 1000);
+        delayMicroseconds(wait % 1000);
+    }
+
+    static void run(void* arg) {
+        AsyncOutput* self = static_cast<AsyncOutput*>(arg);
+        while (true) {
+            uint32_t refresh = self->ditherError && !self->parked ? pdMS_TO_TICKS(OUTPUT_DITHER_REFRESH_MS)
+                                                                  : portMAX_DELAY;
+            bool fresh = xSemaphoreTake(self->frameReady, refresh) == pdTRUE;
+            if (!fresh) {
+                // No new frame: resend the last one so the dither keeps moving,
+                // unless the next frame is due first or show() is handing one over right now
+                if (!self->refreshFits()) continue;
+                if (xSemaphoreTake(self->wireIdle, 0) != pdTRUE) continue;
+            }
+            if (self->stopping) break;
+            self->waitForSchedule();
+            self->sendFrame();
+            if (fresh) {
+                self->frameSendUs += self->lastSendUs;
+                self->framesSent++;
+            }
+            xSemaphoreGive(self->wireIdle);
+        }
+        xSemaphoreGive(self->wireIdle);
+        vTaskDelete(nullptr);
+    }
+
+public:
+    AsyncOutput(const CRGB* backBuffer, int numLeds) : source(backBuffer), numLeds(numLeds) {
+    }
+
+    ~AsyncOutput() {
+        if (task == nullptr) return;
+        xSemaphoreTake(wireIdle, portMAX_DELAY);
+        stopping = true;
+        xSemaphoreGive(frameReady);
+        xSemaphoreTake(wireIdle, portMAX_DELAY);   // Task has exited
+        vSemaphoreDelete(frameReady);
+        vSemaphoreDelete(wireIdle);
+        delete[] frame;
+        delete[] front;
+        delete[] ditherError;
+    }
+
+    // Allocate the buffers and start the output task
+    void begin(SendFunction sendFrame = sendFastLED, bool dither = OUTPUT_DITHER) {
+        send = sendFrame;
+        frame = new CRGB[numLeds];
+        front = new CRGB[numLeds];
+        memcpy(frame, source, numLeds * sizeof(CRGB));
+        memcpy(front, source, numLeds * sizeof(CRGB));
+        if (dither) {
+            // Start every channel at a different phase so dim areas shimmer rather than pulse together
+            ditherError = new uint8_t[numLeds * sizeof(CRGB)];
+            for (int i = 0; i < numLeds * (int)sizeof(CRGB); i++) {
+                ditherError[i] = i * 97;
+            }
+        }
+        frameReady = xSemaphoreCreateBinary();
+        wireIdle = xSemaphoreCreateBinary();
+        xSemaphoreGive(wireIdle);
+        xTaskCreatePinnedToCore(run, "led_output", OUTPUT_TASK_STACK, this, OUTPUT_TASK_PRIORITY, &task, OUTPUT_TASK_CORE);
+    }
+
+    // Buffer the LED driver should be registered with
+    CRGB* frontBuffer() {
+        return front;
+    }
+
+    bool dithering() const {
+        return ditherError != nullptr;
+    }
+
+    // Start sending the back buffer; LEDs outside [start, end) are unchanged since the last call
+    void show(uint8_t brightness, int start = 0, int end = -1) {
+        if (end < 0) end = numLeds;
+
+        uint32_t waitStart = micros();
+        uint32_t interval = waitStart - lastShowAt;
+        if (interval < 1000000) {
+            frameIntervalUs = frameIntervalUs ? (frameIntervalUs * 3 + interval) / 4 : interval;
+        }
+        lastShowAt = waitStart;
+        xSemaphoreTake(wireIdle, portMAX_DELAY);
+        lastWaitUs = micros() - waitStart;
+        totalWaitUs += lastWaitUs;
+        frames++;
+
+        if (start < end) {
+            memcpy(frame + start, source + start, (end - start) * sizeof(CRGB));
+        }
+        frameBrightness = brightness;
+        // Handed over with the frame, so a dither resend never waits for it
+        sendAt = nextSendAt;
+        scheduled = nextScheduled;
+        nextScheduled = false;
+        xSemaphoreGive(frameReady);
+    }
+
+    // Send the next show()'s frame at atMicros rather than straight away
+    void schedule(uint32_t atMicros) {
+        nextSendAt = atMicros;
+        nextScheduled = true;
+    }
+
+    // Block until the last frame is out, e.g. before reconfiguring the driver
+    void flush() {
+        xSemaphoreTake(wireIdle, portMAX_DELAY);
+        xSemaphoreGive(wireIdle);
+    }
+
+    // While parked the task only wakes for a new frame, with no dither refresh in between
+    void park(bool park) {
+        parked = park;
+    }
+
+    // Time the last show() spent waiting for the previous frame
+    uint32_t lastWait() const {
+        return lastWaitUs;
+    }
+
+    uint32_t meanWait() const {
+        return frames ? totalWaitUs / frames : 0;
+    }
+
+    // Time the task took to send the last frame, dithering included
+    uint32_t lastSend() const {
+        return lastSendUs;
+    }
+
+    // Total send time of the frames handed to show() and how many were sent, since begin();
+    // after flush() they include the last one. Differences stay right when the total wraps.
+    uint32_t sentFrameUs() const {
+        return frameSendUs;
+    }
+
+    uint32_t sentFrames() const {
+        return framesSent;
+    }
+};
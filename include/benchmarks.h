@@ -0,0 +1,457 @@
+#pragma once
+#include <Arduino.h>
+#include <FastLED.h>
+#include "config.h"
+#include "planter_layout.h"
+#include "effects.h"
+#include "pixel_kernels.h"
+#include "presenter.h"
+#include "async_output.h"
+#include "compositor.h"
+#include "transition.h"
+#include "interpolator.h"
+#include "power_model.h"
+#include "effect_vm.h"
+#include "alloc_counter.h"
+#include "palettes.h"
+
+// On-device render benchmarks. Build with -D RUN_BENCHMARKS to run them once
+// from setup(); results are printed to the serial console and nothing is
+// sent to the strip.
+class Benchmarks {
+private:
+    static const int FRAME_BUDGET_US = 16667;  // 60 fps
+    static const int BENCH_FRAMES = 600;
+    static const int KERNEL_REPS = 1000;
+
+    static void report(const char* name, int numLeds, uint32_t totalUs, int frames) {
+        uint32_t meanUs = totalUs / frames;
+        Serial.printf("  %-12s %4d LEDs: %6lu us/frame (%s 60 fps)\n",
+                      name, numLeds, meanUs,
+                      meanUs <= FRAME_BUDGET_US ? "holds" : "misses");
+    }
+
+    static void water(int numLeds) {
+        CRGB* buffer = new CRGB[numLeds];
+        PlanterLayout benchLayout;
+        benchLayout.begin(numLeds);
+        Effects benchEffects(buffer, numLeds, &benchLayout);
+        Presenter benchPresenter(buffer, numLeds);
+        const EffectInfo* effect = Effects::find("water");
+
+        // Group-resolution render plus the upscale pass, without wire output. The
+        // first frame rebuilds the surface, which happens once per epoch; leave it out
+        benchEffects.render(effect->name, CRGB::Blue);
+        uint32_t start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            benchEffects.render(effect->name, CRGB::Blue);
+            benchPresenter.upscale(benchEffects.output(effect), benchEffects.outputSize(effect), effect->upscale);
+        }
+        report("water", numLeds, micros() - start, BENCH_FRAMES);
+
+        delete[] buffer;
+    }
+
+    // Default three-layer scene and a static single-layer scene against
+    // rendering ripple alone; times are per frame, without wire output
+    static void compositor(int numLeds) {
+        CRGB* buffer = new CRGB[numLeds];
+        PlanterLayout benchLayout;
+        benchLayout.begin(numLeds);
+
+        Effects single(buffer, numLeds, &benchLayout);
+        Presenter benchPresenter(buffer, numLeds);
+        const EffectInfo* ripple = Effects::find("ripple");
+        uint32_t start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            single.render(ripple->name, CRGB::Blue);
+            benchPresenter.upscale(single.output(ripple), single.outputSize(ripple), ripple->upscale);
+        }
+        report("ripple", numLeds, micros() - start, BENCH_FRAMES);
+
+        // Every layer is forced to render every frame by stepping time past its interval
+        Compositor scene(buffer, numLeds, &benchLayout);
+        scene.begin();
+        uint32_t now = 0;
+        start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            now += 100;
+            scene.render(CRGB::Blue, now);
+        }
+        report("scene x3", numLeds, micros() - start, BENCH_FRAMES);
+
+        Compositor::LayerConfig still[] = { { "solid", "all", BlendMode::NORMAL, 255 } };
+        scene.setLayers(still, 1);
+        start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            now += 100;
+            scene.render(CRGB::Blue, now);
+        }
+        report("scene static", numLeds, micros() - start, BENCH_FRAMES);
+
+        delete[] buffer;
+    }
+
+    // Water on its own against water fading in over ripple; the transition
+    // clock is held at mid-fade so every frame pays for both effects
+    static void transition(int numLeds) {
+        CRGB* buffer = new CRGB[numLeds];
+        PlanterLayout benchLayout;
+        benchLayout.begin(numLeds);
+        Effects benchEffects(buffer, numLeds, &benchLayout);
+        Presenter benchPresenter(buffer, numLeds);
+        Transition fade(buffer, numLeds);
+        fade.begin();
+        const EffectInfo* water = Effects::find("water");
+        const EffectInfo* ripple = Effects::find("ripple");
+
+        uint32_t start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            benchEffects.render(water, CRGB::Blue);
+            benchPresenter.upscale(benchEffects.output(water), benchEffects.outputSize(water), water->upscale);
+        }
+        report("no fade", numLeds, micros() - start, BENCH_FRAMES);
+
+        uint32_t now = 0;
+        start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            now += 100;
+            fade.start(ripple, 0, now - EFFECT_TRANSITION_MS / 2);
+            benchEffects.render(water, CRGB::Blue);
+            benchPresenter.upscale(benchEffects.output(water), benchEffects.outputSize(water), water->upscale);
+            fade.apply(benchEffects, CRGB::Blue, now);
+        }
+        report("crossfade", numLeds, micros() - start, BENCH_FRAMES);
+
+        delete[] buffer;
+    }
+
+    // Ripple rendered natively at 60 fps against keyframes at its own interval
+    // with interpolated frames in between; the clock advances 16 ms per frame
+    static void interpolation(int numLeds) {
+        CRGB* buffer = new CRGB[numLeds];
+        PlanterLayout benchLayout;
+        benchLayout.begin(numLeds);
+        Effects benchEffects(buffer, numLeds, &benchLayout);
+        Presenter benchPresenter(buffer, numLeds);
+        Interpolator benchInterpolator;
+        benchInterpolator.begin(benchEffects.interpolatedSize());
+        const EffectInfo* ripple = Effects::find("ripple");
+        int size = benchEffects.outputSize(ripple);
+
+        uint32_t start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            benchEffects.render(ripple, CRGB::Blue);
+            benchPresenter.upscale(benchEffects.output(ripple), size, ripple->upscale);
+        }
+        report("ripple 60fps", numLeds, micros() - start, BENCH_FRAMES);
+
+        uint32_t now = 0;
+        start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            now += INTERPOLATED_FRAME_MS;
+            if (benchInterpolator.due(now, ripple->frameMs)) {
+                benchEffects.render(ripple, CRGB::Blue);
+                benchInterpolator.keyframe(benchEffects.output(ripple), size, now, ripple->frameMs);
+            }
+            benchPresenter.upscale(benchInterpolator.frame(now), size, ripple->upscale);
+        }
+        report("interpolated", numLeds, micros() - start, BENCH_FRAMES);
+
+        delete[] buffer;
+    }
+
+    // Sine wave with sparkles (tools/programs/wave.vms) in the VM against the same effect in C++
+    static void vm(int numLeds) {
+        typedef EffectVM VM;
+        static const uint8_t frameCode[] = {
+            VM::OP_LOAD, VM::VAR_T, VM::OP_PUSH8, 2, VM::OP_MUL, VM::OP_STORE, VM::VAR_GLOBAL0,
+            VM::OP_END
+        };
+        static const uint8_t pixelCode[] = {
+            VM::OP_RAND, VM::OP_PUSH8, 4, VM::OP_LT, VM::OP_JZ, 11,
+            VM::OP_PUSH16, 255, 0, VM::OP_PUSH16, 255, 0, VM::OP_PUSH16, 255, 0, VM::OP_OUT, VM::OP_END,
+            VM::OP_LOAD, VM::VAR_PHASE, VM::OP_LOAD, VM::VAR_GLOBAL0, VM::OP_ADD, VM::OP_SIN8,
+            VM::OP_LOAD, VM::VAR_R, VM::OP_OVER, VM::OP_SCALE8, VM::OP_SWAP,
+            VM::OP_LOAD, VM::VAR_G, VM::OP_OVER, VM::OP_SCALE8, VM::OP_SWAP,
+            VM::OP_LOAD, VM::VAR_B, VM::OP_SWAP, VM::OP_SCALE8, VM::OP_OUT, VM::OP_END
+        };
+        uint8_t program[VM::HEADER_SIZE + sizeof(frameCode) + sizeof(pixelCode)] = {
+            'L', 'V', 'M', 1, sizeof(frameCode), 0, sizeof(pixelCode), 0
+        };
+        memcpy(program + VM::HEADER_SIZE, frameCode, sizeof(frameCode));
+        memcpy(program + VM::HEADER_SIZE + sizeof(frameCode), pixelCode, sizeof(pixelCode));
+
+        CRGB* buffer = new CRGB[numLeds];
+        PlanterLayout benchLayout;
+        benchLayout.begin(numLeds);
+        const CRGB color = CRGB::Blue;
+
+        VM benchVM;
+        const char* error;
+        if (!benchVM.use(program, sizeof(program), error)) {
+            Serial.printf("  vm program rejected: %s\n", error);
+            delete[] buffer;
+            return;
+        }
+        uint32_t start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            benchVM.render(buffer, numLeds, &benchLayout, color);
+        }
+        report("vm wave", numLeds, micros() - start, BENCH_FRAMES);
+
+        start = micros();
+        for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+            uint8_t offset = frame * 2;
+            for (int i = 0; i < numLeds; i++) {
+                if (random8() < 4) {
+                    buffer[i] = CRGB(255, 255, 255);
+                    continue;
+                }
+                uint8_t level = sin8(benchLayout.phase(i) + offset);
+                buffer[i] = CRGB(scale8(color.r, level), scale8(color.g, level), scale8(color.b, level));
+            }
+        }
+        report("native wave", numLeds, micros() - start, BENCH_FRAMES);
+
+        delete[] buffer;
+    }
+
+    template<typename F>
+    static uint32_t timeReps(F body) {
+        uint32_t start = micros();
+        for (int rep = 0; rep < KERNEL_REPS; rep++) {
+            body();
+        }
+        return micros() - start;
+    }
+
+    static void compare(const char* name, int numLeds, uint32_t kernelUs, uint32_t pixelUs) {
+        uint32_t divisor = kernelUs ? kernelUs : 1;
+        Serial.printf("  %-12s %4d LEDs: kernel %5lu ns, per-pixel %5lu ns (%lu.%02lux)\n",
+                      name, numLeds,
+                      kernelUs * 1000 / KERNEL_REPS, pixelUs * 1000 / KERNEL_REPS,
+                      pixelUs / divisor, (pixelUs * 100 / divisor) % 100);
+    }
+
+    // Each kernel against the per-pixel CRGB method it replaces
+    static void kernels(int numLeds) {
+        CRGB* a = new CRGB[numLeds];
+        CRGB* b = new CRGB[numLeds];
+        PixelKernels::fill(b, numLeds, CRGB(40, 80, 120));
+        const CRGB color(200, 100, 50);
+
+        compare("fill", numLeds,
+                timeReps([&] { PixelKernels::fill(a, numLeds, color); }),
+                timeReps([&] { for (int i = 0; i < numLeds; i++) a[i] = color; }));
+        compare("fade", numLeds,
+                timeReps([&] { PixelKernels::fade(a, numLeds, 1); }),
+                timeReps([&] { for (int i = 0; i < numLeds; i++) a[i].fadeToBlackBy(1); }));
+        compare("scale", numLeds,
+                timeReps([&] { PixelKernels::scale(a, numLeds, 254); }),
+                timeReps([&] { for (int i = 0; i < numLeds; i++) a[i].nscale8(254); }));
+        compare("add", numLeds,
+                timeReps([&] { PixelKernels::add(a, b, numLeds); }),
+                timeReps([&] { for (int i = 0; i < numLeds; i++) a[i] += b[i]; }));
+        compare("add color", numLeds,
+                timeReps([&] { PixelKernels::add(a, numLeds, color); }),
+                timeReps([&] { for (int i = 0; i < numLeds; i++) a[i] += color; }));
+        compare("blend", numLeds,
+                timeReps([&] { PixelKernels::blend(a, b, numLeds, 128); }),
+                timeReps([&] { for (int i = 0; i < numLeds; i++) nblend(a[i], b[i], 128); }));
+
+        delete[] a;
+        delete[] b;
+    }
+
+    // Power estimate after a full frame and after one changed group, against
+    // rescanning every pixel each frame the way FastLED's limiter does
+    static void power(int numLeds) {
+        CRGB* a = new CRGB[numLeds];
+        PixelKernels::fill(a, numLeds, CRGB(200, 100, 50));
+        PowerModel model(a, numLeds);
+        model.begin();
+        volatile uint32_t sink = 0;
+        uint32_t rescanUs = timeReps([&] {
+            uint32_t total = 0;
+            for (int i = 0; i < numLeds; i++) total += a[i].r + a[i].g + a[i].b;
+            sink = total;
+        });
+
+        compare("power full", numLeds,
+                timeReps([&] { model.update(0, numLeds); sink = model.limit(255); }),
+                rescanUs);
+        compare("power group", numLeds,
+                timeReps([&] { model.update(0, LED_GROUP_SIZE); sink = model.limit(255); }),
+                rescanUs);
+        (void)sink;
+
+        delete[] a;
+    }
+
+    // Cached palette table against FastLED's ColorFromPalette interpolating
+    // a 16-entry palette for every pixel, indexed by the planter's phase
+    static void palettes(int numLeds) {
+        CRGB* a = new CRGB[numLeds];
+        PlanterLayout benchLayout;
+        benchLayout.begin(numLeds);
+        const uint8_t* phases = benchLayout.phases();
+        const CRGB* table = Palettes::table(Palettes::find("ocean"));
+        CRGBPalette16 gradient;
+        for (int k = 0; k < 16; k++) {
+            gradient[k] = table[k * 17];
+        }
+        uint8_t offset = 0;
+
+        compare("palette", numLeds,
+                timeReps([&] { PixelKernels::lookup(a, numLeds, table, phases, offset++); }),
+                timeReps([&] {
+                    for (int i = 0; i < numLeds; i++) a[i] = ColorFromPalette(gradient, phases[i] + offset, 255, LINEARBLEND);
+                    offset++;
+                }));
+
+        delete[] a;
+    }
+
+    // One-off cost of building a table when a palette is first selected
+    static void paletteExpand() {
+        int count;
+        const Palettes::Info* registry = Palettes::registry(count);
+        CRGB table[256];
+        uint32_t start = micros();
+        for (int rep = 0; rep < KERNEL_REPS; rep++) {
+            Palettes::expand(registry[rep % count], table);
+        }
+        Serial.printf("  %-12s %lu ns per palette\n", "expand", (micros() - start) * 1000 / KERNEL_REPS);
+    }
+
+public:
+    // Stand-in for the strip: holds the sender for the frame's wire time
+    static void mockWire(const CRGB* frame, int numLeds, uint8_t brightness) {
+        delayMicroseconds(numLeds * WIRE_US_PER_LED);
+    }
+
+    // Water plus output against a mock strip, sending inline against
+    // sending from the output task while the next frame renders
+    static void output(int numLeds) {
+        CRGB* buffer = new CRGB[numLeds];
+        PlanterLayout benchLayout;
+        benchLayout.begin(numLeds);
+        Effects benchEffects(buffer, numLeds, &benchLayout);
+        Presenter benchPresenter(buffer, numLeds);
+        const EffectInfo* effect = Effects::find("water");
+        const int frames = BENCH_FRAMES / 10;
+
+        uint32_t start = micros();
+        for (int frame = 0; frame < frames; frame++) {
+            benchEffects.render(effect, CRGB::Blue);
+            benchPresenter.upscale(benchEffects.output(effect), benchEffects.outputSize(effect), effect->upscale);
+            mockWire(buffer, numLeds, 255);
+        }
+        report("sync show", numLeds, micros() - start, frames);
+
+        {
+            AsyncOutput benchOutput(buffer, numLeds);
+            benchOutput.begin(mockWire, false);
+            start = micros();
+            for (int frame = 0; frame < frames; frame++) {
+                benchEffects.render(effect, CRGB::Blue);
+                benchPresenter.upscale(benchEffects.output(effect), benchEffects.outputSize(effect), effect->upscale);
+                benchOutput.show(255);
+            }
+            benchOutput.flush();
+            report("async show", numLeds, micros() - start, frames);
+            Serial.printf("  %-12s %4d LEDs: %6lu us/frame waiting for the wire\n",
+                          "", numLeds, (unsigned long)benchOutput.meanWait());
+        }
+
+        // Output stage alone: the 8-bit copy against 16-bit brightness with dithering
+        CRGB* front = new CRGB[numLeds];
+        uint8_t* error = new uint8_t[numLeds * sizeof(CRGB)]();
+        start = micros();
+        for (int rep = 0; rep < KERNEL_REPS; rep++) {
+            memcpy(front, buffer, numLeds * sizeof(CRGB));
+        }
+        uint32_t copyUs = micros() - start;
+        start = micros();
+        for (int rep = 0; rep < KERNEL_REPS; rep++) {
+            PixelKernels::scaleDither(front, buffer, error, numLeds, 24);
+        }
+        uint32_t ditherUs = micros() - start;
+        Serial.printf("  %-12s %4d LEDs: 8-bit copy %5lu ns, 16-bit dither %5lu ns per frame\n",
+                      "output stage", numLeds,
+                      copyUs * 1000 / KERNEL_REPS, ditherUs * 1000 / KERNEL_REPS);
+
+        delete[] error;
+        delete[] front;
+        delete[] buffer;
+    }
+
+    // Heap allocations per effect once it has warmed up; any non-zero count
+    // in the steady state is reported as a failure (TRACK_ALLOCATIONS builds)
+    static void allocations(int numLeds) {
+        CRGB* buffer = new CRGB[numLeds];
+        PlanterLayout benchLayout;
+        benchLayout.begin(numLeds);
+        Effects benchEffects(buffer, numLeds, &benchLayout);
+        Presenter benchPresenter(buffer, numLeds);
+        PowerModel benchPower(buffer, numLeds);
+        benchPower.begin();
+
+        int count;
+        const EffectInfo* table = Effects::registry(count);
+        for (int i = 0; i < count; i++) {
+            const EffectInfo* effect = &table[i];
+            uint32_t before = 0;
+            for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+                if (frame == 1) before = AllocCounter::count();   // Frame 0 may allocate lazily
+                if (frame == 0) benchEffects.start(effect);
+                int dirtyStart, dirtyEnd;
+                benchEffects.render(effect, CRGB::Blue);
+                benchEffects.dirtyRange(dirtyStart, dirtyEnd);
+                benchPresenter.stripRange(effect->upscale, dirtyStart, dirtyEnd);
+                benchPresenter.upscale(benchEffects.output(effect), benchEffects.outputSize(effect), effect->upscale);
+                benchPower.update(dirtyStart, dirtyEnd);
+                benchPower.limit(255);
+            }
+            uint32_t allocated = AllocCounter::count() - before;
+            Serial.printf("  %-12s %4d LEDs: %lu allocations (%s)\n", effect->name, numLeds,
+                          (unsigned long)allocated, allocated == 0 ? "ok" : "FAIL");
+        }
+
+        delete[] buffer;
+    }
+
+    static void runAll() {
+        Serial.println("Running render benchmarks...");
+        water(120);
+        water(1000);
+        compositor(120);
+        compositor(1000);
+        transition(120);
+        transition(1000);
+        interpolation(120);
+        interpolation(1000);
+        vm(120);
+        vm(1000);
+
+        Serial.printf("Pixel kernels (%s):\n", PixelKernels::backend());
+        kernels(120);
+        kernels(1000);
+        power(120);
+        power(1000);
+        palettes(120);
+        palettes(1000);
+        paletteExpand();
+
+        Serial.println("Strip output (mock wire):");
+        output(120);
+        output(1000);
+
+        if (AllocCounter::enabled()) {
+            Serial.println("Steady-state allocations:");
+            allocations(120);
+        }
+        Serial.println("Benchmarks complete");
+    }
+};
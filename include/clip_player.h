@@ -0,0 +1,341 @@
+#pragma once
+#include <Arduino.h>
+#include <FastLED.h>
+#include <LittleFS.h>
+#include "config.h"
+#include "pixel_kernels.h"
+
+// Prerendered animation clips stored in LittleFS (see tools/clip_encoder.py).
+//
+// A clip file is a 12-byte header followed by its frames. Each frame is a
+// 16-bit byte length and a list of ops, each op covering 1-64 pixels
+// (count - 1 in the low 6 bits):
+//   00nnnnnn            skip, pixels unchanged from the previous frame
+//   01nnnnnn r g b      run of one color
+//   10nnnnnn rgb...     literal pixels
+// Frame 0 never skips, so looping back to it needs no clear. Frames are
+// streamed from the file straight into the player's frame buffer; only one
+// frame is ever held in RAM.
+//
+// Uploads go to a temporary file, one at a time. A finished upload is handed
+// to the render loop, which closes every player reading the clip it replaces
+// before swapping the new file in.
+class ClipPlayer {
+public:
+    struct Header {
+        char magic[4];         // "LCLP"
+        uint8_t version;
+        uint8_t flags;
+        uint16_t numLeds;
+        uint16_t frameCount;
+        uint16_t frameMs;      // Frame interval the clip was rendered at
+    };
+    static_assert(sizeof(Header) == 12, "Clip header must match the file layout");
+
+    static const uint8_t VERSION = 1;
+    static const uint8_t FLAG_LOOP = 0x01;
+    static const int NAME_LENGTH = 24;
+
+private:
+    static const uint8_t OP_MASK = 0xC0;
+    static const uint8_t OP_SKIP = 0x00;
+    static const uint8_t OP_RUN = 0x40;
+    static const uint8_t OP_LITERAL = 0x80;
+    static const int MAX_CATCH_UP = 2;   // Frames decoded per tick when running behind
+
+    // Clip selection shared by every player, written by the web handler and
+    // copied out by the loop, both under selectionLock()
+    struct Selection {
+        char name[NAME_LENGTH];
+        uint16_t frameMs;   // 0 plays at the clip's own rate
+        int8_t loop;        // -1 follows the clip's loop flag
+    };
+    static Selection& selection() {
+        static Selection current = { "", 0, -1 };
+        return current;
+    }
+    static volatile uint32_t& selectionId() {
+        static volatile uint32_t id = 1;
+        return id;
+    }
+    static portMUX_TYPE& selectionLock() {
+        static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+        return lock;
+    }
+
+    // Upload handoff between the web server task and the loop
+    enum UploadState : uint8_t { UPLOAD_IDLE, UPLOAD_RECEIVING, UPLOAD_INSTALLING };
+    struct Upload {
+        UploadState state;
+        char name[NAME_LENGTH];
+        portMUX_TYPE lock;
+    };
+    static Upload& upload() {
+        static Upload current = { UPLOAD_IDLE, "", portMUX_INITIALIZER_UNLOCKED };
+        return current;
+    }
+
+    // Every player, so an install can close the ones reading the old file
+    static ClipPlayer*& players() {
+        static ClipPlayer* head = nullptr;
+        return head;
+    }
+    ClipPlayer* nextPlayer = nullptr;
+
+    File file;
+    char openName[NAME_LENGTH] = "";
+    Header header;
+    CRGB* frame = nullptr;
+    int numLeds;
+    uint32_t openedId = 0;
+    uint16_t frameIndex = 0;
+    uint16_t frameMs = 0;
+    bool looping = false;
+    bool playing = false;
+    uint32_t nextFrameAt = 0;
+
+    bool open() {
+        playing = false;
+        if (file) file.close();
+
+        portENTER_CRITICAL(&selectionLock());
+        Selection current = selection();
+        openedId = selectionId();
+        portEXIT_CRITICAL(&selectionLock());
+        char name[NAME_LENGTH];
+        strncpy(name, current.name, NAME_LENGTH);
+        name[NAME_LENGTH - 1] = '\0';
+        if (name[0] == '\0' && !firstClip(name)) return false;
+
+        char clipPath[48];
+        file = LittleFS.open(path(name, clipPath, sizeof(clipPath)), FILE_READ);
+        if (!file || !readHeader(file, header, numLeds)) {
+            Serial.printf("Clip '%s' missing or not for %d LEDs\n", name, numLeds);
+            if (file) file.close();
+            return false;
+        }
+        strcpy(openName, name);
+        frameMs = current.frameMs ? current.frameMs : header.frameMs;
+        looping = current.loop < 0 ? (header.flags & FLAG_LOOP) : current.loop;
+        frameIndex = 0;
+        playing = true;
+        Serial.printf("Playing clip '%s': %u frames, %u ms/frame\n", name, header.frameCount, frameMs);
+        return true;
+    }
+
+    // Name of the first clip in the directory, used when nothing is selected
+    static bool firstClip(char* name) {
+        File dir = LittleFS.open(CLIP_DIRECTORY);
+        if (!dir || !dir.isDirectory()) return false;
+        for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+            const char* fileName = entry.name();
+            const char* ext = strrchr(fileName, '.');
+            if (ext && strcmp(ext, ".clp") == 0 && ext - fileName < NAME_LENGTH) {
+                memcpy(name, fileName, ext - fileName);
+                name[ext - fileName] = '\0';
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Decode the next frame into the frame buffer; false on a corrupt or truncated file
+    bool decodeFrame(int& dirtyStart, int& dirtyEnd) {
+        uint16_t length;
+        if (file.read((uint8_t*)&length, sizeof(length)) != sizeof(length)) return false;
+
+        int pos = 0;
+        uint32_t consumed = 0;
+        while (consumed < length) {
+            int op = file.read();
+            if (op < 0) return false;
+            int count = (op & ~OP_MASK) + 1;
+            if (pos + count > numLeds) return false;
+            consumed++;
+
+            switch (op & OP_MASK) {
+                case OP_SKIP:
+                    break;
+                case OP_RUN: {
+                    CRGB color;
+                    if (file.read(color.raw, 3) != 3) return false;
+                    PixelKernels::fill(frame + pos, count, color);
+                    consumed += 3;
+                    break;
+                }
+                case OP_LITERAL:
+                    if (file.read((uint8_t*)(frame + pos), count * 3) != (size_t)count * 3) return false;
+                    consumed += count * 3;
+                    break;
+                default:
+                    return false;
+            }
+            if ((op & OP_MASK) != OP_SKIP) {
+                if (pos < dirtyStart) dirtyStart = pos;
+                if (pos + count > dirtyEnd) dirtyEnd = pos + count;
+            }
+            pos += count;
+        }
+        return consumed == length;
+    }
+
+public:
+    ClipPlayer(int numLeds) : numLeds(numLeds) {
+        nextPlayer = players();
+        players() = this;
+    }
+
+    ~ClipPlayer() {
+        for (ClipPlayer** p = &players(); *p; p = &(*p)->nextPlayer) {
+            if (*p == this) {
+                *p = nextPlayer;
+                break;
+            }
+        }
+        delete[] frame;
+    }
+
+    // Temporary file an upload is written to
+    static const char* uploadPath(char* buffer, size_t size) {
+        return path("upload", buffer, size, ".tmp");
+    }
+
+    // Web server task: claim the upload file; false while another upload is received or installed
+    static bool beginUpload() {
+        Upload& u = upload();
+        portENTER_CRITICAL(&u.lock);
+        bool available = u.state == UPLOAD_IDLE;
+        if (available) u.state = UPLOAD_RECEIVING;
+        portEXIT_CRITICAL(&u.lock);
+        return available;
+    }
+
+    // Web server task: the upload is complete and checked; the loop installs it under this name
+    static void finishUpload(const char* name) {
+        Upload& u = upload();
+        portENTER_CRITICAL(&u.lock);
+        strncpy(u.name, name, NAME_LENGTH - 1);
+        u.name[NAME_LENGTH - 1] = '\0';
+        u.state = UPLOAD_INSTALLING;
+        portEXIT_CRITICAL(&u.lock);
+    }
+
+    // Web server task: the upload failed or was abandoned and its file removed
+    static void abandonUpload() {
+        Upload& u = upload();
+        portENTER_CRITICAL(&u.lock);
+        u.state = UPLOAD_IDLE;
+        portEXIT_CRITICAL(&u.lock);
+    }
+
+    // Render loop: swap a finished upload in, closing any player reading the clip it replaces.
+    // Those players reopen it on their next frame.
+    static void service() {
+        Upload& u = upload();
+        if (u.state != UPLOAD_INSTALLING) return;
+        for (ClipPlayer* p = players(); p; p = p->nextPlayer) {
+            if (p->file && strcmp(p->openName, u.name) == 0) {
+                p->file.close();
+                p->playing = false;
+                p->openedId = 0;
+            }
+        }
+        char tempPath[48];
+        char clipPath[48];
+        uploadPath(tempPath, sizeof(tempPath));
+        path(u.name, clipPath, sizeof(clipPath));
+        LittleFS.remove(clipPath);
+        LittleFS.rename(tempPath, clipPath);
+        Serial.printf("Clip installed: %s\n", u.name);
+        abandonUpload();   // Free for the next one
+    }
+
+    // Pick the clip every player shows; frameMs 0 and loop -1 keep the clip's own settings
+    static void select(const char* name, uint16_t frameMs, int8_t loop) {
+        Selection next;
+        strncpy(next.name, name, NAME_LENGTH - 1);
+        next.name[NAME_LENGTH - 1] = '\0';
+        next.frameMs = frameMs;
+        next.loop = loop;
+        portENTER_CRITICAL(&selectionLock());
+        selection() = next;
+        selectionId() = selectionId() + 1;
+        portEXIT_CRITICAL(&selectionLock());
+    }
+
+    static const char* selected() {
+        return selection().name;
+    }
+
+    static bool validName(const char* name) {
+        int length = strlen(name);
+        if (length == 0 || length >= NAME_LENGTH) return false;
+        for (int i = 0; i < length; i++) {
+            if (!isalnum(name[i]) && name[i] != '-' && name[i] != '_') return false;
+        }
+        return true;
+    }
+
+    // Path of a clip file, written into the caller's buffer
+    static const char* path(const char* name, char* buffer, size_t size, const char* ext = ".clp") {
+        snprintf(buffer, size, "%s/%s%s", CLIP_DIRECTORY, name, ext);
+        return buffer;
+    }
+
+    // Read and check a clip header; leaves the file at the first frame
+    static bool readHeader(File& clip, Header& header, int numLeds) {
+        if (clip.read((uint8_t*)&header, sizeof(Header)) != sizeof(Header)) return false;
+        return memcmp(header.magic, "LCLP", 4) == 0 && header.version == VERSION &&
+               header.numLeds == numLeds && header.frameCount > 0 && header.frameMs > 0;
+    }
+
+    // Rewind to the start of the selected clip
+    void start() {
+        if (frame == nullptr) {
+            frame = new CRGB[numLeds];
+        }
+        PixelKernels::fill(frame, numLeds, CRGB::Black);
+        open();
+        nextFrameAt = millis();
+    }
+
+    // Decode every frame that is due; returns the range of the frame buffer that changed
+    void render(uint32_t now, int& dirtyStart, int& dirtyEnd) {
+        if (frame == nullptr) return;   // Not started
+        if (openedId != selectionId()) {
+            PixelKernels::fill(frame, numLeds, CRGB::Black);
+            dirtyStart = 0;
+            dirtyEnd = numLeds;
+            open();
+            nextFrameAt = now;
+        }
+        if (!playing) return;
+
+        for (int n = 0; n < MAX_CATCH_UP && (int32_t)(now - nextFrameAt) >= 0; n++) {
+            if (frameIndex >= header.frameCount) {
+                if (!looping) {
+                    playing = false;   // Hold the last frame
+                    return;
+                }
+                file.seek(sizeof(Header));
+                frameIndex = 0;
+            }
+            if (!decodeFrame(dirtyStart, dirtyEnd)) {
+                Serial.printf("Clip frame %u is corrupt, stopping\n", frameIndex);
+                playing = false;
+                file.close();
+                return;
+            }
+            frameIndex++;
+            nextFrameAt += frameMs;
+        }
+        // Too far behind to catch up, e.g. after a long stall: drop the backlog
+        if ((int32_t)(now - nextFrameAt) >= 0) {
+            nextFrameAt = now + frameMs;
+        }
+    }
+
+    const CRGB* output() const {
+        return frame;
+    }
+};
@@ -0,0 +1,311 @@
+#pragma once
+#include <FastLED.h>
+#include "config.h"
+#include "planter_layout.h"
+#include "effects.h"
+#include "presenter.h"
+#include "pixel_kernels.h"
+
+// How a layer is combined with the layers below it
+enum class BlendMode : uint8_t {
+    NORMAL,   // Cross-fade over what is below by the layer opacity
+    ADD       // Saturating add, so black is transparent (good for sparkles)
+};
+
+// Stack of effect layers, each limited to a named segment of the strip.
+// Every layer renders into its own buffer at its own frame rate and reports
+// what changed; only the union of changed ranges is re-blended, so a layer
+// that is static costs nothing per frame.
+class Compositor {
+public:
+    static const int MAX_SEGMENTS = 8;
+    static const int MAX_LAYERS = 4;
+    static const int NAME_LENGTH = 12;
+
+    struct Segment {
+        char name[NAME_LENGTH];   // Several segments may share a name, e.g. both long sides
+        uint16_t start;
+        uint16_t end;
+    };
+
+    struct LayerConfig {
+        char effect[16];
+        char segment[NAME_LENGTH];
+        BlendMode blend;
+        uint8_t opacity;
+    };
+
+private:
+    struct Layer {
+        bool active = false;
+        const EffectInfo* effect = nullptr;
+        Effects* effects = nullptr;      // Own effect state, allocated on first use
+        CRGB* buffer = nullptr;          // Full strip of layer pixels
+        Presenter* upscaler = nullptr;   // Expands group-resolution output into buffer
+        char segment[NAME_LENGTH];
+        BlendMode blend = BlendMode::NORMAL;
+        uint8_t opacity = 255;
+        uint32_t lastRender = 0;
+    };
+
+    CRGB* output;
+    int numLeds;
+    const PlanterLayout* layout;
+
+    Segment segments[MAX_SEGMENTS];
+    int numSegments = 0;
+    Layer layers[MAX_LAYERS];
+    int numLayers = 0;
+    bool fullRedraw = true;
+    int lastStart = 0;   // Output range re-blended by the last render
+    int lastEnd = 0;
+
+    // Written by the web handler, picked up at the start of the next frame
+    LayerConfig pending[MAX_LAYERS];
+    int pendingCount = -1;
+    portMUX_TYPE pendingLock = portMUX_INITIALIZER_UNLOCKED;
+
+    void addSegment(const char* name, int start, int end) {
+        if (numSegments >= MAX_SEGMENTS || start >= end) return;
+        Segment& seg = segments[numSegments++];
+        strncpy(seg.name, name, NAME_LENGTH - 1);
+        seg.name[NAME_LENGTH - 1] = '\0';
+        seg.start = start;
+        seg.end = end;
+    }
+
+    // Split the strip into runs of LEDs on the same side of the planter
+    void defaultSegments() {
+        numSegments = 0;
+        addSegment("all", 0, numLeds);
+        int runStart = 0;
+        for (int i = 1; i <= numLeds; i++) {
+            if (i == numLeds || layout->side(i) != layout->side(runStart)) {
+                addSegment(layout->onLongSide(runStart) ? "long" : "end", runStart, i);
+                runStart = i;
+            }
+        }
+    }
+
+    bool layerCovers(const Layer& layer, const Segment& seg) const {
+        return strcmp(layer.segment, seg.name) == 0;
+    }
+
+    void applyPending() {
+        // Copied out under the lock, so a stack queued meanwhile is never half read
+        LayerConfig configs[MAX_LAYERS];
+        portENTER_CRITICAL(&pendingLock);
+        int count = pendingCount;
+        memcpy(configs, pending, max(count, 0) * sizeof(LayerConfig));
+        pendingCount = -1;
+        portEXIT_CRITICAL(&pendingLock);
+        if (count < 0) return;
+
+        numLayers = 0;
+        for (int i = 0; i < count; i++) {
+            const LayerConfig& config = configs[i];
+            const EffectInfo* effect = Effects::find(config.effect);
+            if (effect == nullptr) continue;
+
+            Layer& layer = layers[numLayers++];
+            if (layer.effects == nullptr) {
+                layer.buffer = new CRGB[numLeds];
+                layer.effects = new Effects(layer.buffer, numLeds, layout);
+                layer.upscaler = new Presenter(layer.buffer, numLeds);
+            }
+            layer.active = true;
+            layer.effect = effect;
+            layer.effects->start(effect);
+            layer.effects->setPalette(Palettes::fromEffect(config.effect));
+            strncpy(layer.segment, config.segment, NAME_LENGTH - 1);
+            layer.segment[NAME_LENGTH - 1] = '\0';
+            layer.blend = config.blend;
+            layer.opacity = config.opacity;
+            layer.lastRender = 0;
+        }
+        for (int i = numLayers; i < MAX_LAYERS; i++) {
+            layers[i].active = false;
+        }
+        fullRedraw = true;
+    }
+
+    // Render a layer if its frame is due; returns the LED range it changed
+    bool renderLayer(Layer& layer, CRGB color, uint32_t now, int& start, int& end) {
+        if (!fullRedraw && now - layer.lastRender < layer.effect->frameMs) {
+            return false;
+        }
+        layer.lastRender = now;
+
+        layer.effects->render(layer.effect, color);
+        layer.effects->dirtyRange(start, end);
+        if (fullRedraw) {
+            start = 0;
+            end = layer.effects->outputSize(layer.effect);
+        }
+        if (start >= end) return false;
+
+        layer.upscaler->upscale(layer.effects->output(layer.effect),
+                                layer.effects->outputSize(layer.effect),
+                                layer.effect->upscale);
+
+        layer.upscaler->stripRange(layer.effect->upscale, start, end);
+        return true;
+    }
+
+    void blendRange(const Layer& layer, int start, int end) {
+        CRGB* dst = output + start;
+        const CRGB* src = layer.buffer + start;
+        int count = end - start;
+
+        if (layer.blend == BlendMode::ADD) {
+            if (layer.opacity == 255) {
+                PixelKernels::add(dst, src, count);
+                return;
+            }
+            // Scale a chunk at a time so the layer buffer itself stays untouched
+            CRGB scratch[32];
+            for (int i = 0; i < count; i += 32) {
+                int chunk = min(32, count - i);
+                memcpy(scratch, src + i, chunk * sizeof(CRGB));
+                PixelKernels::scale(scratch, chunk, layer.opacity);
+                PixelKernels::add(dst + i, scratch, chunk);
+            }
+        } else if (layer.opacity == 255) {
+            memcpy(dst, src, count * sizeof(CRGB));
+        } else {
+            PixelKernels::blend(dst, src, count, layer.opacity);
+        }
+    }
+
+    // Rebuild [start, end) of the output from every layer, bottom to top
+    void composite(int start, int end) {
+        PixelKernels::fill(output + start, end - start, CRGB::Black);
+        for (int i = 0; i < numLayers; i++) {
+            for (int s = 0; s < numSegments; s++) {
+                if (!layerCovers(layers[i], segments[s])) continue;
+                int lo = max(start, (int)segments[s].start);
+                int hi = min(end, (int)segments[s].end);
+                if (lo < hi) blendRange(layers[i], lo, hi);
+            }
+        }
+    }
+
+public:
+    Compositor(CRGB* ledArray, int numLeds, const PlanterLayout* layout) :
+        output(ledArray), numLeds(numLeds), layout(layout) {
+    }
+
+    ~Compositor() {
+        for (int i = 0; i < MAX_LAYERS; i++) {
+            delete layers[i].effects;
+            delete layers[i].upscaler;
+            delete[] layers[i].buffer;
+        }
+    }
+
+    // Default planter scene: ripples along the long sides, a slow wave on the
+    // ends and twinkles sparkling over everything
+    void begin() {
+        defaultSegments();
+        LayerConfig scene[] = {
+            { "ripple",  "long", BlendMode::NORMAL, 255 },
+            { "wave",    "end",  BlendMode::NORMAL, 255 },
+            { "twinkle", "all",  BlendMode::ADD,    160 },
+        };
+        setLayers(scene, 3);
+        applyPending();
+    }
+
+    // Queue a new layer stack; safe to call from the web server task
+    void setLayers(const LayerConfig* configs, int count) {
+        if (count > MAX_LAYERS) count = MAX_LAYERS;
+        portENTER_CRITICAL(&pendingLock);
+        memcpy(pending, configs, count * sizeof(LayerConfig));
+        pendingCount = count;
+        portEXIT_CRITICAL(&pendingLock);
+    }
+
+    // True if at least one segment has this name
+    bool hasSegment(const char* name) const {
+        for (int s = 0; s < numSegments; s++) {
+            if (strcmp(segments[s].name, name) == 0) return true;
+        }
+        return false;
+    }
+
+    // Render every due layer and re-blend whatever changed
+    void render(CRGB color, uint32_t now) {
+        applyPending();
+
+        int dirtyStart = numLeds;
+        int dirtyEnd = 0;
+        for (int i = 0; i < numLayers; i++) {
+            int start, end;
+            if (!renderLayer(layers[i], color, now, start, end)) continue;
+
+            // Only the parts inside the layer's segments can change the output
+            for (int s = 0; s < numSegments; s++) {
+                if (!layerCovers(layers[i], segments[s])) continue;
+                int lo = max(start, (int)segments[s].start);
+                int hi = min(end, (int)segments[s].end);
+                if (lo < hi) {
+                    dirtyStart = min(dirtyStart, lo);
+                    dirtyEnd = max(dirtyEnd, hi);
+                }
+            }
+        }
+        if (fullRedraw) {
+            dirtyStart = 0;
+            dirtyEnd = numLeds;
+            fullRedraw = false;
+        }
+
+        if (dirtyStart < dirtyEnd) {
+            composite(dirtyStart, dirtyEnd);
+        }
+        lastStart = dirtyStart;
+        lastEnd = dirtyEnd;
+    }
+    
+    // Range of the output changed by the last render; empty when start >= end
+    void dirtyRange(int& start, int& end) const {
+        start = lastStart;
+        end = lastEnd;
+    }
+
+    // Force every layer to redraw on the next frame, e.g. after switching back to the scene
+    void invalidate() {
+        fullRedraw = true;
+    }
+
+    // Shortest layer frame interval, used to pace the render loop
+    uint16_t frameMs() const {
+        uint16_t interval = 40;
+        for (int i = 0; i < numLayers; i++) {
+            if (i == 0 || layers[i].effect->frameMs < interval) {
+                interval = layers[i].effect->frameMs;
+            }
+        }
+        return interval;
+    }
+
+    int getNumLayers() const {
+        return numLayers;
+    }
+
+    const char* layerEffect(int i) const {
+        return layers[i].effect->name;
+    }
+
+    const char* layerSegment(int i) const {
+        return layers[i].segment;
+    }
+
+    BlendMode layerBlend(int i) const {
+        return layers[i].blend;
+    }
+
+    uint8_t layerOpacity(int i) const {
+        return layers[i].opacity;
+    }
+};
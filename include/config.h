@@ -1,10 +1,53 @@
 #pragma once
 
-// LED Configuration
+// LED Configuration (type, order and pin are defaults; /setup-strip picks others at runtime)
 #define LED_PIN     13
 #define NUM_LEDS    120
 #define LED_TYPE    WS2811
 #define COLOR_ORDER BRG
+#define LOGICAL_LEDS NUM_LEDS   // Rendered length; a fan-out leader sends LEDs past NUM_LEDS to followers
+#define LED_GROUP_SIZE 7   // LEDs per visual group used by the effects
+#define EFFECT_TRANSITION_MS 800   // Crossfade time when switching effects
+#define INTERPOLATED_FRAME_MS 16   // Output interval for effects that render keyframes and blend between them
+#define PALETTE_CACHE_SLOTS 4      // Expanded palettes kept at once, 768 bytes each
+
+// Strip output (frames are sent from their own task while the next one renders)
+#define OUTPUT_TASK_CORE     0      // Loop and web server run on core 1
+#define OUTPUT_TASK_PRIORITY 2
+#define OUTPUT_TASK_STACK    4096
+#define WIRE_US_PER_LED      30     // WS2811 at 800 kHz, used by the benchmark's mock strip
+#define OUTPUT_DITHER        1      // Brightness at 16-bit precision with temporal dithering; 0 leaves it to FastLED
+#define OUTPUT_DITHER_REFRESH_MS 8  // Resend interval for a static frame while dithering
+#define OUTPUT_REFRESH_MARGIN_US 500 // A resend must be off the wire this long before the next frame is due
+
+// On-device benchmark started from /benchmark (see self_benchmark.h)
+#define SELF_BENCH_FRAMES 120   // Per effect, once without output and once with it
+
+// Command tracing (esp32dev-trace builds; see event_trace.h)
+#define TRACE_BUFFER_EVENTS 512   // 16 bytes each, oldest overwritten
+
+// Power limiting (estimates the strip draw and dims the output to stay in budget)
+#define POWER_BUDGET_MA          4000   // Supply current available to the strip
+#define POWER_MA_PER_CHANNEL     20     // Draw of one color channel at full intensity
+#define POWER_IDLE_MA_PER_LED    1      // Quiescent draw of each LED driver
+#define POWER_REPORT_MS          5000   // Interval between MQTT power reports
+
+// Idle mode (light off: fade out, then stop rendering and slow the CPU)
+#define IDLE_FADE_MS    600   // Fade to black before parking
+#define IDLE_CPU_MHZ    80    // Lowest clock WiFi keeps working at
+#define ACTIVE_CPU_MHZ  240
+#define IDLE_POLL_MS    100   // Network service interval while parked; commands wake the loop sooner
+
+// Prerendered clips
+#define CLIP_DIRECTORY "/clips"   // LittleFS directory holding uploaded .clp files
+
+// User effect programs
+#define VM_PROGRAM_PATH "/program.lvm"   // Last uploaded program, reloaded at boot
+
+// Planter geometry (strip runs around the inside of the rectangle)
+#define PLANTER_LENGTH_MM 3000
+#define PLANTER_WIDTH_MM  500
+#define PLANTER_START_OFFSET_MM 0   // Distance from the first corner to LED 0, along the long side
 
 // Status LED Configuration
 #define WIFI_STATUS_LED_PIN  14
@@ -14,6 +57,26 @@
 #define AP_SSID     "LED-Controller"
 #define AP_PASSWORD "ledcontrol123"
 
+// WiFi reconnection
+#define WIFI_CONNECT_TIMEOUT_MS 10000   // Give up on an attempt that has not got an IP
+#define WIFI_RETRY_MIN_MS 500           // First retry delay, doubled per failed attempt
+#define WIFI_RETRY_MAX_MS 8000          // Backoff cap, so recovery after an outage takes seconds
+#define WIFI_AP_FALLBACK_MS 30000       // Serve the config AP alongside once down this long
+#define CONFIG_APPLY_DELAY_MS 250       // Settings that drop the link wait this long for the HTTP reply to leave
+
+// Clock sync between controllers on the same LAN, so their effects run in step
+#define SYNC_ENABLED 1
+#define SYNC_GROUP   239, 255, 76, 84   // Multicast group shared by all controllers
+#define SYNC_PORT    47684
+
+// Frame fan-out: a leader streams slices of the logical strip to followers over DDP
+#define DDP_PORT 4048
+#define FANOUT_MAX_FOLLOWERS 4
+#define FANOUT_PRESENT_DELAY_MS 10   // Frames are shown this long after rendering, on every controller
+#define FANOUT_KEEPALIVE_MS 1000     // Resend an unchanged slice this often
+#define FANOUT_TIMEOUT_MS 2000       // Follower renders its own effects after this long without frames
+#define FANOUT_STATUS_MS 1000        // Follower status report interval
+
 // Default MQTT Configuration
 #define DEFAULT_MQTT_HOST   "homeassistant.local"
 #define DEFAULT_MQTT_PORT   1883
@@ -25,6 +88,15 @@
 #define DEVICE_NAME "LED Planter"
 #define DEVICE_ID   "led_planter"
 #define MQTT_BASE_TOPIC "homeassistant/light/led_planter"
+#define MQTT_AVAILABILITY_TOPIC MQTT_BASE_TOPIC "/availability"   // "online", or "offline" via the Last Will
+
+// MQTT session
+#define MQTT_KEEPALIVE_S 15             // Broker declares us offline after 1.5x this
+#define MQTT_CONNECT_TIMEOUT_MS 10000   // Give up on a connect that has not been acknowledged
+#define MQTT_RETRY_MIN_MS 1000          // First retry delay, doubled per failed attempt
+#define MQTT_RETRY_MAX_MS 10000         // Backoff cap
+#define MQTT_QUEUE_SLOTS 4              // Topics held while offline, latest value each
+#define MQTT_QUEUE_PAYLOAD 256          // Largest queued payload, including the terminator
 
 // Web server port
 #define HTTP_PORT   80
@@ -39,6 +111,14 @@
 #define MQTT_PASS_ADDR 196
 #define HOSTNAME_ADDR 228
 #define SETTINGS_ADDR 292
+#define STRIP_ADDR 400
+#define FANOUT_ADDR 432
+
+// Strip type magic number to verify EEPROM data
+#define STRIP_MAGIC 0x5354
+
+// Fan-out magic number to verify EEPROM data
+#define FANOUT_MAGIC 0x464F
 
 // Settings magic number to verify EEPROM data
 #define SETTINGS_MAGIC 0xAB54
@@ -0,0 +1,270 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// DDP (Distributed Display Protocol) framing for sending slices of one
+// logical strip to other controllers. Plain C++ without Arduino
+// dependencies, like sync_protocol.h: frame_fanout.h moves the packets on
+// the device, tools/fanout_loopback.cpp on the host.
+//
+// A frame is a run of data packets, each carrying a byte offset into the
+// follower's slice; the last one has PUSH set and a timecode saying when to
+// show it, in 16.16 seconds of network time (net_clock.h), and one byte past
+// its data with the brightness to show it at. Pixels travel at full scale so
+// each follower applies brightness with its own dithering; receivers that
+// only read the length field ignore the extra byte. Every packet has
+// a 4-bit sequence number, so the follower can count the ones it missed.
+// Followers answer with a JSON status reply (id 251) the leader reads its
+// per-follower metrics from.
+class DDP {
+public:
+    static const uint8_t VERSION1 = 0x40;
+    static const uint8_t TIMECODE = 0x10;
+    static const uint8_t REPLY = 0x04;
+    static const uint8_t PUSH = 0x01;
+    static const uint8_t TYPE_RGB24 = 0x0B;
+    static const uint8_t ID_DISPLAY = 1;
+    static const uint8_t ID_STATUS = 251;
+
+    static const int HEADER = 10;            // Without timecode
+    static const int MAX_DATA = 1440;        // 480 RGB pixels, fits one Ethernet frame
+    static const int MAX_PACKET = HEADER + 4 + MAX_DATA + 1;   // Timecode and brightness on the last
+
+    struct Status {
+        uint32_t frames;        // Complete frames received
+        uint32_t incomplete;    // Frames pushed with packets missing
+        uint32_t packets;       // Data packets received
+        uint32_t lost;          // Data packets missing from the sequence
+        uint32_t latencyUs;     // Mean render-to-arrival time since the last status
+        uint32_t latencyMaxUs;
+        uint32_t late;          // Frames that arrived after their present time
+    };
+
+private:
+    static void put32(uint8_t* p, uint32_t v) {
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+    }
+
+    static uint32_t get32(const uint8_t* p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    static uint32_t get16(const uint8_t* p) {
+        return ((uint32_t)p[0] << 8) | p[1];
+    }
+
+public:
+    // Network time in microseconds as a DDP timecode; wraps every 18 hours
+    static uint32_t timecode(int64_t us) {
+        return (uint32_t)((us << 16) / 1000000);
+    }
+
+    // a - b in microseconds, for timecodes less than 9 hours apart
+    static int64_t timecodeDiffUs(uint32_t a, uint32_t b) {
+        return (int64_t)(int32_t)(a - b) * 1000000 / 65536;
+    }
+
+    static int packets(uint32_t bytes) {
+        return (bytes + MAX_DATA - 1) / MAX_DATA;
+    }
+
+    // Write packet index of a frame of bytes into packet (MAX_PACKET long); returns its length.
+    // The payload is left for the caller to fill: dataLength(packet) bytes at payload(packet).
+    static int build(uint8_t* packet, uint8_t& sequence, int index, uint32_t bytes, uint32_t presentAt,
+                     uint8_t brightness) {
+        uint32_t offset = (uint32_t)index * MAX_DATA;
+        uint32_t length = bytes - offset;
+        if (length > (uint32_t)MAX_DATA) length = MAX_DATA;
+        bool last = offset + length >= bytes;
+
+        sequence = sequence % 15 + 1;   // 1..15; 0 means unsequenced
+        packet[0] = VERSION1 | TIMECODE | (last ? PUSH : 0);
+        packet[1] = sequence;
+        packet[2] = TYPE_RGB24;
+        packet[3] = ID_DISPLAY;
+        put32(packet + 4, offset);
+        packet[8] = length >> 8;
+        packet[9] = length;
+        put32(packet + HEADER, last ? presentAt : 0);
+        if (!last) return HEADER + 4 + length;
+        packet[HEADER + 4 + length] = brightness;
+        return HEADER + 4 + length + 1;
+    }
+
+    static uint8_t* payload(uint8_t* packet) {
+        return packet + HEADER + ((packet[0] & TIMECODE) ? 4 : 0);
+    }
+
+    static uint32_t dataLength(const uint8_t* packet) {
+        return get16(packet + 8);
+    }
+
+    static int buildStatus(uint8_t* packet, const Status& s) {
+        char* json = (char*)packet + HEADER;
+        int length = snprintf(json, MAX_DATA,
+                              "{\"frames\":%u,\"incomplete\":%u,\"packets\":%u,\"lost\":%u,"
+                              "\"latency_us\":%u,\"latency_max_us\":%u,\"late\":%u}",
+                              (unsigned)s.frames, (unsigned)s.incomplete, (unsigned)s.packets, (unsigned)s.lost,
+                              (unsigned)s.latencyUs, (unsigned)s.latencyMaxUs, (unsigned)s.late);
+        packet[0] = VERSION1 | REPLY | PUSH;
+        packet[1] = 0;
+        packet[2] = 0;
+        packet[3] = ID_STATUS;
+        put32(packet + 4, 0);
+        packet[8] = length >> 8;
+        packet[9] = length;
+        return HEADER + length;
+    }
+
+    static bool parseStatus(const uint8_t* packet, int len, Status& s) {
+        if (len <= HEADER || (packet[0] & 0xC0) != VERSION1 || !(packet[0] & REPLY) || packet[3] != ID_STATUS) {
+            return false;
+        }
+        char json[160];
+        int length = len - HEADER < (int)sizeof(json) - 1 ? len - HEADER : (int)sizeof(json) - 1;
+        memcpy(json, packet + HEADER, length);
+        json[length] = '\0';
+        unsigned v[7];
+        if (sscanf(json,
+                   "{\"frames\":%u,\"incomplete\":%u,\"packets\":%u,\"lost\":%u,"
+                   "\"latency_us\":%u,\"latency_max_us\":%u,\"late\":%u}",
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) != 7) {
+            return false;
+        }
+        s.frames = v[0];
+        s.incomplete = v[1];
+        s.packets = v[2];
+        s.lost = v[3];
+        s.latencyUs = v[4];
+        s.latencyMaxUs = v[5];
+        s.late = v[6];
+        return true;
+    }
+
+    // Follower side: assembles a slice from data packets into one buffer and
+    // swaps it with the ready buffer when complete, so nothing is copied or
+    // allocated per frame.
+    class Receiver {
+    private:
+        uint8_t* incoming;
+        uint8_t* ready;
+        uint32_t capacity;
+        int64_t presentDelayUs;     // How far ahead of sending the leader stamps frames
+
+        uint32_t received = 0;      // Bytes of the frame being assembled
+        bool intact = false;        // No packet missed since the frame's first one
+        uint32_t readyBytes = 0;
+        uint32_t readyAt = 0;       // Timecode the ready frame is to be shown at
+        uint8_t readyBrightness = 255;
+        bool pending = false;
+        uint8_t expected = 0;       // Next sequence number, 0 before the first packet
+
+        Status stats = {};
+        uint64_t latencySum = 0;
+        uint32_t latencyCount = 0;
+
+    public:
+        Receiver(uint8_t* incomingBuffer, uint8_t* readyBuffer, uint32_t bytes, int64_t presentDelay) :
+            incoming(incomingBuffer), ready(readyBuffer), capacity(bytes), presentDelayUs(presentDelay) {
+        }
+
+        // Feed one datagram received at network timecode now; true when a frame became ready
+        bool receive(const uint8_t* packet, int len, uint32_t now) {
+            if (len < HEADER || (packet[0] & 0xC0) != VERSION1 || (packet[0] & REPLY) ||
+                packet[3] != ID_DISPLAY) {
+                return false;
+            }
+            int header = HEADER + ((packet[0] & TIMECODE) ? 4 : 0);
+            uint32_t offset = get32(packet + 4);
+            uint32_t length = dataLength(packet);
+            if (len < header + (int)length) return false;
+
+            uint8_t sequence = packet[1] & 0x0F;
+            if (sequence != 0) {
+                if (expected != 0 && sequence != expected) {
+                    stats.lost += (sequence + 15 - expected) % 15;
+                    intact = false;
+                }
+                expected = sequence % 15 + 1;
+            }
+            stats.packets++;
+
+            if (offset == 0) {
+                received = 0;
+                intact = true;
+            }
+            if (offset < capacity) {
+                uint32_t fit = capacity - offset < length ? capacity - offset : length;
+                memcpy(incoming + offset, packet + header, fit);
+                received += fit;
+            }
+            if (!(packet[0] & PUSH)) return false;
+
+            uint32_t frameBytes = offset + length < capacity ? offset + length : capacity;
+            bool complete = intact && received >= frameBytes;
+            received = 0;
+            intact = false;
+            if (!complete) {
+                stats.incomplete++;
+                return false;
+            }
+
+            uint32_t presentAt = (packet[0] & TIMECODE) ? get32(packet + HEADER) : now;
+            int64_t untilPresent = timecodeDiffUs(presentAt, now);
+            int64_t latency = presentDelayUs - untilPresent;
+            if (latency < 0) latency = 0;
+            latencySum += latency;
+            latencyCount++;
+            if (latency > stats.latencyMaxUs) stats.latencyMaxUs = (uint32_t)latency;
+            if (untilPresent < 0) stats.late++;
+
+            uint8_t* swap = ready;
+            ready = incoming;
+            incoming = swap;
+            readyBytes = frameBytes;
+            readyAt = presentAt;
+            readyBrightness = len > header + (int)length ? packet[header + length] : 255;   // Full if not sent
+            pending = true;
+            stats.frames++;
+            return true;
+        }
+
+        // Microseconds until the ready frame is due (0 if overdue), or -1 if there is none
+        int64_t dueInUs(uint32_t now) const {
+            if (!pending) return -1;
+            int64_t wait = timecodeDiffUs(readyAt, now);
+            return wait > 0 ? wait : 0;
+        }
+
+        // Timecode the ready frame is to be shown at
+        uint32_t presentAt() const {
+            return readyAt;
+        }
+
+        // Brightness the ready frame is to be shown at; its pixels are at full scale
+        uint8_t brightness() const {
+            return readyBrightness;
+        }
+
+        // Hand out the ready frame; valid until the next receive() completes a frame
+        const uint8_t* take(uint32_t& bytes) {
+            pending = false;
+            bytes = readyBytes;
+            return ready;
+        }
+
+        // Counters since start; latency covers the time since the last call
+        Status status() {
+            stats.latencyUs = latencyCount ? (uint32_t)(latencySum / latencyCount) : 0;
+            Status s = stats;
+            latencySum = 0;
+            latencyCount = 0;
+            stats.latencyMaxUs = 0;
+            return s;
+        }
+    };
+};
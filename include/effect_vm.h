@@ -0,0 +1,400 @@
+#pragma once
+#include <Arduino.h>
+#include <FastLED.h>
+#include "planter_layout.h"
+
+// Opcode list: name, immediate bytes, values popped, values pushed.
+// The enum, the dispatch table and the verifier are all generated from it.
+#define EFFECT_VM_OPS(X) \
+    X(END,    0, 0, 0)  /* finish this run                                */ \
+    X(PUSH8,  1, 0, 1)  /* push signed 8-bit immediate                    */ \
+    X(PUSH16, 2, 0, 1)  /* push signed 16-bit immediate, little endian    */ \
+    X(LOAD,   1, 0, 1)  /* push variable                                  */ \
+    X(STORE,  1, 1, 0)  /* pop into global                                */ \
+    X(DUP,    0, 1, 2)                                                       \
+    X(DROP,   0, 1, 0)                                                       \
+    X(SWAP,   0, 2, 2)                                                       \
+    X(OVER,   0, 2, 3)                                                       \
+    X(ADD,    0, 2, 1)                                                       \
+    X(SUB,    0, 2, 1)                                                       \
+    X(MUL,    0, 2, 1)                                                       \
+    X(DIV,    0, 2, 1)  /* division by zero gives 0                       */ \
+    X(MOD,    0, 2, 1)                                                       \
+    X(AND,    0, 2, 1)                                                       \
+    X(OR,     0, 2, 1)                                                       \
+    X(XOR,    0, 2, 1)                                                       \
+    X(SHL,    0, 2, 1)                                                       \
+    X(SHR,    0, 2, 1)                                                       \
+    X(MIN,    0, 2, 1)                                                       \
+    X(MAX,    0, 2, 1)                                                       \
+    X(LT,     0, 2, 1)                                                       \
+    X(EQ,     0, 2, 1)                                                       \
+    X(NEG,    0, 1, 1)                                                       \
+    X(JZ,     1, 1, 0)  /* pop, skip forward by immediate if zero         */ \
+    X(JMP,    1, 0, 0)  /* skip forward by immediate                      */ \
+    X(SIN8,   0, 1, 1)                                                       \
+    X(COS8,   0, 1, 1)                                                       \
+    X(SCALE8, 0, 2, 1)  /* value scale -> scale8(value, scale)            */ \
+    X(NOISE,  0, 2, 1)  /* x y -> inoise8(x, y)                           */ \
+    X(RAND,   0, 0, 1)  /* push random8()                                 */ \
+    X(CLAMP,  0, 1, 1)  /* clamp to 0-255                                 */ \
+    X(HSV,    0, 3, 3)  /* h s v -> r g b                                 */ \
+    X(PAL,    1, 1, 3)  /* index -> r g b from the palette in immediate   */ \
+    X(OUT,    0, 3, 0)  /* pop r g b into the current pixel (pixel only)  */
+
+// Sandboxed interpreter for user effect programs uploaded at runtime
+// (assembled with tools/vm_assembler.py).
+//
+// A program image is "LVM\x01", the 16-bit lengths of a frame section and a
+// pixel section, then the two sections. The frame section runs once per
+// frame and can keep state in globals; the pixel section runs once per LED
+// and writes it with OUT. Everything is 32-bit integer math on a small
+// stack.
+//
+// Programs are verified once when loaded: known opcodes only, forward jumps
+// only (so every run finishes within the section length), and a stack depth
+// that is fixed at every instruction and stays within the stack. The
+// interpreter itself then runs without any checks, dispatching with
+// computed goto.
+class EffectVM {
+public:
+    static const int MAX_IMAGE = 1024;
+    static const int HEADER_SIZE = 8;
+    static const int STACK_SIZE = 32;
+    static const int NUM_GLOBALS = 8;
+
+    enum Op : uint8_t {
+#define EFFECT_VM_ENUM(name, imm, pops, pushes) OP_##name,
+        EFFECT_VM_OPS(EFFECT_VM_ENUM)
+#undef EFFECT_VM_ENUM
+        OP_COUNT
+    };
+
+    // Variables readable with LOAD; only globals can be written with STORE
+    enum Var : uint8_t {
+        VAR_I,        // LED index
+        VAR_X,        // LED position along the planter, mm
+        VAR_Y,        // LED position across the planter, mm
+        VAR_PHASE,    // Position along the long side, 0-255
+        VAR_T,        // Frame counter
+        VAR_N,        // Number of LEDs
+        VAR_R,        // Selected color
+        VAR_G,
+        VAR_B,
+        VAR_GLOBAL0,  // Globals, kept between frames
+        NUM_VARS = VAR_GLOBAL0 + NUM_GLOBALS
+    };
+
+private:
+    struct OpInfo {
+        uint8_t immediate;
+        uint8_t pops;
+        uint8_t pushes;
+    };
+
+    static const OpInfo& info(uint8_t op) {
+        static const OpInfo table[OP_COUNT] = {
+#define EFFECT_VM_INFO(name, imm, pops, pushes) { imm, pops, pushes },
+            EFFECT_VM_OPS(EFFECT_VM_INFO)
+#undef EFFECT_VM_INFO
+        };
+        return table[op];
+    }
+
+    static const TProgmemRGBPalette16* palette(uint8_t id) {
+        static const TProgmemRGBPalette16* const palettes[] = {
+            &RainbowColors_p, &OceanColors_p, &ForestColors_p, &LavaColors_p,
+            &PartyColors_p, &HeatColors_p, &CloudColors_p
+        };
+        return palettes[id];
+    }
+    static const int NUM_PALETTES = 7;
+
+    // Program shared by every VM, written by the upload handler
+    static uint8_t* sharedImage() {
+        static uint8_t image[MAX_IMAGE];
+        return image;
+    }
+    static volatile uint16_t& sharedSize() {
+        static volatile uint16_t size = 0;
+        return size;
+    }
+    static volatile uint32_t& sharedId() {
+        static volatile uint32_t id = 0;
+        return id;
+    }
+
+    uint8_t* image = nullptr;   // This VM's verified copy of the program
+    int imageSize = 0;
+    uint32_t loadedId = 0;
+    bool pinned = false;        // Running its own program instead of the shared one
+    int32_t vars[NUM_VARS];
+    uint32_t frameCount = 0;
+
+    static uint16_t read16(const uint8_t* p) {
+        return p[0] | (p[1] << 8);
+    }
+
+    static uint8_t clamp8(int32_t v) {
+        return v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+
+    static bool verifySection(const uint8_t* code, int size, bool pixel, const char*& error) {
+        int8_t depthAt[MAX_IMAGE];     // Stack depth expected at each jump target, -1 if none
+        uint8_t isStart[MAX_IMAGE];    // Instruction boundaries
+        memset(depthAt, -1, size);
+        memset(isStart, 0, size);
+
+        int depth = 0;
+        bool reachable = true;
+        int pc = 0;
+        while (pc < size) {
+            uint8_t op = code[pc];
+            if (op >= OP_COUNT) { error = "unknown opcode"; return false; }
+            if (depthAt[pc] >= 0) {
+                if (reachable && depthAt[pc] != depth) { error = "stack depth differs at jump target"; return false; }
+                depth = depthAt[pc];
+                reachable = true;
+            }
+            if (!reachable) { error = "unreachable code"; return false; }
+            isStart[pc] = 1;
+
+            const OpInfo& opInfo = info(op);
+            int next = pc + 1 + opInfo.immediate;
+            if (next > size) { error = "truncated instruction"; return false; }
+            if (depth < opInfo.pops) { error = "stack underflow"; return false; }
+            depth += opInfo.pushes - opInfo.pops;
+            if (depth > STACK_SIZE) { error = "stack overflow"; return false; }
+
+            uint8_t imm = opInfo.immediate ? code[pc + 1] : 0;
+            if (op == OP_LOAD && imm >= NUM_VARS) { error = "unknown variable"; return false; }
+            if (op == OP_STORE && (imm < VAR_GLOBAL0 || imm >= NUM_VARS)) { error = "store to a non-global"; return false; }
+            if (op == OP_PAL && imm >= NUM_PALETTES) { error = "unknown palette"; return false; }
+            if (op == OP_OUT && !pixel) { error = "OUT outside the pixel section"; return false; }
+            if (op == OP_JZ || op == OP_JMP) {
+                int target = next + imm;
+                if (target >= size) { error = "jump past the end"; return false; }
+                if (depthAt[target] >= 0 && depthAt[target] != depth) { error = "stack depth differs at jump target"; return false; }
+                depthAt[target] = depth;
+            }
+            reachable = op != OP_JMP && op != OP_END;
+            pc = next;
+        }
+        if (reachable) { error = "section does not end with END"; return false; }
+        for (int i = 0; i < size; i++) {
+            if (depthAt[i] >= 0 && !isStart[i]) { error = "jump into an instruction"; return false; }
+        }
+        return true;
+    }
+
+    // Copy the shared program if it changed; only a verified copy is ever run
+    void sync() {
+        uint32_t id = sharedId();
+        if (pinned || id == loadedId) return;
+        if (image == nullptr) {
+            image = new uint8_t[MAX_IMAGE];
+        }
+        int size = sharedSize();
+        memcpy(image, sharedImage(), size);
+        const char* error;
+        imageSize = verify(image, size, error) ? size : 0;
+        loadedId = id;
+        start();
+    }
+
+    void run(const uint8_t* pc, CRGB* out) {
+        int32_t stack[STACK_SIZE];
+        int32_t* sp = stack;   // Next free slot
+        static const void* const dispatch[OP_COUNT] = {
+#define EFFECT_VM_LABEL(name, imm, pops, pushes) &&op_##name,
+            EFFECT_VM_OPS(EFFECT_VM_LABEL)
+#undef EFFECT_VM_LABEL
+        };
+#define VM_NEXT goto *dispatch[*pc++]
+#define VM_BINARY(name, expr) op_##name: { int32_t b = *--sp; int32_t a = sp[-1]; sp[-1] = (expr); } VM_NEXT;
+
+        VM_NEXT;
+    op_END:
+        return;
+    op_PUSH8:
+        *sp++ = (int8_t)*pc++;
+        VM_NEXT;
+    op_PUSH16:
+        *sp++ = (int16_t)read16(pc);
+        pc += 2;
+        VM_NEXT;
+    op_LOAD:
+        *sp++ = vars[*pc++];
+        VM_NEXT;
+    op_STORE:
+        vars[*pc++] = *--sp;
+        VM_NEXT;
+    op_DUP:
+        sp[0] = sp[-1];
+        sp++;
+        VM_NEXT;
+    op_DROP:
+        sp--;
+        VM_NEXT;
+    op_SWAP: {
+        int32_t t = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = t;
+        VM_NEXT;
+    }
+    op_OVER:
+        sp[0] = sp[-2];
+        sp++;
+        VM_NEXT;
+    // Wrapping arithmetic, done unsigned so overflow is defined
+    VM_BINARY(ADD, (int32_t)((uint32_t)a + (uint32_t)b))
+    VM_BINARY(SUB, (int32_t)((uint32_t)a - (uint32_t)b))
+    VM_BINARY(MUL, (int32_t)((uint32_t)a * (uint32_t)b))
+    VM_BINARY(DIV, b == 0 ? 0 : b == -1 ? (int32_t)(0u - (uint32_t)a) : a / b)
+    VM_BINARY(MOD, b == 0 || b == -1 ? 0 : a % b)
+    VM_BINARY(AND, a & b)
+    VM_BINARY(OR, a | b)
+    VM_BINARY(XOR, a ^ b)
+    VM_BINARY(SHL, (int32_t)((uint32_t)a << (b & 31)))
+    VM_BINARY(SHR, a >> (b & 31))
+    VM_BINARY(MIN, a < b ? a : b)
+    VM_BINARY(MAX, a > b ? a : b)
+    VM_BINARY(LT, a < b)
+    VM_BINARY(EQ, a == b)
+    op_NEG:
+        sp[-1] = (int32_t)(0u - (uint32_t)sp[-1]);
+        VM_NEXT;
+    op_JZ: {
+        uint8_t offset = *pc++;
+        if (*--sp == 0) pc += offset;
+        VM_NEXT;
+    }
+    op_JMP: {
+        uint8_t offset = *pc++;
+        pc += offset;
+        VM_NEXT;
+    }
+    op_SIN8:
+        sp[-1] = sin8(sp[-1]);
+        VM_NEXT;
+    op_COS8:
+        sp[-1] = cos8(sp[-1]);
+        VM_NEXT;
+    VM_BINARY(SCALE8, scale8(a, b))
+    VM_BINARY(NOISE, inoise8(a, b))
+    op_RAND:
+        *sp++ = random8();
+        VM_NEXT;
+    op_CLAMP:
+        sp[-1] = clamp8(sp[-1]);
+        VM_NEXT;
+    op_HSV: {
+        CRGB c;
+        hsv2rgb_rainbow(CHSV(sp[-3], sp[-2], sp[-1]), c);
+        sp[-3] = c.r;
+        sp[-2] = c.g;
+        sp[-1] = c.b;
+        VM_NEXT;
+    }
+    op_PAL: {
+        CRGB c = ColorFromPalette(*palette(*pc++), sp[-1]);
+        sp[-1] = c.r;
+        sp[0] = c.g;
+        sp[1] = c.b;
+        sp += 2;
+        VM_NEXT;
+    }
+    op_OUT:
+        sp -= 3;
+        *out = CRGB(clamp8(sp[0]), clamp8(sp[1]), clamp8(sp[2]));
+        VM_NEXT;
+
+#undef VM_BINARY
+#undef VM_NEXT
+    }
+
+public:
+    EffectVM() {
+        start();
+    }
+
+    ~EffectVM() {
+        delete[] image;
+    }
+
+    // Check a program image; error is set to the reason when it is rejected
+    static bool verify(const uint8_t* program, int size, const char*& error) {
+        if (size < HEADER_SIZE || size > MAX_IMAGE || memcmp(program, "LVM\x01", 4) != 0) {
+            error = "not a program image";
+            return false;
+        }
+        int frameSize = read16(program + 4);
+        int pixelSize = read16(program + 6);
+        if (HEADER_SIZE + frameSize + pixelSize != size || pixelSize == 0) {
+            error = "section sizes do not match the image";
+            return false;
+        }
+        return (frameSize == 0 || verifySection(program + HEADER_SIZE, frameSize, false, error)) &&
+               verifySection(program + HEADER_SIZE + frameSize, pixelSize, true, error);
+    }
+
+    // Verify a program and make it the one every VM runs from its next frame
+    static bool load(const uint8_t* program, int size, const char*& error) {
+        if (!verify(program, size, error)) return false;
+        memcpy(sharedImage(), program, size);
+        sharedSize() = size;
+        sharedId() = sharedId() + 1;
+        return true;
+    }
+
+    static int loadedSize() {
+        return sharedSize();
+    }
+    
+    // Run a program on this VM only, leaving the shared one alone (used by the benchmarks)
+    bool use(const uint8_t* program, int size, const char*& error) {
+        if (!verify(program, size, error)) return false;
+        if (image == nullptr) {
+            image = new uint8_t[MAX_IMAGE];
+        }
+        memcpy(image, program, size);
+        imageSize = size;
+        pinned = true;
+        start();
+        return true;
+    }
+
+    // Clear globals and the frame counter
+    void start() {
+        memset(vars, 0, sizeof(vars));
+        frameCount = 0;
+    }
+
+    // Run the frame section once and the pixel section for every LED;
+    // false when no program is loaded
+    bool render(CRGB* leds, int numLeds, const PlanterLayout* layout, const CRGB& color) {
+        sync();
+        if (imageSize == 0) return false;
+
+        int frameSize = read16(image + 4);
+        const uint8_t* frameCode = image + HEADER_SIZE;
+        const uint8_t* pixelCode = frameCode + frameSize;
+
+        vars[VAR_T] = frameCount++;
+        vars[VAR_N] = numLeds;
+        vars[VAR_R] = color.r;
+        vars[VAR_G] = color.g;
+        vars[VAR_B] = color.b;
+        if (frameSize > 0) {
+            run(frameCode, nullptr);
+        }
+        for (int i = 0; i < numLeds; i++) {
+            vars[VAR_I] = i;
+            vars[VAR_X] = layout->x(i);
+            vars[VAR_Y] = layout->y(i);
+            vars[VAR_PHASE] = layout->phase(i);
+            run(pixelCode, leds + i);
+        }
+        return true;
+    }
+};
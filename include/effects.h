@@ -1,77 +1,331 @@
 #pragma once
 #include <FastLED.h>
+#include "planter_layout.h"
+#include "water_sim.h"
+#include "pixel_kernels.h"
+#include "active_set.h"
+#include "presenter.h"
+#include "clip_player.h"
+#include "effect_vm.h"
+#include "net_clock.h"
+#include "palettes.h"
+
+class Effects;
+
+// Registry entry for an effect. Group-resolution effects render one pixel per
+// LED group into a buffer LED_GROUP_SIZE times smaller and are expanded by the
+// presenter; full-resolution effects draw straight into the strip buffer.
+struct EffectInfo {
+    const char* name;
+    void (Effects::*render)(CRGB color);
+    void (Effects::*start)();   // Resets the effect's state when it comes on; may be null
+    Upscale upscale;
+    uint16_t frameMs;   // Target frame interval
+    bool interpolate;   // frameMs is the keyframe interval; frames in between are blended at the output rate
+    bool palette;       // Takes a palette suffix, "water:ocean", in place of the current color
+};
 
 class Effects {
 private:
     CRGB* leds;
     int numLeds;
-    uint8_t hue = 0;
+    const PlanterLayout* layout;
     
-    // Water effect parameters
+    // Logical pixel buffer for effects that render at group resolution
+    CRGB* groupLeds;
+    int numGroups;
+    
+    // Water effect parameters. Ripples are a function of the network clock:
+    // each tick may spawn one, with parameters hashed from the tick number.
     static const int MAX_RIPPLES = 3;  // Reduced number of ripples for smaller strip
-    static const int LED_GROUP_SIZE = 7;  // Number of LEDs in each group
-    struct Ripple {
-        int center;         // Center point of the ripple
-        int life;          // Current life of the ripple
-        int maxLife;       // Maximum life of this ripple
-        float amplitude;    // Height of the ripple
-        float speed;       // Speed of ripple expansion
-        bool active;       // Whether this ripple is currently active
-    };
-    Ripple ripples[MAX_RIPPLES];
+    static const uint16_t RIPPLE_WIDTH = (LED_GROUP_SIZE * 2) << PlanterLayout::DISTANCE_SHIFT;
+    static const uint16_t RIPPLE_TICK_MS = 70;
+    static const int RIPPLE_MAX_LIFE = 50;   // Ticks
+    
+    // Wave-equation water, one simulation cell per LED group. It steps once per
+    // network clock tick with droplets hashed from the tick number. The surface
+    // is rebuilt from calm water at every epoch, replaying the droplets of the
+    // WATER_SETTLE_TICKS before it, so every controller holds the same surface
+    // however long it has been running; the damping has all but forgotten
+    // older droplets by then, so the rebuild barely shows.
+    WaterSim waterSim;
+    static const uint8_t DROPLET_CHANCE = 40;  // Out of 255, per tick
+    static const uint16_t WATER_TICK_MS = 16;
+    static const uint32_t WATER_EPOCH_TICKS = 1024;   // About 16 s
+    static const uint32_t WATER_SETTLE_TICKS = 512;
+    uint32_t waterTick = 0;   // Last tick simulated
+    bool waterValid = false;
     
     // Effect state variables
-    uint8_t wavePosition = 0;
     uint8_t twinkleDimming = 40;
+    
+    // Twinkle only touches groups that are still lit, each with its own fade rate.
+    // It keeps its own logical buffer since its pixels persist between frames and
+    // groupLeds is shared with the other effects (a transition's outgoing one
+    // draws there too); only the groups it changed are copied across, and the
+    // whole buffer after start or invalidate().
+    ActiveSet litGroups;
+    CRGB* twinkleLeds;
+    uint8_t* twinkleFade;
+    bool twinkleFresh = true;
+    
+    // Prerendered clip, streamed from flash into the player's frame buffer
+    ClipPlayer clipPlayer;
+    CRGB* clipTarget = nullptr;
+    
+    // User program uploaded at runtime
+    EffectVM vm;
+    
+    // Solid only redraws when the color or target buffer changes
+    CRGB solidColor;
+    CRGB* solidTarget = nullptr;
+    
+    // Part of the output buffer changed by the last render, [dirtyStart, dirtyEnd)
+    int dirtyStart = 0;
+    int dirtyEnd = 0;
+    
+    void markDirty(int start, int end) {
+        if (start < dirtyStart) dirtyStart = start;
+        if (end > dirtyEnd) dirtyEnd = end;
+    }
+    
+    // Random number seeded by a network clock tick, identical on every controller
+    static uint32_t tickRandom(uint32_t tick, uint32_t stream) {
+        uint32_t x = tick * 0x9E3779B1u + stream * 0x85EBCA77u;
+        x ^= x >> 16;
+        x *= 0x7FEB352Du;
+        x ^= x >> 15;
+        x *= 0x846CA68Bu;
+        x ^= x >> 16;
+        return x;
+    }
+    
+    // Current color pre-scaled to every brightness, rebuilt only when the color changes
+    CRGB tableColor;
+    bool tablesValid = false;
+    CRGB levelTable[256];  // color scaled by index
+    CRGB waveTable[256];   // color scaled by sin8(index)
+    
+    // Selected palette, and its expanded table for the frame being rendered
+    uint8_t paletteId = 0;
+    const CRGB* paletteTable = nullptr;
+    
+    void updateColorTables(const CRGB& color) {
+        if (tablesValid && tableColor == color) return;
+        for (int i = 0; i < 256; i++) {
+            levelTable[i] = color;
+            levelTable[i].nscale8(i);
+            waveTable[i] = color;
+            waveTable[i].nscale8(sin8(i));
+        }
+        tableColor = color;
+        tablesValid = true;
+    }
 
 public:
-    Effects(CRGB* ledArray, int numLeds) : leds(ledArray), numLeds(numLeds) {
-        // Initialize ripples as inactive
-        for (int i = 0; i < MAX_RIPPLES; i++) {
-            ripples[i].active = false;
+    Effects(CRGB* ledArray, int numLeds, const PlanterLayout* layout) :
+        leds(ledArray), numLeds(numLeds), layout(layout), clipPlayer(numLeds) {
+        numGroups = layout->getNumGroups();
+        groupLeds = new CRGB[numGroups];
+        waterSim.begin(numGroups);
+        litGroups.begin(numGroups);
+        twinkleLeds = new CRGB[numGroups];
+        twinkleFade = new uint8_t[numGroups];
+        startTwinkle();
+    }
+    
+    ~Effects() {
+        delete[] groupLeds;
+        delete[] twinkleLeds;
+        delete[] twinkleFade;
+    }
+    
+    static const EffectInfo* registry(int& count) {
+        static const EffectInfo table[] = {
+            { "solid",   &Effects::solid,     &Effects::startSolid,   Upscale::NONE,    40,             false, false },
+            { "rainbow", &Effects::rainbow,   nullptr,                Upscale::NONE,    40,             false, true },
+            { "ripple",  &Effects::ripple,    nullptr,                Upscale::SMOOTH,  RIPPLE_TICK_MS, true,  false },
+            { "twinkle", &Effects::twinkle,   &Effects::startTwinkle, Upscale::NEAREST, 40,             false, false },
+            { "wave",    &Effects::colorWave, nullptr,                Upscale::NONE,    40,             false, true },
+            { "water",   &Effects::water,     &Effects::startWater,   Upscale::SMOOTH,  WATER_TICK_MS,  false, true },
+            { "clip",    &Effects::clip,      &Effects::startClip,    Upscale::NONE,    10,             false, false },
+            { "program", &Effects::program,   &Effects::startProgram, Upscale::NONE,    16,             false, false },
+        };
+        count = sizeof(table) / sizeof(table[0]);
+        return table;
+    }
+    
+    // Looks up the name before any palette suffix
+    static const EffectInfo* find(const char* name) {
+        int count;
+        const EffectInfo* table = registry(count);
+        const char* colon = strchr(name, ':');
+        size_t length = colon ? colon - name : strlen(name);
+        for (int i = 0; i < count; i++) {
+            if (strncmp(table[i].name, name, length) == 0 && table[i].name[length] == '\0') {
+                return &table[i];
+            }
+        }
+        return nullptr;
+    }
+    
+    // Reset an effect's state before it starts drawing, so switching back to
+    // it doesn't resume from stale state
+    void start(const EffectInfo* effect) {
+        if (effect->start) {
+            (this->*(effect->start))();
+        }
+    }
+    
+    // Render one frame of an effect
+    void render(const EffectInfo* effect, CRGB color) {
+        dirtyStart = outputSize(effect);
+        dirtyEnd = 0;
+        // Looked up every frame, since other Effects instances share the cache and may evict it
+        paletteTable = effect->palette ? Palettes::table(paletteId) : nullptr;
+        (this->*(effect->render))(color);
+    }
+    
+    // Render one frame of the named effect; returns nullptr for unknown names
+    const EffectInfo* render(const char* name, CRGB color) {
+        const EffectInfo* effect = find(name);
+        if (effect) {
+            render(effect, color);
+        }
+        return effect;
+    }
+    
+    // Palette for the effects that take one, 0 for the current color
+    void setPalette(uint8_t id) {
+        paletteId = id;
+    }
+    
+    uint8_t palette() const {
+        return paletteId;
+    }
+    
+    // Point full-resolution effects at a different buffer, e.g. a transition's spare frame
+    void setTarget(CRGB* target) {
+        leds = target;
+    }
+    
+    // Something else wrote the strip buffer; effects that skip unchanged frames must redraw
+    void invalidate() {
+        solidTarget = nullptr;
+        clipTarget = nullptr;
+        twinkleFresh = true;
+    }
+    
+    // Range of output() changed by the last render; empty when start >= end
+    void dirtyRange(int& start, int& end) const {
+        start = dirtyStart;
+        end = dirtyEnd;
+    }
+    
+    // Buffer and pixel count the effect drew into, for the presenter
+    const CRGB* output(const EffectInfo* effect) const {
+        return effect->upscale == Upscale::NONE ? leds : groupLeds;
+    }
+    
+    int outputSize(const EffectInfo* effect) const {
+        return effect->upscale == Upscale::NONE ? numLeds : numGroups;
+    }
+    
+    // Largest keyframe of the effects that interpolate, for sizing the interpolator
+    int interpolatedSize() const {
+        int count, size = 0;
+        const EffectInfo* table = registry(count);
+        for (int i = 0; i < count; i++) {
+            if (table[i].interpolate && outputSize(&table[i]) > size) size = outputSize(&table[i]);
         }
+        return size;
+    }
+    
+    void startSolid() {
+        solidTarget = nullptr;
+    }
+    
+    void startTwinkle() {
+        PixelKernels::fill(twinkleLeds, numGroups, CRGB::Black);
+        litGroups.clear();
+        twinkleFresh = true;
+    }
+    
+    void startWater() {
+        waterValid = false;
     }
     
-    void rainbow() {
-        fill_rainbow(leds, numLeds, hue++, 7);
-        FastLED.show();
-        FastLED.delay(20);
+    void startClip() {
+        clipPlayer.start();
+        clipTarget = nullptr;
+    }
+    
+    void startProgram() {
+        vm.start();
+    }
+    
+    void rainbow(CRGB color) {
+        // One hue step per 40 ms on the network clock, so every controller shows the same colors
+        if (paletteTable) {
+            // The palette travels along the planter in place of the hue wheel
+            PixelKernels::lookup(leds, numLeds, paletteTable, layout->phases(), NetClock::millis() / 40);
+        } else {
+            fill_rainbow(leds, numLeds, NetClock::millis() / 40, 7);
+        }
+        markDirty(0, numLeds);
     }
     
     void solid(CRGB color) {
-        fill_solid(leds, numLeds, color);
-        FastLED.show();
+        // Only redraw when something changed, so a static color costs nothing
+        if (solidTarget != leds || color != solidColor) {
+            PixelKernels::fill(leds, numLeds, color);
+            solidColor = color;
+            solidTarget = leds;
+            markDirty(0, numLeds);
+        }
     }
     
     void twinkle(CRGB color) {
-        // Fade existing pixels
-        for (int i = 0; i < numLeds; i++) {
-            leds[i].fadeToBlackBy(twinkleDimming);
+        if (twinkleFresh) {
+            memcpy(groupLeds, twinkleLeds, numGroups * sizeof(CRGB));
+            markDirty(0, numGroups);
+            twinkleFresh = false;
         }
         
-        // Randomly light up new pixels in groups
-        if (random8() < 50) {
-            int groupStart = random16(numLeds / LED_GROUP_SIZE) * LED_GROUP_SIZE;
-            for (int i = 0; i < LED_GROUP_SIZE && groupStart + i < numLeds; i++) {
-                leds[groupStart + i] = color;
+        // Fade lit groups and drop them from the set once they reach black
+        for (int k = 0; k < litGroups.size();) {
+            int group = litGroups.at(k);
+            twinkleLeds[group].fadeToBlackBy(twinkleFade[group]);
+            groupLeds[group] = twinkleLeds[group];
+            markDirty(group, group + 1);
+            if (!twinkleLeds[group]) {
+                litGroups.removeAt(k);
+            } else {
+                k++;
             }
         }
         
-        FastLED.show();
-        FastLED.delay(20);
+        // Randomly light up new groups
+        if (random8() < 50) {
+            int group = random16(numLeds / LED_GROUP_SIZE);
+            twinkleLeds[group] = color;
+            groupLeds[group] = color;
+            twinkleFade[group] = random8(twinkleDimming / 2, twinkleDimming * 3 / 2);
+            litGroups.insert(group);
+            markDirty(group, group + 1);
+        }
     }
     
     void colorWave(CRGB color) {
-        for (int i = 0; i < numLeds; i++) {
-            // Create smooth sine wave brightness
-            uint8_t brightness = sin8(wavePosition + (i * 255 / numLeds));
-            leds[i] = color;
-            leds[i].nscale8(brightness);
+        // Create smooth sine wave brightness travelling along the planter
+        uint8_t wavePosition = NetClock::millis() / 20;   // 2 steps per 40 ms frame
+        if (paletteTable) {
+            PixelKernels::lookup(leds, numLeds, paletteTable, layout->phases(), wavePosition);
+        } else {
+            updateColorTables(color);
+            PixelKernels::lookup(leds, numLeds, waveTable, layout->phases(), wavePosition);
         }
-        wavePosition += 2;
-        
-        FastLED.show();
-        FastLED.delay(20);
+        markDirty(0, numLeds);
     }
     
     void ripple(CRGB color) {
@@ -80,67 +334,109 @@ public:
         baseColor.nscale8(128);  // Reduce brightness for base
         
         // Fill with base color
-        fill_solid(leds, numLeds, baseColor);
+        PixelKernels::fill(groupLeds, numGroups, baseColor);
+        markDirty(0, numGroups);
         
-        // Update existing ripples
-        for (int i = 0; i < MAX_RIPPLES; i++) {
-            if (ripples[i].active) {
-                // Calculate ripple spread
-                for (int led = 0; led < numLeds; led++) {
-                    float distance = abs(led - ripples[i].center);
-                    float ripplePos = distance - (ripples[i].life * ripples[i].speed);
-                    
-                    // Create sine wave effect with wider spread
-                    if (ripplePos >= 0 && ripplePos < LED_GROUP_SIZE * 2) {  // Wider spread
-                        float brightness = sin(ripplePos * PI / (LED_GROUP_SIZE * 2)) * ripples[i].amplitude;
-                        brightness = constrain(brightness, 0, 1);
-                        
-                        // Add highlight to base color
-                        CRGB highlightColor = color;
-                        highlightColor.nscale8(255 * brightness);
-                        
-                        // Apply the same highlight to the LED group
-                        int groupStart = (led / LED_GROUP_SIZE) * LED_GROUP_SIZE;
-                        for (int j = 0; j < LED_GROUP_SIZE && groupStart + j < numLeds; j++) {
-                            leds[groupStart + j] += highlightColor;
-                        }
-                    }
-                }
+        // Ripples spawned in the last RIPPLE_MAX_LIFE ticks, newest first, that are still alive
+        uint32_t now = NetClock::millis() / RIPPLE_TICK_MS;
+        int drawn = 0;
+        for (int age = 0; age < RIPPLE_MAX_LIFE && drawn < MAX_RIPPLES; age++) {
+            uint32_t born = now - age;
+            uint32_t r = tickRandom(born, 0);
+            if ((r & 0xFF) >= 25) continue;   // Reduced probability of new ripples
+            int maxLife = 30 + (r >> 8) % 20;                 // Longer lifetime
+            if (age >= maxLife) continue;
+            int center = (r >> 16) % (numLeds / LED_GROUP_SIZE);
+            uint8_t amplitude = 77 + (r >> 24) % 127;         // Reduced maximum amplitude (0.3 - 0.8)
+            uint8_t speed = 2 + tickRandom(born, 1) % 4;      // Slower speed (0.15 - 0.35 LEDs per frame)
+            int32_t radius = age * speed;
+            drawn++;
+            
+            // Calculate ripple spread across the water surface
+            for (int group = 0; group < numGroups; group++) {
+                int32_t ripplePos = layout->groupDistance(center, group) - radius;
                 
-                // Update ripple life
-                ripples[i].life++;
-                if (ripples[i].life >= ripples[i].maxLife) {
-                    ripples[i].active = false;
+                // Create sine wave effect with wider spread
+                if (ripplePos >= 0 && ripplePos < RIPPLE_WIDTH) {  // Wider spread
+                    uint8_t wave = quadwave8(ripplePos * 255 / RIPPLE_WIDTH);
+                    
+                    // Add highlight to base color
+                    CRGB highlightColor = color;
+                    highlightColor.nscale8(scale8(wave, amplitude));
+                    
+                    groupLeds[group] += highlightColor;
                 }
             }
         }
         
-        // Randomly create new ripples
-        if (random8() < 25) {  // Reduced probability of new ripples
-            for (int i = 0; i < MAX_RIPPLES; i++) {
-                if (!ripples[i].active) {
-                    // Initialize new ripple with random parameters
-                    int groupNum = random16(numLeds / LED_GROUP_SIZE);
-                    ripples[i].center = groupNum * LED_GROUP_SIZE + (LED_GROUP_SIZE / 2);
-                    ripples[i].life = 0;
-                    ripples[i].maxLife = random8(30, 50);  // Longer lifetime
-                    ripples[i].amplitude = 0.3 + (random8() / 255.0) * 0.5;  // Reduced maximum amplitude
-                    ripples[i].speed = 0.15 + (random8() / 255.0) * 0.2;  // Slower speed
-                    ripples[i].active = true;
-                    break;
-                }
-            }
+        // Apply gentle noise to simulate small surface variations
+        for (int group = 0; group < numGroups; group++) {
+            uint8_t noise = tickRandom(now, group + 2) % 6;  // Reduced noise range
+            groupLeds[group].addToRGB(noise);
         }
+    }
+    
+    // One simulation step for a tick: droplets push the surface down and send rings outward
+    void stepWater(uint32_t tick) {
+        uint32_t r = tickRandom(tick, 0);
+        if ((r & 0xFF) < DROPLET_CHANCE) {
+            waterSim.drop((r >> 8) % waterSim.getNumCells(), -(int16_t)(2048 + (r >> 16) % 4096));
+        }
+        waterSim.step();
+    }
+    
+    // Advance the water simulation to the current tick; one logical pixel per cell
+    void water(CRGB color) {
+        int cells = waterSim.getNumCells();
         
-        // Apply gentle noise to simulate small surface variations
-        for (int i = 0; i < numLeds; i += LED_GROUP_SIZE) {
-            int8_t noise = random8(10) - 5;  // Reduced noise range
-            for (int j = 0; j < LED_GROUP_SIZE && i + j < numLeds; j++) {
-                leds[i + j].addToRGB(noise);
+        // Rebuild at a new epoch, on start and when the clock steps back
+        uint32_t now = NetClock::millis() / WATER_TICK_MS;
+        uint32_t epoch = now - now % WATER_EPOCH_TICKS;
+        if (!waterValid || (int32_t)(now - waterTick) < 0 || (int32_t)(waterTick - epoch) < 0) {
+            waterSim.reset();
+            for (uint32_t tick = epoch - WATER_SETTLE_TICKS + 1; tick != epoch + 1; tick++) {
+                stepWater(tick);
             }
+            waterTick = epoch;
+            waterValid = true;
+        }
+        while (waterTick != now) {
+            stepWater(++waterTick);
         }
         
-        FastLED.show();
-        FastLED.delay(50);  // Slower animation speed
+        // Troughs take the palette's first colors, crests its last: deep blue to white caustics with "ocean"
+        const CRGB* table = paletteTable;
+        if (!table) {
+            updateColorTables(color);
+            table = levelTable;
+        }
+        markDirty(0, cells);
+        for (int cell = 0; cell < cells; cell++) {
+            int32_t level = 128 + (waterSim.height(cell) >> 5);  // Flat water sits at half brightness
+            groupLeds[cell] = table[constrain(level, 0, 255)];
+        }
+    }
+    
+    // Play the selected clip at its own frame rate; the registry interval only sets how often it is polled
+    void clip(CRGB color) {
+        int start = numLeds;
+        int end = 0;
+        clipPlayer.render(millis(), start, end);
+        if (clipTarget != leds) {
+            start = 0;
+            end = numLeds;
+            clipTarget = leds;
+        }
+        if (start < end) {
+            memcpy(leds + start, clipPlayer.output() + start, (end - start) * sizeof(CRGB));
+            markDirty(start, end);
+        }
+    }
+    
+    // Run the uploaded program; the strip stays as it was until one is loaded
+    void program(CRGB color) {
+        if (vm.render(leds, numLeds, layout, color)) {
+            markDirty(0, numLeds);
+        }
     }
 };
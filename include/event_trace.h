@@ -0,0 +1,260 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "config.h"
+
+// Timeline of where a command spends its time on the way to the strip: MQTT
+// or HTTP receive, JSON parse, settings commit, publishState(), effect render,
+// the hand-off to the output task and the wire time there. Each command gets
+// an id when it arrives; the first frame rendered after it carries the same
+// id, so its spans can be picked out in the viewer.
+//
+// Only active in builds made with TRACE_EVENTS (the esp32dev-trace
+// environment); otherwise the probe macros compile to nothing. Events go into
+// a ring of TRACE_BUFFER_EVENTS entries, overwriting the oldest, and GET /trace
+// downloads them as Chrome trace JSON for ui.perfetto.dev or chrome://tracing.
+//
+// Spans are timed with esp_timer, which both cores share and which does not
+// change with the CPU clock (idle mode lowers it). Each event is filed under
+// the FreeRTOS task that recorded it, so a task that moves between cores
+// stays on one row of the timeline.
+class EventTrace {
+public:
+    struct Event {
+        uint32_t startUs;
+        uint32_t durationUs;  // Span length; 0 for command markers
+        const char* name;     // String literal
+        uint16_t command;     // 0 when the event belongs to no command
+        char phase;           // Chrome phase: X span, b/e command start and end
+        uint8_t task;         // Index into the task table, the trace's tid
+    };
+
+    static const int MAX_TASKS = 12;
+
+private:
+    struct State {
+        Event events[TRACE_BUFFER_EVENTS];
+        uint32_t head;                 // Events recorded since boot
+        volatile uint16_t nextCommand;
+        volatile uint16_t pending;     // Arrived, not yet picked up by a frame
+        volatile uint16_t latest;      // Last to arrive, for probes in the handlers
+        volatile bool exporting;       // Recording pauses while /trace reads the ring
+
+        // Tasks seen so far; an event's task is its index here
+        TaskHandle_t tasks[MAX_TASKS];
+        const char* taskNames[MAX_TASKS];
+        volatile uint8_t taskCount;
+
+        // Export position
+        uint8_t stage;                 // 0 header, 1 task names, 2 events, 3 footer sent
+        uint8_t taskCursor;
+        uint32_t cursor, end;
+        char line[256];
+        int lineLength, lineSent;
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+
+    static portMUX_TYPE& taskLock() {
+        static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+        return lock;
+    }
+
+    // Table index of the calling task, added on its first event; the last slot
+    // is shared once the table is full
+    static uint8_t taskIndex() {
+        State& s = state();
+        TaskHandle_t self = xTaskGetCurrentTaskHandle();
+        uint8_t count = s.taskCount;
+        for (uint8_t i = 0; i < count; i++) {
+            if (s.tasks[i] == self) return i;
+        }
+        portENTER_CRITICAL(&taskLock());
+        uint8_t i = 0;
+        while (i < s.taskCount && s.tasks[i] != self) i++;
+        if (i == s.taskCount && i < MAX_TASKS) {
+            s.tasks[i] = self;
+            s.taskNames[i] = pcTaskGetTaskName(self);
+            s.taskCount = i + 1;
+        }
+        portEXIT_CRITICAL(&taskLock());
+        return i < MAX_TASKS ? i : MAX_TASKS - 1;
+    }
+
+    static uint32_t nowUs() {
+        return (uint32_t)esp_timer_get_time();
+    }
+
+    // Next piece of the JSON document into line; false when done
+    static bool nextLine() {
+        State& s = state();
+        if (s.stage == 0) {
+            s.stage = 1;
+            s.lineLength = snprintf(s.line, sizeof(s.line),
+                                    "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+                                    "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"controller\"}}");
+            return true;
+        }
+        if (s.stage == 1) {
+            // One timeline row per task, named as FreeRTOS knows it
+            if (s.taskCursor < s.taskCount) {
+                uint8_t i = s.taskCursor++;
+                s.lineLength = snprintf(s.line, sizeof(s.line),
+                                        ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                                        "\"args\":{\"name\":\"%s\"}}", i, s.taskNames[i]);
+                return true;
+            }
+            s.stage = 2;
+        }
+        if (s.cursor == s.end) {
+            if (s.stage == 3) return false;
+            s.stage = 3;
+            s.lineLength = snprintf(s.line, sizeof(s.line), "]}\n");
+            return true;
+        }
+
+        const Event& e = s.events[s.cursor++ % TRACE_BUFFER_EVENTS];
+        if (e.phase == 'X') {
+            s.lineLength = snprintf(s.line, sizeof(s.line),
+                                    ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":1,\"tid\":%u,"
+                                    "\"args\":{\"command\":%u}}",
+                                    e.name, (unsigned)e.startUs, (unsigned)e.durationUs, e.task, e.command);
+        } else {
+            // Commands are async events, so they can start on one task and end on another
+            s.lineLength = snprintf(s.line, sizeof(s.line),
+                                    ",\n{\"name\":\"command\",\"cat\":\"command\",\"ph\":\"%c\",\"id\":%u,\"ts\":%u,"
+                                    "\"pid\":1,\"tid\":%u,\"args\":{\"%s\":\"%s\"}}",
+                                    e.phase, e.command, (unsigned)e.startUs, e.task,
+                                    e.phase == 'b' ? "source" : "ended", e.name);
+        }
+        return true;
+    }
+
+public:
+    static bool enabled() {
+#ifdef TRACE_EVENTS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static void record(const char* name, char phase, uint16_t command, uint32_t startUs, uint32_t durationUs) {
+        State& s = state();
+        if (s.exporting) return;
+        uint32_t slot = __atomic_fetch_add(&s.head, 1, __ATOMIC_RELAXED) % TRACE_BUFFER_EVENTS;
+        Event& e = s.events[slot];
+        e.startUs = startUs;
+        e.durationUs = durationUs;
+        e.name = name;
+        e.command = command;
+        e.phase = phase;
+        e.task = taskIndex();
+    }
+
+    // A command arrived from source ("mqtt", "http"); returns its id
+    static uint16_t beginCommand(const char* source) {
+        State& s = state();
+        uint16_t id = ++s.nextCommand;
+        if (id == 0) id = s.nextCommand = 1;
+        uint16_t superseded = s.pending;
+        if (superseded) {
+            // Never got a frame of its own; the next one shows both
+            record("superseded", 'e', superseded, nowUs(), 0);
+        }
+        record(source, 'b', id, nowUs(), 0);
+        s.latest = id;
+        s.pending = id;
+        return id;
+    }
+
+    // Command the handler running now belongs to
+    static uint16_t latestCommand() {
+        return state().latest;
+    }
+
+    // Render loop: the command this frame is the first to show, or 0
+    static uint16_t takeCommand() {
+        State& s = state();
+        uint16_t id = s.pending;
+        if (id) __atomic_compare_exchange_n(&s.pending, &id, (uint16_t)0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        return id;
+    }
+
+    // The command's frame has been handed to the output
+    static void endCommand(uint16_t command) {
+        if (command) record("frame", 'e', command, nowUs(), 0);
+    }
+
+    // Records one span from construction to the end of the enclosing block
+    class Scope {
+    private:
+        const char* name;
+        uint16_t command;
+        uint32_t startUs;
+
+    public:
+        Scope(const char* spanName, uint16_t commandId) : name(spanName), command(commandId), startUs(nowUs()) {
+        }
+
+        ~Scope() {
+            record(name, 'X', command, startUs, nowUs() - startUs);
+        }
+    };
+
+    // Start reading the ring out as JSON; false if another export is running
+    static bool beginExport() {
+        State& s = state();
+        if (s.exporting) return false;
+        s.exporting = true;
+        s.end = s.head;
+        s.cursor = s.end > TRACE_BUFFER_EVENTS ? s.end - TRACE_BUFFER_EVENTS : 0;
+        s.lineLength = s.lineSent = 0;
+        s.stage = 0;
+        s.taskCursor = 0;
+        return true;
+    }
+
+    // Fill up to maxLen bytes of the export; 0 once it is complete
+    static size_t read(uint8_t* buffer, size_t maxLen) {
+        State& s = state();
+        size_t written = 0;
+        while (written < maxLen) {
+            if (s.lineSent == s.lineLength) {
+                if (!nextLine()) break;
+                s.lineSent = 0;
+            }
+            size_t n = s.lineLength - s.lineSent;
+            if (n > maxLen - written) n = maxLen - written;
+            memcpy(buffer + written, s.line + s.lineSent, n);
+            s.lineSent += n;
+            written += n;
+        }
+        return written;
+    }
+
+    // Resume recording after an export, complete or abandoned
+    static void endExport() {
+        state().exporting = false;
+    }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+
+#ifdef TRACE_EVENTS
+// Span from here to the end of the block, tagged with a command id
+#define TRACE_SCOPE(name, command) EventTrace::Scope TRACE_CONCAT(traceScope, __LINE__)(name, command)
+#define TRACE_COMMAND(source) EventTrace::beginCommand(source)
+#define TRACE_TAKE_COMMAND() EventTrace::takeCommand()
+#define TRACE_END_COMMAND(command) EventTrace::endCommand(command)
+#else
+// Arguments are not evaluated
+#define TRACE_SCOPE(name, command) ((void)sizeof(command))
+#define TRACE_COMMAND(source) ((uint16_t)0)
+#define TRACE_TAKE_COMMAND() ((uint16_t)0)
+#define TRACE_END_COMMAND(command) ((void)sizeof(command))
+#endif
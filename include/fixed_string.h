@@ -0,0 +1,75 @@
+#pragma once
+#include <Arduino.h>
+
+// String with its storage inline, for state that lives for the whole uptime
+// or is rebuilt on every command. Assigning never allocates: text longer
+// than the capacity is truncated, and set() reports when that happened.
+template<size_t N>
+class FixedString {
+private:
+    char text[N + 1];
+    size_t len = 0;
+
+public:
+    FixedString() {
+        text[0] = '\0';
+    }
+
+    FixedString(const char* value) {
+        set(value);
+    }
+
+    FixedString& operator=(const char* value) {
+        set(value);
+        return *this;
+    }
+
+    // Copy up to N characters; false if the value was truncated
+    bool set(const char* value, size_t count) {
+        bool fits = count <= N;
+        len = fits ? count : N;
+        memmove(text, value, len);   // value may point into this string
+        text[len] = '\0';
+        return fits;
+    }
+
+    bool set(const char* value) {
+        return set(value ? value : "", value ? strlen(value) : 0);
+    }
+
+    bool append(char c) {
+        if (len >= N) return false;
+        text[len++] = c;
+        text[len] = '\0';
+        return true;
+    }
+
+    void clear() {
+        len = 0;
+        text[0] = '\0';
+    }
+
+    const char* c_str() const {
+        return text;
+    }
+
+    size_t length() const {
+        return len;
+    }
+
+    bool empty() const {
+        return len == 0;
+    }
+
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+    bool operator==(const char* other) const {
+        return strcmp(text, other) == 0;
+    }
+
+    bool operator!=(const char* other) const {
+        return strcmp(text, other) != 0;
+    }
+};
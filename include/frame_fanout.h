@@ -0,0 +1,239 @@
+#pragma once
+#include <Arduino.h>
+#include <FastLED.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <EEPROM.h>
+#include "config.h"
+#include "ddp_protocol.h"
+#include "net_clock.h"
+
+// One long logical strip spread over several controllers. The leader
+// renders all LOGICAL_LEDS, drives the first NUM_LEDS itself and streams
+// each follower its slice over DDP (ddp_protocol.h), stamped to be shown
+// FANOUT_PRESENT_DELAY_MS later on the network clock; its own part is
+// scheduled on the output task for that moment, so all strips change
+// together. Pixels go out at full scale with the brightness alongside, and
+// every node applies it with its own dithering. Followers show what they
+// receive at the stamped time and go back to their own effects when the
+// leader has been silent for FANOUT_TIMEOUT_MS.
+//
+// Packets are built in a single buffer, reused for every slice. The role and
+// the follower slices are stored in EEPROM and take effect on boot.
+class FrameFanout {
+public:
+    enum Role : uint8_t { OFF = 0, LEADER = 1, FOLLOWER = 2 };
+
+    struct Target {
+        uint8_t ip[4];
+        uint16_t start;   // First LED of the slice in the logical strip
+        uint16_t count;
+    };
+
+    struct Stored {
+        uint16_t magic;
+        uint8_t role;
+        uint8_t targetCount;
+        Target targets[FANOUT_MAX_FOLLOWERS];
+    };
+
+    // What the leader knows about one follower
+    struct Link {
+        uint8_t sequence;
+        uint32_t frames;          // Frames sent
+        uint32_t windowBytes;     // Bytes sent in the current second
+        uint32_t windowStart;
+        uint32_t bytesPerSecond;  // Over the last full second
+        uint32_t lastSent;
+        uint8_t brightness;       // Sent with the last frame
+        DDP::Status status;       // Last report from the follower
+        uint32_t statusAt;        // 0 until one arrives
+    };
+
+private:
+    Stored config;
+    WiFiUDP udp;
+    bool listening = false;
+    uint8_t packet[DDP::MAX_PACKET];
+    Link links[FANOUT_MAX_FOLLOWERS];
+
+    // Follower side
+    uint8_t* incoming = nullptr;
+    uint8_t* ready = nullptr;
+    DDP::Receiver* receiver = nullptr;
+    IPAddress leaderIP;
+    bool leaderSeen = false;
+    uint32_t lastFrameAt = 0;
+    uint32_t lastStatus = 0;
+
+    static uint32_t now() {
+        return DDP::timecode(NetClock::micros());
+    }
+
+    void sendTo(const Target& t, int len) {
+        udp.beginPacket(IPAddress(t.ip[0], t.ip[1], t.ip[2], t.ip[3]), DDP_PORT);
+        udp.write(packet, len);
+        udp.endPacket();
+    }
+
+    void receiveAll(uint32_t nowMs) {
+        while (udp.parsePacket() > 0) {
+            int len = udp.read(packet, sizeof(packet));
+            if (len <= 0) continue;
+
+            if (config.role == FOLLOWER) {
+                if ((packet[0] & 0xC0) != DDP::VERSION1 || (packet[0] & DDP::REPLY)) continue;
+                receiver->receive(packet, len, now());
+                leaderIP = udp.remoteIP();
+                leaderSeen = true;
+                lastFrameAt = nowMs;
+                continue;
+            }
+
+            // Leader: status replies, matched to the follower by address
+            DDP::Status status;
+            if (!DDP::parseStatus(packet, len, status)) continue;
+            IPAddress from = udp.remoteIP();
+            for (int i = 0; i < config.targetCount; i++) {
+                const uint8_t* ip = config.targets[i].ip;
+                if (from == IPAddress(ip[0], ip[1], ip[2], ip[3])) {
+                    links[i].status = status;
+                    links[i].statusAt = nowMs;
+                }
+            }
+        }
+    }
+
+public:
+    ~FrameFanout() {
+        delete receiver;
+        delete[] incoming;
+        delete[] ready;
+    }
+
+    // Load the stored role; a follower sets up buffers for its own strip of localLeds
+    void begin(int localLeds) {
+        if (!load(config)) {
+            memset(&config, 0, sizeof(config));
+        }
+        memset(links, 0, sizeof(links));
+        if (config.role == FOLLOWER) {
+            incoming = new uint8_t[localLeds * sizeof(CRGB)];
+            ready = new uint8_t[localLeds * sizeof(CRGB)];
+            receiver = new DDP::Receiver(incoming, ready, localLeds * sizeof(CRGB),
+                                         (int64_t)FANOUT_PRESENT_DELAY_MS * 1000);
+        }
+        if (config.role != OFF) {
+            Serial.printf("Frame fan-out: %s, %u followers\n", config.role == LEADER ? "leader" : "follower",
+                          config.role == LEADER ? config.targetCount : 0);
+        }
+    }
+
+    static bool valid(const Stored& stored) {
+        if (stored.magic != FANOUT_MAGIC || stored.role > FOLLOWER) return false;
+        if (stored.targetCount > FANOUT_MAX_FOLLOWERS) return false;
+        for (int i = 0; i < stored.targetCount; i++) {
+            const Target& t = stored.targets[i];
+            if (t.count == 0 || t.start + t.count > LOGICAL_LEDS) return false;
+        }
+        return true;
+    }
+
+    static bool load(Stored& stored) {
+        EEPROM.get(FANOUT_ADDR, stored);
+        return valid(stored);
+    }
+
+    static bool save(const Stored& stored) {
+        EEPROM.put(FANOUT_ADDR, stored);
+        return EEPROM.commit();
+    }
+
+    // Call from loop(): joins the DDP port while the network is up and handles what arrived
+    void update(uint32_t nowMs, bool networkUp) {
+        if (config.role == OFF) return;
+        if (networkUp != listening) {
+            if (networkUp) {
+                udp.begin(DDP_PORT);
+            } else {
+                udp.stop();
+            }
+            listening = networkUp;
+        }
+        if (!listening) return;
+
+        receiveAll(nowMs);
+
+        if (config.role == FOLLOWER && leaderSeen && nowMs - lastStatus >= FANOUT_STATUS_MS) {
+            int len = DDP::buildStatus(packet, receiver->status());
+            udp.beginPacket(leaderIP, DDP_PORT);
+            udp.write(packet, len);
+            udp.endPacket();
+            lastStatus = nowMs;
+        }
+    }
+
+    bool leading() const {
+        return config.role == LEADER && listening;
+    }
+
+    // True while frames from the leader are arriving; the loop then shows those instead of rendering
+    bool following(uint32_t nowMs) const {
+        return config.role == FOLLOWER && leaderSeen && nowMs - lastFrameAt < FANOUT_TIMEOUT_MS;
+    }
+
+    // Leader: stream every follower slice that changed (or is due a keepalive), to be shown at
+    // brightness at presentUs on the network clock
+    void send(const CRGB* logical, int changedStart, int changedEnd, uint8_t brightness, int64_t presentUs,
+              uint32_t nowMs) {
+        uint32_t presentAt = DDP::timecode(presentUs);
+        for (int i = 0; i < config.targetCount; i++) {
+            const Target& t = config.targets[i];
+            Link& link = links[i];
+            bool changed = changedStart < t.start + t.count && changedEnd > t.start;
+            changed |= brightness != link.brightness;
+            if (!changed && link.frames > 0 && nowMs - link.lastSent < FANOUT_KEEPALIVE_MS) continue;
+
+            const uint8_t* slice = (const uint8_t*)(logical + t.start);
+            uint32_t bytes = t.count * sizeof(CRGB);
+            for (int p = 0; p < DDP::packets(bytes); p++) {
+                int len = DDP::build(packet, link.sequence, p, bytes, presentAt, brightness);
+                memcpy(DDP::payload(packet), slice + p * DDP::MAX_DATA, DDP::dataLength(packet));
+                sendTo(t, len);
+                link.windowBytes += len;
+            }
+            link.frames++;
+            link.lastSent = nowMs;
+            link.brightness = brightness;
+            if (nowMs - link.windowStart >= 1000) {
+                link.bytesPerSecond = link.windowBytes * 1000 / (nowMs - link.windowStart);
+                link.windowBytes = 0;
+                link.windowStart = nowMs;
+            }
+        }
+    }
+
+    // Follower: microseconds until the received frame is due, or -1 if none is waiting
+    int32_t dueInUs() const {
+        return receiver ? (int32_t)receiver->dueInUs(now()) : -1;
+    }
+
+    // Follower: copy the waiting frame into the strip buffer, with the brightness to show it at
+    bool present(CRGB* dst, int numLeds, uint8_t& brightness) {
+        if (receiver == nullptr || receiver->dueInUs(now()) < 0) return false;
+        brightness = receiver->brightness();
+        uint32_t bytes;
+        const uint8_t* frame = receiver->take(bytes);
+        uint32_t limit = numLeds * sizeof(CRGB);
+        memcpy(dst, frame, bytes < limit ? bytes : limit);
+        return true;
+    }
+
+    const Stored& settings() const {
+        return config;
+    }
+
+    const Link& link(int i) const {
+        return links[i];
+    }
+};
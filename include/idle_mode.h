@@ -0,0 +1,101 @@
+#pragma once
+#include <Arduino.h>
+#include "config.h"
+
+// What the controller does while the light is off. Turning it off fades the
+// output to black over IDLE_FADE_MS; after the final black frame the render
+// loop parks: it stops drawing, drops the CPU to IDLE_CPU_MHZ and blocks
+// between network polls, leaving the WiFi modem to sleep between beacons.
+// A command that turns the light back on calls wake() from the web or MQTT
+// task, which releases the loop at once instead of at the next poll.
+class IdleMode {
+public:
+    enum State : uint8_t { ACTIVE, FADING, PARKED };
+
+private:
+    State state = ACTIVE;
+    uint8_t fadeFrom = 0;       // Level the fade started at
+    uint32_t fadeStart = 0;
+    uint32_t parkedAt = 0;
+    uint32_t parkedMs = 0;      // Time spent parked before the current stretch
+
+    SemaphoreHandle_t wakeSignal = nullptr;
+    volatile uint32_t wakeAt = 0;   // micros() of the pending wake, 0 if none
+    uint32_t wakeLatencyUs = 0;
+
+public:
+    void begin() {
+        wakeSignal = xSemaphoreCreateBinary();
+    }
+
+    // Output level for the requested brightness: follows it while on, fades out from the last level when off
+    uint8_t level(uint8_t requested, uint32_t now) {
+        if (requested > 0) {
+            state = ACTIVE;
+            fadeFrom = requested;
+            return requested;
+        }
+        if (state == ACTIVE) {
+            state = FADING;
+            fadeStart = now;
+        }
+        uint32_t elapsed = now - fadeStart;
+        if (elapsed >= IDLE_FADE_MS) return 0;
+        return (uint32_t)fadeFrom * (IDLE_FADE_MS - elapsed) / IDLE_FADE_MS;
+    }
+
+    // True once the fade has reached black, so the frame just shown was the last
+    bool faded(uint32_t now) const {
+        return state == FADING && now - fadeStart >= IDLE_FADE_MS;
+    }
+
+    // Stop rendering: call after the final black frame is out
+    void park(uint32_t now) {
+        state = PARKED;
+        parkedAt = now;
+        setCpuFrequencyMhz(IDLE_CPU_MHZ);
+        Serial.printf("Idle: parked at %u MHz\n", (unsigned)getCpuFrequencyMhz());
+    }
+
+    bool parked() const {
+        return state == PARKED;
+    }
+
+    // Block the loop for up to timeoutMs, or until wake() is called
+    void wait(uint32_t timeoutMs) {
+        xSemaphoreTake(wakeSignal, pdMS_TO_TICKS(timeoutMs));
+    }
+
+    // A command turned the light on; safe to call from any task
+    void wake() {
+        if (state != PARKED) return;
+        wakeAt = micros();
+        xSemaphoreGive(wakeSignal);
+    }
+
+    // Back to full speed before rendering the first frame
+    void resume(uint32_t now) {
+        setCpuFrequencyMhz(ACTIVE_CPU_MHZ);
+        parkedMs += now - parkedAt;
+        state = ACTIVE;
+        fadeFrom = 0;
+    }
+
+    // Call after each frame is handed to the output; records the first one after a wake
+    void frameShown() {
+        uint32_t at = wakeAt;
+        if (at == 0) return;
+        wakeLatencyUs = micros() - at;
+        wakeAt = 0;
+    }
+
+    // From the command that woke the loop to the first frame on its way to the strip
+    uint32_t wakeLatency() const {
+        return wakeLatencyUs;
+    }
+
+    // Total time parked since boot
+    uint32_t idleSeconds(uint32_t now) const {
+        return (parkedMs + (state == PARKED ? now - parkedAt : 0)) / 1000;
+    }
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <FastLED.h>
+#include "config.h"
+#include "pixel_kernels.h"
+
+// Lets an effect render slower than the output rate. The effect draws
+// keyframes at its own interval; every output frame in between blends the
+// last two in fixed point, so motion stays smooth for a fraction of the
+// render cost. The output trails the effect by one keyframe.
+//
+// Keyframes sit on the effect's tick grid in network time (now / interval,
+// as the effects count ticks), so synced controllers blend the same two
+// keyframes by the same amount. Buffers hold the effect's render
+// resolution, which for grouped effects is the group count, not the strip.
+class Interpolator {
+private:
+    int capacity = 0;
+    CRGB* previous = nullptr;
+    CRGB* latest = nullptr;
+    CRGB* blended = nullptr;
+    int count = 0;
+    uint32_t tick = 0;        // Tick latest was rendered in; it is fully shown when the next one starts
+    uint16_t interval = 1;
+    bool primed = false;
+
+public:
+    ~Interpolator() {
+        delete[] previous;
+        delete[] latest;
+        delete[] blended;
+    }
+
+    // Allocate for keyframes of up to maxPixels
+    void begin(int maxPixels) {
+        capacity = maxPixels;
+        previous = new CRGB[capacity];
+        latest = new CRGB[capacity];
+        blended = new CRGB[capacity];
+    }
+
+    // Forget the keyframes, e.g. when another effect starts
+    void reset() {
+        primed = false;
+    }
+
+    // True when a new tick has started and the effect should render its keyframe
+    bool due(uint32_t now, uint16_t intervalMs) const {
+        return !primed || intervalMs != interval || now / intervalMs != tick;
+    }
+
+    // Take a new keyframe of pixels from src, rendered at network time now
+    void keyframe(const CRGB* src, int pixels, uint32_t now, uint16_t intervalMs) {
+        if (pixels > capacity) pixels = capacity;
+        CRGB* swap = previous;
+        previous = latest;
+        latest = swap;
+        memcpy(latest, src, pixels * sizeof(CRGB));
+
+        // Blend on from the last keyframe only if it was the tick just before
+        uint32_t current = now / intervalMs;
+        bool onTime = primed && pixels == count && intervalMs == interval && current == tick + 1;
+        if (!onTime) memcpy(previous, src, pixels * sizeof(CRGB));
+        tick = current;
+        interval = intervalMs;
+        count = pixels;
+        primed = true;
+    }
+
+    // Output frame for network time now, between the last two keyframes
+    const CRGB* frame(uint32_t now) {
+        uint32_t elapsed = now - tick * interval;
+        if (elapsed >= interval) return latest;
+        memcpy(blended, previous, count * sizeof(CRGB));
+        PixelKernels::blend(blended, latest, count, elapsed * 256 / interval);
+        return blended;
+    }
+};
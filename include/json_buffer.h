@@ -0,0 +1,18 @@
+#pragma once
+#include <ArduinoJson.h>
+#include <stddef.h>
+
+// serializeJson() into a fixed buffer cuts the text off when it does not fit,
+// and a document that ran out of capacity while being filled silently lost
+// members. Either way the reply is wrong, so this writes the whole document
+// or nothing: 0 (and an empty string) when it would not be complete.
+//
+// Plain C++ like light_command.h, so the host tools use it too.
+inline size_t serializeJsonComplete(const JsonDocument& doc, char* out, size_t size) {
+    if (size == 0) return 0;
+    if (doc.overflowed() || measureJson(doc) >= size) {
+        out[0] = '\0';
+        return 0;
+    }
+    return serializeJson(doc, out, size);
+}
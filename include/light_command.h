@@ -0,0 +1,108 @@
+#pragma once
+#include <ArduinoJson.h>
+#include "json_buffer.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One command from Home Assistant or the web UI, and the state reply to it.
+// Plain C++ on top of ArduinoJson, like ddp_protocol.h: the MQTT and HTTP
+// handlers in main.cpp use it on the device, tools/command_load.cpp on the
+// host, so both parse and encode the same way.
+class LightCommand {
+public:
+    enum Field : uint8_t { BRIGHTNESS = 1, COLOR = 2, EFFECT = 4 };
+
+    uint8_t fields = 0;   // Which of the values below the command sets
+    uint8_t brightness = 0;
+    uint8_t r = 0, g = 0, b = 0;
+    char effect[32] = "";
+
+    void setBrightness(int value) {
+        brightness = value;
+        fields |= BRIGHTNESS;
+    }
+
+    void setColor(uint8_t red, uint8_t green, uint8_t blue) {
+        r = red;
+        g = green;
+        b = blue;
+        fields |= COLOR;
+    }
+
+    // RRGGBB, as the web UI sends it
+    void setColor(const char* hex) {
+        uint32_t number = (uint32_t)strtoul(hex, nullptr, 16);
+        setColor(number >> 16, (number >> 8) & 0xFF, number & 0xFF);
+    }
+
+    void setEffect(const char* name) {
+        strncpy(effect, name, sizeof(effect) - 1);
+        effect[sizeof(effect) - 1] = '\0';
+        fields |= EFFECT;
+    }
+
+    // Home Assistant's JSON schema: {"state":"ON","brightness":128,"color":{"r":255,"g":0,"b":0},"effect":"wave"}.
+    // The payload need not be NUL-terminated; false if it is not valid JSON.
+    // "ON" without a brightness keeps the current one, anything else turns the light off.
+    bool parseJson(const char* payload, size_t length) {
+        StaticJsonDocument<200> doc;
+        if (deserializeJson(doc, payload, length)) return false;
+
+        fields = 0;
+        if (doc.containsKey("state")) {
+            const char* state = doc["state"] | "";
+            if (strcmp(state, "ON") != 0) {
+                setBrightness(0);
+            } else if (doc.containsKey("brightness")) {
+                setBrightness(doc["brightness"].as<int>());
+            }
+        } else if (doc.containsKey("brightness")) {
+            setBrightness(doc["brightness"].as<int>());
+        }
+
+        if (doc.containsKey("color")) {
+            JsonObject color = doc["color"];
+            if (color.containsKey("r") && color.containsKey("g") && color.containsKey("b")) {
+                setColor(color["r"].as<int>(), color["g"].as<int>(), color["b"].as<int>());
+            }
+        }
+
+        if (doc.containsKey("effect")) {
+            setEffect(doc["effect"] | "");
+        }
+        return true;
+    }
+
+    // State reply for Home Assistant; returns its length, 0 if it does not fit in size
+    static size_t encodeState(char* out, size_t size, uint8_t brightness, uint8_t r, uint8_t g, uint8_t b,
+                              const char* effect) {
+        StaticJsonDocument<200> doc;
+        doc["state"] = (brightness > 0) ? "ON" : "OFF";
+        doc["brightness"] = brightness;
+
+        JsonObject color = doc.createNestedObject("color");
+        color["r"] = r;
+        color["g"] = g;
+        color["b"] = b;
+
+        if (effect[0] != '\0') {
+            doc["effect"] = effect;
+        }
+        return serializeJsonComplete(doc, out, size);
+    }
+
+    // GET /state for the web UI, color as #RRGGBB; returns its length, 0 if it does not fit in size
+    static size_t encodeWebState(char* out, size_t size, uint8_t brightness, uint8_t r, uint8_t g, uint8_t b,
+                                 const char* effect) {
+        StaticJsonDocument<200> doc;
+        doc["brightness"] = brightness;
+        doc["effect"] = effect;
+
+        char colorHex[8];
+        snprintf(colorHex, sizeof(colorHex), "#%02X%02X%02X", r, g, b);
+        doc["color"] = colorHex;   // Copied into the document
+        return serializeJsonComplete(doc, out, size);
+    }
+};
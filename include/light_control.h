@@ -0,0 +1,64 @@
+#pragma once
+#include <FastLED.h>
+#include "config.h"
+#include "event_trace.h"
+#include "fixed_string.h"
+#include "light_command.h"
+#include "mqtt_session.h"
+
+// Applies commands to the light's state and publishes the state reply. The
+// state itself stays in the caller's variables; main.cpp passes the strip's
+// globals and a hook that stores the change and wakes the strip,
+// tools/command_load.cpp its own variables and no hook, so both run the same
+// command path.
+class LightControl {
+public:
+    // Called after the state has taken over a command, e.g. to save it; saveNow skips rate limiting
+    typedef void (*AppliedFunction)(const LightCommand& light, bool saveNow);
+
+private:
+    uint8_t& brightness;
+    CRGB& color;
+    FixedString<31>& effect;
+    MQTTSession& session;
+    AppliedFunction applied;
+    uint32_t unpublishedCount = 0;
+
+public:
+    LightControl(uint8_t& brightness, CRGB& color, FixedString<31>& effect, MQTTSession& session,
+                 AppliedFunction onApplied = nullptr) :
+        brightness(brightness), color(color), effect(effect), session(session), applied(onApplied) {
+    }
+
+    // Take over what a command from MQTT or the web UI sets and report the new state.
+    // False if it set nothing.
+    bool apply(const LightCommand& light, bool saveNow) {
+        if (light.fields == 0) return false;
+        if (light.fields & LightCommand::BRIGHTNESS) brightness = light.brightness;
+        if (light.fields & LightCommand::COLOR) color = CRGB(light.r, light.g, light.b);
+        if (light.fields & LightCommand::EFFECT) effect = light.effect;
+        if (applied) applied(light, saveNow);
+
+        // Publish the current state back to Home Assistant
+        publish();
+        return true;
+    }
+
+    // Queue the state for Home Assistant, raw color values before brightness
+    void publish() {
+        TRACE_SCOPE("publish_state", EventTrace::latestCommand());
+        char output[MQTT_QUEUE_PAYLOAD];
+        if (!LightCommand::encodeState(output, sizeof(output), brightness, color.r, color.g, color.b,
+                                       effect.c_str())) {
+            Serial.println("State update too large to publish");
+            unpublishedCount++;
+            return;
+        }
+        session.publish(MQTT_BASE_TOPIC "/state", output, true);
+    }
+
+    // State updates that did not fit MQTT_QUEUE_PAYLOAD
+    uint32_t unpublished() const {
+        return unpublishedCount;
+    }
+};
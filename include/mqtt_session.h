@@ -0,0 +1,231 @@
+#pragma once
+#include <Arduino.h>
+#include <AsyncMqttClient.h>
+#include "config.h"
+
+// Keeps the broker session up: reconnects with backoff whenever the network
+// is up, announces availability through a retained topic backed by the Last
+// Will, and hands the app a callback to resubscribe and republish once the
+// session is back.
+//
+// Every outbound publish goes through a small queue of per-topic slots that
+// loop() flushes, so the MQTT client is only driven from one task. While the
+// broker is away, a newer payload for a topic replaces the queued one and
+// only the latest value goes out on reconnect.
+class MQTTSession {
+private:
+    enum State { WAITING, CONNECTING, READY };
+
+    struct Pending {
+        const char* topic;   // Must outlive the session (string literals)
+        bool retain;
+        uint32_t sequence;   // 0 marks a free slot
+        char payload[MQTT_QUEUE_PAYLOAD];
+    };
+
+    AsyncMqttClient& client;
+    void (*readyCallback)() = nullptr;
+
+    State state = WAITING;
+    volatile bool linkUp = false;
+    volatile uint32_t linkDrops = 0;   // Disconnects, counted on the network task
+    uint32_t seenDrops = 0;
+
+    uint8_t attempt = 0;
+    uint32_t attemptStart = 0;
+    uint32_t nextAttempt = 0;
+    uint32_t outageStart = 0;
+    bool inOutage = false;
+
+    uint32_t reconnects = 0;
+    uint32_t lastReconnectMs = 0;   // Session lost to resubscribed, for the last outage
+
+    static const uint32_t RESTART_SETTLE_MS = 50;   // Lets the old connection's disconnect event arrive
+    bool reconfiguring = false;
+    uint32_t reconfigureStart = 0;
+    uint32_t lastReconfigureMs = 0;   // restart() to resubscribed, for the last change
+
+    Pending queue[MQTT_QUEUE_SLOTS];
+    uint32_t nextSequence = 1;
+    uint32_t dropped = 0;   // Topics evicted because the queue was full
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    uint32_t backoff() const {
+        uint32_t step = MQTT_RETRY_MIN_MS << min<uint8_t>(attempt, 16);
+        if (step > MQTT_RETRY_MAX_MS) step = MQTT_RETRY_MAX_MS;
+        return step / 2 + random(step / 2 + 1);
+    }
+
+    void connect(uint32_t now) {
+        seenDrops = linkDrops;
+        client.connect();
+        state = CONNECTING;
+        attemptStart = now;
+    }
+
+    // Send queued payloads oldest first; stops at the first one the client refuses
+    void flush() {
+        char payload[MQTT_QUEUE_PAYLOAD];
+        while (true) {
+            const char* topic = nullptr;
+            bool retain = false;
+            uint32_t sequence = 0;
+
+            portENTER_CRITICAL(&lock);
+            int oldest = -1;
+            for (int i = 0; i < MQTT_QUEUE_SLOTS; i++) {
+                if (queue[i].sequence != 0 && (oldest < 0 || queue[i].sequence < queue[oldest].sequence)) {
+                    oldest = i;
+                }
+            }
+            if (oldest >= 0) {
+                topic = queue[oldest].topic;
+                retain = queue[oldest].retain;
+                sequence = queue[oldest].sequence;
+                memcpy(payload, queue[oldest].payload, sizeof(payload));
+            }
+            portEXIT_CRITICAL(&lock);
+
+            if (oldest < 0) return;
+            if (client.publish(topic, 0, retain, payload) == 0) return;   // Client buffer full, retry next frame
+
+            // Free the slot unless a newer value replaced it meanwhile
+            portENTER_CRITICAL(&lock);
+            if (queue[oldest].sequence == sequence) queue[oldest].sequence = 0;
+            portEXIT_CRITICAL(&lock);
+        }
+    }
+
+public:
+    MQTTSession(AsyncMqttClient& client) : client(client) {
+        for (int i = 0; i < MQTT_QUEUE_SLOTS; i++) {
+            queue[i].sequence = 0;
+        }
+    }
+
+    // Register the Last Will; call before the first connect
+    void begin(void (*onReady)()) {
+        readyCallback = onReady;
+        client.setKeepAlive(MQTT_KEEPALIVE_S);
+        client.setWill(MQTT_AVAILABILITY_TOPIC, 1, true, "offline");
+    }
+
+    // Called from the client's callbacks on the network task
+    void onConnected() {
+        linkUp = true;
+    }
+
+    void onDisconnected() {
+        linkUp = false;
+        linkDrops = linkDrops + 1;
+    }
+
+    // Queue a payload for a topic, replacing any unsent one; false if it does not fit
+    bool publish(const char* topic, const char* payload, bool retain) {
+        size_t length = strlen(payload);
+        if (length >= MQTT_QUEUE_PAYLOAD) return false;
+
+        portENTER_CRITICAL(&lock);
+        int slot = -1;
+        for (int i = 0; i < MQTT_QUEUE_SLOTS && slot < 0; i++) {
+            if (queue[i].sequence != 0 && strcmp(queue[i].topic, topic) == 0) slot = i;
+        }
+        for (int i = 0; i < MQTT_QUEUE_SLOTS && slot < 0; i++) {
+            if (queue[i].sequence == 0) slot = i;
+        }
+        if (slot < 0) {
+            // Full: the oldest topic loses its update
+            slot = 0;
+            for (int i = 1; i < MQTT_QUEUE_SLOTS; i++) {
+                if (queue[i].sequence < queue[slot].sequence) slot = i;
+            }
+            dropped++;
+        }
+        queue[slot].topic = topic;
+        queue[slot].retain = retain;
+        queue[slot].sequence = nextSequence++;
+        memcpy(queue[slot].payload, payload, length + 1);
+        portEXIT_CRITICAL(&lock);
+        return true;
+    }
+
+    // Drop the session so it reconnects with new server or credentials, set on the
+    // client after this call. Queued payloads are kept for the new broker.
+    void restart(uint32_t now) {
+        if (client.connected() || state == CONNECTING) {
+            client.disconnect(true);
+        }
+        linkUp = false;
+        reconfiguring = true;
+        reconfigureStart = now;
+        inOutage = false;
+        attempt = 0;
+        state = WAITING;
+        nextAttempt = now + RESTART_SETTLE_MS;
+    }
+
+    // Drive reconnects and flush the queue; networkUp gates connection attempts
+    void update(uint32_t now, bool networkUp) {
+        bool droppedLink = linkDrops != seenDrops;
+        seenDrops = linkDrops;
+
+        if (state == READY && !linkUp) {
+            Serial.println("MQTT session lost, reconnecting");
+            inOutage = true;
+            outageStart = now;
+            attempt = 0;
+            state = WAITING;
+            nextAttempt = now;
+        }
+
+        if (state == CONNECTING) {
+            if (linkUp) {
+                state = READY;
+                client.publish(MQTT_AVAILABILITY_TOPIC, 1, true, "online");
+                if (readyCallback) readyCallback();
+                if (reconfiguring) {
+                    lastReconfigureMs = now - reconfigureStart;
+                    Serial.printf("MQTT reconfigured, back after %lu ms\n", (unsigned long)lastReconfigureMs);
+                } else if (inOutage) {
+                    lastReconnectMs = now - outageStart;
+                    reconnects++;
+                    Serial.printf("MQTT back after %lu ms, %u attempts\n", (unsigned long)lastReconnectMs, attempt + 1);
+                }
+                reconfiguring = false;
+                inOutage = false;
+                attempt = 0;
+            } else if (droppedLink || now - attemptStart >= MQTT_CONNECT_TIMEOUT_MS) {
+                client.disconnect(true);
+                attempt++;
+                state = WAITING;
+                nextAttempt = now + backoff();
+            }
+        }
+
+        if (state == WAITING && networkUp && (int32_t)(now - nextAttempt) >= 0) {
+            connect(now);
+        }
+
+        if (state == READY) flush();
+    }
+
+    bool connected() const {
+        return state == READY;
+    }
+
+    uint32_t reconnectCount() const {
+        return reconnects;
+    }
+
+    uint32_t lastReconnectLatency() const {
+        return lastReconnectMs;
+    }
+
+    uint32_t lastReconfigureDowntime() const {
+        return lastReconfigureMs;
+    }
+
+    uint32_t droppedUpdates() const {
+        return dropped;
+    }
+};
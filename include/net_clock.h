@@ -0,0 +1,117 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <esp_timer.h>
+#include "config.h"
+#include "sync_protocol.h"
+
+// Network clock shared by every controller on the LAN (see sync_protocol.h).
+// Packets go over UDP multicast on SYNC_GROUP; the group is joined whenever
+// the station link is up and left when it drops. Until a leader is heard,
+// or with SYNC_ENABLED 0, the network clock is just the local one.
+//
+// Effects read NetClock::millis() for their phase and random seeds instead
+// of counting their own frames, so every planter shows the same frame.
+class NetClock {
+private:
+    WiFiUDP udp;
+    SyncProtocol protocol;
+    bool joined = false;
+
+    static int64_t& sharedOffset() {
+        static int64_t offset = 0;   // Network minus local time, read by millis()
+        return offset;
+    }
+
+    static uint32_t nodeId() {
+        // Low bytes of the MAC are unique per board; 0 is reserved for "no leader"
+        uint32_t id = (uint32_t)(ESP.getEfuseMac() >> 16);
+        return id ? id : 1;
+    }
+
+    void send(const SyncProtocol::Packet& packet) {
+        udp.beginMulticastPacket();
+        udp.write((const uint8_t*)&packet, sizeof(packet));
+        udp.endPacket();
+    }
+
+public:
+    NetClock() : protocol(nodeId()) {
+    }
+
+    // Call from loop(); handles the link coming and going
+    void update(bool networkUp) {
+#if SYNC_ENABLED
+        if (networkUp != joined) {
+            if (networkUp) {
+                udp.beginMulticast(IPAddress(SYNC_GROUP), SYNC_PORT);
+                protocol.begin(esp_timer_get_time());
+                Serial.printf("Clock sync joined as node %08x\n", protocol.node());
+            } else {
+                udp.stop();
+            }
+            joined = networkUp;
+        }
+        if (!joined) return;
+
+        SyncProtocol::Packet packet, reply;
+        while (udp.parsePacket() > 0) {
+            if (udp.read((uint8_t*)&packet, sizeof(packet)) != (int)sizeof(packet)) continue;
+            if (protocol.receive(packet, esp_timer_get_time(), reply)) {
+                send(reply);
+            }
+        }
+        if (protocol.poll(esp_timer_get_time(), packet)) {
+            send(packet);
+        }
+        sharedOffset() = protocol.offsetUs();
+#endif
+    }
+
+    static int64_t micros() {
+        return esp_timer_get_time() + sharedOffset();
+    }
+
+    // Network time in milliseconds, for effect phase and seeds
+    static uint32_t millis() {
+        return (uint32_t)(micros() / 1000);
+    }
+
+    // Microseconds until the next multiple of period after the one a frame
+    // started on (network time), so nodes present frames together. 0 once it
+    // has passed: a frame that ran long is followed at once, not a whole
+    // period later. Starting within a tick before a boundary counts as on it.
+    static uint32_t untilNextBoundary(int64_t frameStartUs, uint32_t periodMs) {
+        int64_t period = (int64_t)periodMs * 1000;
+        int64_t from = frameStartUs + 1000;
+        int64_t phase = from % period;
+        if (phase < 0) phase += period;
+        int64_t wait = from - phase + period - micros();
+        return wait > 0 ? (uint32_t)wait : 0;
+    }
+
+    bool synced() const {
+        return joined && protocol.isSynced();
+    }
+
+    bool isLeader() const {
+        return protocol.isLeader();
+    }
+
+    uint32_t node() const {
+        return protocol.node();
+    }
+
+    uint32_t leader() const {
+        return protocol.leader();
+    }
+
+    int32_t offsetMs() const {
+        return (int32_t)(protocol.offsetUs() / 1000);
+    }
+
+    uint32_t roundTripUs() const {
+        return (uint32_t)protocol.roundTripUs();
+    }
+};
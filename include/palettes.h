@@ -0,0 +1,132 @@
+#pragma once
+#include <FastLED.h>
+#include "config.h"
+
+// Color palettes for the effects, defined as gradient stops and expanded into
+// 256-entry tables the first time they are used, so an effect maps a level or
+// phase to a color with a single indexed load per pixel.
+//
+// An effect selects a palette with a suffix on its name, "water:ocean";
+// without one it uses the current color. Expanded tables are kept in a small
+// LRU cache shared by every Effects instance, enough for the main effect, the
+// one fading out during a transition and a couple of scene layers.
+class Palettes {
+public:
+    struct Stop {
+        uint8_t index;   // 0 for the first stop, 255 for the last
+        uint8_t r, g, b;
+    };
+
+    struct Info {
+        const char* name;
+        const Stop* stops;
+        uint8_t count;
+    };
+
+private:
+    struct Slot {
+        uint8_t id;       // 0 while empty
+        uint32_t used;    // Cache clock of the last lookup
+        CRGB table[256];
+    };
+
+    struct Cache {
+        Slot slots[PALETTE_CACHE_SLOTS];
+        uint32_t clock;
+        uint32_t expansions;
+    };
+
+    static Cache& cache() {
+        static Cache c;
+        return c;
+    }
+
+public:
+    static const Info* registry(int& count) {
+        // Deep water through teal to white caustics at the crests
+        static const Stop ocean[] = {
+            { 0, 0, 4, 24 }, { 90, 0, 24, 96 }, { 150, 0, 110, 130 }, { 215, 90, 210, 200 }, { 255, 255, 255, 255 },
+        };
+        static const Stop lava[] = {
+            { 0, 0, 0, 0 }, { 90, 140, 0, 0 }, { 170, 255, 60, 0 }, { 230, 255, 170, 20 }, { 255, 255, 240, 160 },
+        };
+        static const Stop forest[] = {
+            { 0, 0, 20, 0 }, { 100, 10, 90, 10 }, { 180, 80, 150, 20 }, { 255, 200, 220, 90 },
+        };
+        static const Stop sunset[] = {
+            { 0, 40, 0, 60 }, { 80, 160, 0, 80 }, { 160, 255, 60, 20 }, { 220, 255, 150, 0 }, { 255, 255, 220, 120 },
+        };
+        static const Info table[] = {
+            { "ocean",  ocean,  sizeof(ocean) / sizeof(Stop) },
+            { "lava",   lava,   sizeof(lava) / sizeof(Stop) },
+            { "forest", forest, sizeof(forest) / sizeof(Stop) },
+            { "sunset", sunset, sizeof(sunset) / sizeof(Stop) },
+        };
+        count = sizeof(table) / sizeof(table[0]);
+        return table;
+    }
+
+    // Palette id for a name, 1-based; 0 if there is none by that name
+    static uint8_t find(const char* name) {
+        int count;
+        const Info* table = registry(count);
+        for (int i = 0; i < count; i++) {
+            if (strcmp(table[i].name, name) == 0) return i + 1;
+        }
+        return 0;
+    }
+
+    // Palette named by an effect's suffix ("water:ocean"), or 0
+    static uint8_t fromEffect(const char* effect) {
+        const char* colon = strchr(effect, ':');
+        return colon ? find(colon + 1) : 0;
+    }
+
+    static const char* name(uint8_t id) {
+        int count;
+        const Info* table = registry(count);
+        return id >= 1 && id <= count ? table[id - 1].name : nullptr;
+    }
+
+    // Interpolate the stops linearly into a 256-entry table
+    static void expand(const Info& palette, CRGB* table) {
+        for (int s = 0; s + 1 < palette.count; s++) {
+            const Stop& a = palette.stops[s];
+            const Stop& b = palette.stops[s + 1];
+            int span = b.index - a.index;
+            for (int i = a.index; i <= b.index; i++) {
+                int t = span ? (i - a.index) * 255 / span : 0;
+                table[i] = CRGB(a.r + (b.r - a.r) * t / 255, a.g + (b.g - a.g) * t / 255, a.b + (b.b - a.b) * t / 255);
+            }
+        }
+    }
+
+    // Expanded table for a palette id, from the cache or built now; null for id 0
+    static const CRGB* table(uint8_t id) {
+        int count;
+        const Info* palettes = registry(count);
+        if (id == 0 || id > count) return nullptr;
+
+        Cache& c = cache();
+        c.clock++;
+        Slot* victim = &c.slots[0];
+        for (int i = 0; i < PALETTE_CACHE_SLOTS; i++) {
+            Slot& slot = c.slots[i];
+            if (slot.id == id) {
+                slot.used = c.clock;
+                return slot.table;
+            }
+            if (slot.id == 0 || (victim->id != 0 && slot.used < victim->used)) victim = &slot;
+        }
+        expand(palettes[id - 1], victim->table);
+        victim->id = id;
+        victim->used = c.clock;
+        c.expansions++;
+        return victim->table;
+    }
+
+    // Tables built since boot; stays low unless effects keep switching between many palettes
+    static uint32_t expansions() {
+        return cache().expansions;
+    }
+};
@@ -0,0 +1,345 @@
+#pragma once
+#include <FastLED.h>
+
+#if defined(PIXEL_KERNELS_SCALAR)
+// Forced byte-at-a-time build, used to compare against the packed paths
+#elif defined(PIXEL_KERNELS_SWAR)
+// Forced 32-bit word build, to test the ESP32 path on the host
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PIXEL_KERNELS_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIXEL_KERNELS_NEON
+#elif defined(ESP32)
+#define PIXEL_KERNELS_SWAR
+#endif
+
+// Whole-buffer pixel operations. A CRGB buffer is just a packed byte stream,
+// so each kernel works on raw bytes using the widest path the target has:
+// SSE2 or NEON on host builds, 32-bit SWAR words on the ESP32 and plain
+// bytes otherwise. Results match FastLED's scale8 / qadd8 / nblend per-pixel
+// methods exactly; tools/kernel_check.cpp checks every path against them.
+class PixelKernels {
+private:
+    static_assert(sizeof(CRGB) == 3, "CRGB must be packed RGB bytes");
+
+    static uint8_t scaleByte(uint8_t value, uint8_t scale) {
+        return ((uint16_t)value * (1 + scale)) >> 8;
+    }
+
+    // nblend() rounding: scale8(from, 255 - amount) + scale8(to, amount), never above 255
+    static uint8_t blendByte(uint8_t from, uint8_t to, uint8_t amount) {
+        return (((uint16_t)from * (256 - amount)) >> 8) + (((uint16_t)to * (amount + 1)) >> 8);
+    }
+
+#ifdef PIXEL_KERNELS_SWAR
+    // Two bytes per 16-bit lane; every product stays below 0x10000 so lanes never carry
+    static uint32_t scaleWord(uint32_t w, uint32_t scale1) {
+        uint32_t lo = (((w & 0x00FF00FF) * scale1) >> 8) & 0x00FF00FF;
+        uint32_t hi = (((w >> 8) & 0x00FF00FF) * scale1) & 0xFF00FF00;
+        return lo | hi;
+    }
+
+    static uint32_t addWord(uint32_t a, uint32_t b) {
+        uint32_t low7 = (a & 0x7F7F7F7F) + (b & 0x7F7F7F7F);
+        uint32_t carry = ((a & b) | ((a | b) & low7)) & 0x80808080;
+        uint32_t sum = low7 ^ ((a ^ b) & 0x80808080);
+        return sum | ((carry >> 7) * 0xFF);
+    }
+
+    // Both halves are scaled separately, as nblend() does; their sum stays within a byte
+    static uint32_t blendWord(uint32_t from, uint32_t to, uint32_t amount) {
+        return scaleWord(from, 256 - amount) + scaleWord(to, amount + 1);
+    }
+
+    static size_t misalignment(const void* p) {
+        return (4 - ((uintptr_t)p & 3)) & 3;
+    }
+
+    // Only called on 4-byte aligned addresses, so these compile to plain l32i/s32i
+    static uint32_t load32(const uint8_t* p) {
+        uint32_t w;
+        memcpy(&w, __builtin_assume_aligned(p, 4), 4);
+        return w;
+    }
+
+    static void store32(uint8_t* p, uint32_t w) {
+        memcpy(__builtin_assume_aligned(p, 4), &w, 4);
+    }
+#endif
+
+    static void scaleBytes(uint8_t* p, size_t len, uint8_t scale) {
+        size_t i = 0;
+#if defined(PIXEL_KERNELS_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i mul = _mm_set1_epi16(scale + 1);
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+            __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul), 8);
+            __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul), 8);
+            _mm_storeu_si128((__m128i*)(p + i), _mm_packus_epi16(lo, hi));
+        }
+#elif defined(PIXEL_KERNELS_NEON)
+        const uint8x8_t mul = vdup_n_u8(scale);
+        for (; i + 16 <= len; i += 16) {
+            uint8x16_t v = vld1q_u8(p + i);
+            uint16x8_t lo = vmlal_u8(vmovl_u8(vget_low_u8(v)), vget_low_u8(v), mul);
+            uint16x8_t hi = vmlal_u8(vmovl_u8(vget_high_u8(v)), vget_high_u8(v), mul);
+            vst1q_u8(p + i, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+        }
+#elif defined(PIXEL_KERNELS_SWAR)
+        for (size_t head = misalignment(p); i < head && i < len; i++) {
+            p[i] = scaleByte(p[i], scale);
+        }
+        const uint32_t scale1 = scale + 1;
+        for (; i + 4 <= len; i += 4) {
+            store32(p + i, scaleWord(load32(p + i), scale1));
+        }
+#endif
+        for (; i < len; i++) {
+            p[i] = scaleByte(p[i], scale);
+        }
+    }
+
+    static void addBytes(uint8_t* dst, const uint8_t* src, size_t len) {
+        size_t i = 0;
+#if defined(PIXEL_KERNELS_SSE2)
+        for (; i + 16 <= len; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epu8(a, b));
+        }
+#elif defined(PIXEL_KERNELS_NEON)
+        for (; i + 16 <= len; i += 16) {
+            vst1q_u8(dst + i, vqaddq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+        }
+#elif defined(PIXEL_KERNELS_SWAR)
+        if (misalignment(dst) == misalignment(src)) {
+            for (size_t head = misalignment(dst); i < head && i < len; i++) {
+                dst[i] = qadd8(dst[i], src[i]);
+            }
+            for (; i + 4 <= len; i += 4) {
+                store32(dst + i, addWord(load32(dst + i), load32(src + i)));
+            }
+        }
+#endif
+        for (; i < len; i++) {
+            dst[i] = qadd8(dst[i], src[i]);
+        }
+    }
+
+    static void blendBytes(uint8_t* dst, const uint8_t* src, size_t len, uint8_t amount) {
+        size_t i = 0;
+#if defined(PIXEL_KERNELS_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i keep = _mm_set1_epi16(256 - amount);
+        const __m128i take = _mm_set1_epi16(amount + 1);
+        for (; i + 16 <= len; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i lo = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), keep), 8),
+                                       _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), take), 8));
+            __m128i hi = _mm_add_epi16(_mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), keep), 8),
+                                       _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), take), 8));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+        }
+#elif defined(PIXEL_KERNELS_NEON)
+        // amount is 1-254 here, so both factors fit in a byte
+        const uint8x8_t keep = vdup_n_u8(256 - amount);
+        const uint8x8_t take = vdup_n_u8(amount + 1);
+        for (; i + 16 <= len; i += 16) {
+            uint8x16_t a = vld1q_u8(dst + i);
+            uint8x16_t b = vld1q_u8(src + i);
+            uint8x8_t lo = vadd_u8(vshrn_n_u16(vmull_u8(vget_low_u8(a), keep), 8),
+                                   vshrn_n_u16(vmull_u8(vget_low_u8(b), take), 8));
+            uint8x8_t hi = vadd_u8(vshrn_n_u16(vmull_u8(vget_high_u8(a), keep), 8),
+                                   vshrn_n_u16(vmull_u8(vget_high_u8(b), take), 8));
+            vst1q_u8(dst + i, vcombine_u8(lo, hi));
+        }
+#elif defined(PIXEL_KERNELS_SWAR)
+        if (misalignment(dst) == misalignment(src)) {
+            for (size_t head = misalignment(dst); i < head && i < len; i++) {
+                dst[i] = blendByte(dst[i], src[i], amount);
+            }
+            for (; i + 4 <= len; i += 4) {
+                store32(dst + i, blendWord(load32(dst + i), load32(src + i), amount));
+            }
+        }
+#endif
+        for (; i < len; i++) {
+            dst[i] = blendByte(dst[i], src[i], amount);
+        }
+    }
+
+    static uint32_t sumBytes(const uint8_t* p, size_t len) {
+        uint32_t total = 0;
+        size_t i = 0;
+#if defined(PIXEL_KERNELS_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        for (; i + 16 <= len; i += 16) {
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(p + i)), zero));
+        }
+        total = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(PIXEL_KERNELS_NEON)
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (; i + 16 <= len; i += 16) {
+            acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(p + i)));
+        }
+        total = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#elif defined(PIXEL_KERNELS_SWAR)
+        for (size_t head = misalignment(p); i < head && i < len; i++) {
+            total += p[i];
+        }
+        // Byte pairs summed into 16-bit lanes, flushed before they can overflow
+        while (i + 4 <= len) {
+            uint32_t lanes = 0;
+            for (int words = 0; words < 128 && i + 4 <= len; words++, i += 4) {
+                uint32_t w = load32(p + i);
+                lanes += (w & 0x00FF00FF) + ((w >> 8) & 0x00FF00FF);
+            }
+            total += (lanes & 0xFFFF) + (lanes >> 16);
+        }
+#endif
+        for (; i < len; i++) {
+            total += p[i];
+        }
+        return total;
+    }
+
+    // dst = (src * scale1 + error) >> 8, keeping the low byte in error for the
+    // next frame. scale1 is 1-256, so every sum fits 16 bits.
+    static void ditherBytes(uint8_t* dst, const uint8_t* src, uint8_t* error, size_t len, uint16_t scale1) {
+        size_t i = 0;
+#if defined(PIXEL_KERNELS_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i factor = _mm_set1_epi16(scale1);
+        const __m128i low = _mm_set1_epi16(0xFF);
+        for (; i + 16 <= len; i += 16) {
+            __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i e = _mm_loadu_si128((const __m128i*)(error + i));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), factor), _mm_unpacklo_epi8(e, zero));
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), factor), _mm_unpackhi_epi8(e, zero));
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+            _mm_storeu_si128((__m128i*)(error + i), _mm_packus_epi16(_mm_and_si128(lo, low), _mm_and_si128(hi, low)));
+        }
+#elif defined(PIXEL_KERNELS_NEON)
+        for (; i + 8 <= len; i += 8) {
+            uint16x8_t acc = vaddw_u8(vmulq_n_u16(vmovl_u8(vld1_u8(src + i)), scale1), vld1_u8(error + i));
+            vst1_u8(dst + i, vshrn_n_u16(acc, 8));
+            vst1_u8(error + i, vmovn_u16(acc));
+        }
+#elif defined(PIXEL_KERNELS_SWAR)
+        if (misalignment(dst) == misalignment(src) && misalignment(dst) == misalignment(error)) {
+            for (size_t head = misalignment(dst); i < head && i < len; i++) {
+                uint16_t acc = src[i] * scale1 + error[i];
+                dst[i] = acc >> 8;
+                error[i] = acc;
+            }
+            for (; i + 4 <= len; i += 4) {
+                uint32_t s = load32(src + i);
+                uint32_t e = load32(error + i);
+                uint32_t even = (s & 0x00FF00FF) * scale1 + (e & 0x00FF00FF);
+                uint32_t odd = ((s >> 8) & 0x00FF00FF) * scale1 + ((e >> 8) & 0x00FF00FF);
+                store32(dst + i, ((even >> 8) & 0x00FF00FF) | (odd & 0xFF00FF00));
+                store32(error + i, (even & 0x00FF00FF) | ((odd & 0x00FF00FF) << 8));
+            }
+        }
+#endif
+        for (; i < len; i++) {
+            uint16_t acc = src[i] * scale1 + error[i];
+            dst[i] = acc >> 8;
+            error[i] = acc;
+        }
+    }
+
+public:
+    static const char* backend() {
+#if defined(PIXEL_KERNELS_SSE2)
+        return "sse2";
+#elif defined(PIXEL_KERNELS_NEON)
+        return "neon";
+#elif defined(PIXEL_KERNELS_SWAR)
+        return "swar32";
+#else
+        return "scalar";
+#endif
+    }
+
+    // Set every pixel to one color. The buffer is seeded with one pixel and
+    // then doubled with memcpy, which is already word/vector wide everywhere.
+    static void fill(CRGB* dst, int count, const CRGB& color) {
+        if (count <= 0) return;
+        dst[0] = color;
+        int filled = 1;
+        while (filled < count) {
+            int chunk = filled < count - filled ? filled : count - filled;
+            memcpy(dst + filled, dst, chunk * sizeof(CRGB));
+            filled += chunk;
+        }
+    }
+
+    // Same as nscale8() on every pixel
+    static void scale(CRGB* dst, int count, uint8_t scale) {
+        if (scale == 255) return;
+        scaleBytes((uint8_t*)dst, count * sizeof(CRGB), scale);
+    }
+
+    // Same as fadeToBlackBy() on every pixel
+    static void fade(CRGB* dst, int count, uint8_t amount) {
+        if (amount == 0) return;
+        scaleBytes((uint8_t*)dst, count * sizeof(CRGB), 255 - amount);
+    }
+
+    // Saturating dst += src
+    static void add(CRGB* dst, const CRGB* src, int count) {
+        addBytes((uint8_t*)dst, (const uint8_t*)src, count * sizeof(CRGB));
+    }
+
+    // Saturating dst += color on every pixel
+    static void add(CRGB* dst, int count, const CRGB& color) {
+        if (!color) return;
+        // 16 pixels is a whole number of bytes, words and vectors
+        CRGB pattern[16];
+        fill(pattern, 16, color);
+        for (int i = 0; i < count; i += 16) {
+            int chunk = count - i < 16 ? count - i : 16;
+            addBytes((uint8_t*)(dst + i), (const uint8_t*)pattern, chunk * sizeof(CRGB));
+        }
+    }
+
+    // Same as nblend(dst[i], src[i], amount): 0 keeps dst, 255 copies src exactly
+    static void blend(CRGB* dst, const CRGB* src, int count, uint8_t amount) {
+        if (amount == 0) return;
+        if (amount == 255) {
+            memmove(dst, src, count * sizeof(CRGB));
+            return;
+        }
+        blendBytes((uint8_t*)dst, (const uint8_t*)src, count * sizeof(CRGB), amount);
+    }
+
+    // Sum of every channel of every pixel
+    static uint32_t sum(const CRGB* src, int count) {
+        return sumBytes((const uint8_t*)src, count * sizeof(CRGB));
+    }
+
+    // dst = src scaled by scale/255 at 16-bit precision, quantized with temporal
+    // dithering: the fraction each channel loses is carried in error (one byte
+    // per channel) and added back next frame, so levels between two 8-bit
+    // steps show as their average over a few frames
+    static void scaleDither(CRGB* dst, const CRGB* src, uint8_t* error, int count, uint8_t scale) {
+        if (scale == 0) {
+            fill(dst, count, CRGB::Black);   // Off stays off, not a dithered glow
+            return;
+        }
+        ditherBytes((uint8_t*)dst, (const uint8_t*)src, error, count * sizeof(CRGB), scale + 1);
+    }
+
+    // dst[i] = table[(index[i] + offset) & 255], for precomputed color ramps
+    static void lookup(CRGB* dst, int count, const CRGB* table, const uint8_t* index, uint8_t offset) {
+        for (int i = 0; i < count; i++) {
+            dst[i] = table[(uint8_t)(index[i] + offset)];
+        }
+    }
+};
@@ -0,0 +1,160 @@
+#pragma once
+#include <Arduino.h>
+#include "config.h"
+
+// Physical layout of the strip around the planter. Everything here is
+// computed once in begin() so effects only do table lookups per frame.
+class PlanterLayout {
+private:
+    int numLeds = 0;
+    int numGroups = 0;
+    uint32_t perimeter = 0;   // mm
+
+    uint16_t* ledX = nullptr;        // mm along the long side
+    uint16_t* ledY = nullptr;        // mm across the short side
+    uint8_t* ledPhase = nullptr;     // position along the long side scaled to 0-255
+    uint16_t* groupDist = nullptr;   // lower triangle of group-to-group distances
+
+    // Walk the perimeter from the start corner and return the (x, y) position
+    void positionAt(uint32_t pos, uint16_t& x, uint16_t& y) {
+        const uint32_t length = PLANTER_LENGTH_MM;
+        const uint32_t width = PLANTER_WIDTH_MM;
+        pos %= perimeter;
+
+        if (pos < length) {                      // First long side
+            x = pos;
+            y = 0;
+        } else if (pos < length + width) {       // Far short end
+            x = length;
+            y = pos - length;
+        } else if (pos < 2 * length + width) {   // Second long side
+            x = length - (pos - length - width);
+            y = width;
+        } else {                                 // Near short end
+            x = 0;
+            y = width - (pos - 2 * length - width);
+        }
+    }
+
+    static uint32_t isqrt32(uint32_t value) {
+        uint32_t result = 0;
+        uint32_t bit = 1UL << 30;
+        while (bit > value) bit >>= 2;
+        while (bit) {
+            if (value >= result + bit) {
+                value -= result + bit;
+                result = (result >> 1) + bit;
+            } else {
+                result >>= 1;
+            }
+            bit >>= 2;
+        }
+        return result;
+    }
+
+    static int triangleIndex(int a, int b) {
+        if (a < b) {
+            int t = a;
+            a = b;
+            b = t;
+        }
+        return a * (a + 1) / 2 + b;
+    }
+
+public:
+    // Distances are stored in 1/16ths of the LED pitch so effects can keep
+    // working in "LEDs" regardless of strip length.
+    static const uint8_t DISTANCE_SHIFT = 4;
+
+    ~PlanterLayout() {
+        delete[] ledX;
+        delete[] ledY;
+        delete[] ledPhase;
+        delete[] groupDist;
+    }
+
+    void begin(int leds) {
+        numLeds = leds;
+        numGroups = (numLeds + LED_GROUP_SIZE - 1) / LED_GROUP_SIZE;
+        perimeter = 2UL * (PLANTER_LENGTH_MM + PLANTER_WIDTH_MM);
+
+        ledX = new uint16_t[numLeds];
+        ledY = new uint16_t[numLeds];
+        ledPhase = new uint8_t[numLeds];
+        groupDist = new uint16_t[numGroups * (numGroups + 1) / 2];
+
+        // LEDs are evenly spaced; sample each one at the middle of its pitch
+        for (int i = 0; i < numLeds; i++) {
+            uint32_t pos = PLANTER_START_OFFSET_MM + ((2UL * i + 1) * perimeter) / (2UL * numLeds);
+            positionAt(pos, ledX[i], ledY[i]);
+            ledPhase[i] = (uint32_t)ledX[i] * 255 / PLANTER_LENGTH_MM;
+        }
+
+        // Straight-line distance across the water between group centres. The
+        // planter is convex, so this is the path a ripple actually travels,
+        // including across the short ends and around the corners.
+        for (int a = 0; a < numGroups; a++) {
+            int ledA = groupCenter(a);
+            for (int b = 0; b <= a; b++) {
+                int ledB = groupCenter(b);
+                int32_t dx = (int32_t)ledX[ledA] - ledX[ledB];
+                int32_t dy = (int32_t)ledY[ledA] - ledY[ledB];
+                uint32_t mm = isqrt32(dx * dx + dy * dy);
+                uint32_t dist = (mm * numLeds << DISTANCE_SHIFT) / perimeter;
+                groupDist[triangleIndex(a, b)] = dist > 0xFFFF ? 0xFFFF : dist;
+            }
+        }
+
+        Serial.printf("Planter layout: %d LEDs, %d groups, %lu mm perimeter\n",
+                      numLeds, numGroups, perimeter);
+    }
+
+    int getNumLeds() const {
+        return numLeds;
+    }
+
+    int getNumGroups() const {
+        return numGroups;
+    }
+
+    int groupCenter(int group) const {
+        int led = group * LED_GROUP_SIZE + (LED_GROUP_SIZE / 2);
+        return led < numLeds ? led : numLeds - 1;
+    }
+
+    uint16_t x(int led) const {
+        return ledX[led];
+    }
+
+    uint16_t y(int led) const {
+        return ledY[led];
+    }
+
+    // Which side of the planter an LED is on: 0 and 2 are the long sides,
+    // 1 and 3 the short ends
+    uint8_t side(int led) const {
+        if (ledY[led] == 0 && ledX[led] < PLANTER_LENGTH_MM) return 0;
+        if (ledX[led] == PLANTER_LENGTH_MM && ledY[led] < PLANTER_WIDTH_MM) return 1;
+        if (ledY[led] == PLANTER_WIDTH_MM && ledX[led] > 0) return 2;
+        return 3;
+    }
+
+    bool onLongSide(int led) const {
+        return (side(led) & 1) == 0;
+    }
+
+    // Phase of a wave travelling along the length of the planter
+    uint8_t phase(int led) const {
+        return ledPhase[led];
+    }
+
+    // Whole phase table, for kernels that index by it directly
+    const uint8_t* phases() const {
+        return ledPhase;
+    }
+
+    // Distance between two group centres in 1/16ths of the LED pitch
+    uint16_t groupDistance(int a, int b) const {
+        return groupDist[triangleIndex(a, b)];
+    }
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <FastLED.h>
+#include "config.h"
+#include "pixel_kernels.h"
+
+// Estimated current draw of the strip, kept as a running sum of channel
+// intensities. The strip is split into fixed chunks with a cached sum each;
+// after a frame only the chunks inside the changed range are summed again,
+// so a static frame costs nothing and a full frame is one sum kernel pass.
+class PowerModel {
+public:
+    static const int CHUNK_LEDS = 16;
+
+private:
+    const CRGB* leds;
+    int numLeds;
+    uint32_t* chunkSums = nullptr;
+    int numChunks = 0;
+    uint32_t total = 0;   // Sum of every channel of every LED
+
+    uint8_t requested = 255;
+    uint8_t output = 255;
+
+    uint32_t activeMa(uint8_t scale) const {
+        return (uint64_t)total * POWER_MA_PER_CHANNEL * scale / (255UL * 255UL);
+    }
+
+public:
+    PowerModel(const CRGB* ledArray, int numLeds) : leds(ledArray), numLeds(numLeds) {
+    }
+
+    ~PowerModel() {
+        delete[] chunkSums;
+    }
+
+    void begin() {
+        numChunks = (numLeds + CHUNK_LEDS - 1) / CHUNK_LEDS;
+        chunkSums = new uint32_t[numChunks]();
+        update(0, numLeds);
+    }
+
+    // Account for LEDs [start, end) having changed since the last update
+    void update(int start, int end) {
+        if (start < 0) start = 0;
+        if (end > numLeds) end = numLeds;
+        if (start >= end) return;
+
+        int lastChunk = (end - 1) / CHUNK_LEDS;
+        for (int c = start / CHUNK_LEDS; c <= lastChunk; c++) {
+            int first = c * CHUNK_LEDS;
+            int count = numLeds - first < CHUNK_LEDS ? numLeds - first : CHUNK_LEDS;
+            uint32_t sum = PixelKernels::sum(leds + first, count);
+            total += sum - chunkSums[c];
+            chunkSums[c] = sum;
+        }
+    }
+
+    // Highest brightness, up to the requested one, that keeps the strip in budget
+    uint8_t limit(uint8_t brightness) {
+        requested = brightness;
+        output = brightness;
+        uint32_t idleMa = (uint32_t)numLeds * POWER_IDLE_MA_PER_LED;
+        if (idleMa + activeMa(brightness) > POWER_BUDGET_MA) {
+            uint32_t fullMa = activeMa(255);
+            output = idleMa >= POWER_BUDGET_MA ? 0 : (uint64_t)(POWER_BUDGET_MA - idleMa) * 255 / fullMa;
+        }
+        return output;
+    }
+
+    // Estimated draw at the brightness last returned by limit()
+    uint32_t estimatedMa() const {
+        return (uint32_t)numLeds * POWER_IDLE_MA_PER_LED + activeMa(output);
+    }
+
+    // Draw the current frame would need without limiting
+    uint32_t unlimitedMa() const {
+        return (uint32_t)numLeds * POWER_IDLE_MA_PER_LED + activeMa(requested);
+    }
+
+    uint8_t outputBrightness() const {
+        return output;
+    }
+
+    bool isLimiting() const {
+        return output < requested;
+    }
+
+    uint32_t budgetMa() const {
+        return POWER_BUDGET_MA;
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include <FastLED.h>
+#include "config.h"
+#include "pixel_kernels.h"
+
+// How an effect's output buffer maps onto the physical strip
+enum class Upscale : uint8_t {
+    NONE,      // Rendered at full resolution straight into the strip buffer
+    NEAREST,   // One logical pixel per LED group, copied across the group
+    SMOOTH     // One logical pixel per LED group, interpolated between group centres
+};
+
+// Last stage of every frame: expand the effect output to the strip in a
+// single pass and send it out.
+class Presenter {
+private:
+    CRGB* leds;
+    int numLeds;
+
+    void upscaleNearest(const CRGB* src, int count) {
+        for (int group = 0; group < count; group++) {
+            int groupStart = group * LED_GROUP_SIZE;
+            PixelKernels::fill(leds + groupStart, min(LED_GROUP_SIZE, numLeds - groupStart), src[group]);
+        }
+    }
+
+    // Centre of a group in half-LED units, where LED i's centre is 2i + 1.
+    // Groups hold LED_GROUP_SIZE LEDs except the last, which holds what is left.
+    int32_t groupCentre(int group) const {
+        int start = group * LED_GROUP_SIZE;
+        return 2 * start + min(LED_GROUP_SIZE, numLeds - start);
+    }
+
+    // Logical pixels sit at the centre of their group; LEDs in between are
+    // blended from the two nearest. The strip is a closed loop, so the ends
+    // blend into each other across the real width of the last group.
+    void upscaleSmooth(const CRGB* src, int count) {
+        int last = count - 1;
+        int32_t firstCentre = groupCentre(0);
+        int32_t lastCentre = groupCentre(last);
+        int group = 0;   // Last group whose centre is at or before the LED
+        for (int i = 0; i < numLeds; i++) {
+            int32_t x = 2 * i + 1;
+            int from, to;
+            int32_t a, b;   // Centres of from and to, unwrapped around the loop
+            if (x < firstCentre) {
+                from = last;
+                to = 0;
+                a = lastCentre - 2 * numLeds;
+                b = firstCentre;
+            } else {
+                while (group < last && groupCentre(group + 1) <= x) group++;
+                from = group;
+                a = groupCentre(group);
+                if (group < last) {
+                    to = group + 1;
+                    b = groupCentre(to);
+                } else {
+                    to = 0;
+                    b = firstCentre + 2 * numLeds;
+                }
+            }
+            leds[i] = blend(src[from], src[to], (x - a) * 256 / (b - a));
+        }
+    }
+
+public:
+    Presenter(CRGB* ledArray, int numLeds) : leds(ledArray), numLeds(numLeds) {
+    }
+
+    // Expand group-resolution output into the strip buffer
+    void upscale(const CRGB* src, int count, Upscale mode) {
+        switch (mode) {
+            case Upscale::NEAREST:
+                upscaleNearest(src, count);
+                break;
+            case Upscale::SMOOTH:
+                upscaleSmooth(src, count);
+                break;
+            default:
+                // Full resolution: already in the strip buffer unless it comes from elsewhere
+                if (src != leds) memcpy(leds, src, min(count, numLeds) * sizeof(CRGB));
+                break;
+        }
+    }
+
+    // LEDs covered when a changed range of logical pixels is upscaled. Smooth
+    // upscaling bleeds into the neighbouring groups (and around the loop), so
+    // it takes the whole strip.
+    void stripRange(Upscale mode, int& start, int& end) const {
+        if (start >= end) return;
+        if (mode == Upscale::NEAREST) {
+            start *= LED_GROUP_SIZE;
+            end = min(end * LED_GROUP_SIZE, numLeds);
+        } else if (mode == Upscale::SMOOTH) {
+            start = 0;
+            end = numLeds;
+        }
+    }
+
+    void show() {
+        FastLED.show();
+    }
+
+    void present(const CRGB* src, int count, Upscale mode) {
+        upscale(src, count, mode);
+        show();
+    }
+};
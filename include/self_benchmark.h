@@ -0,0 +1,196 @@
+#pragma once
+#include <Arduino.h>
+#include <FastLED.h>
+#include <algorithm>
+#include "config.h"
+#include "effects.h"
+#include "presenter.h"
+#include "async_output.h"
+#include "power_model.h"
+
+// Benchmark run on the controller itself, started over HTTP, to measure what
+// the host benchmarks cannot: flash cache misses, WiFi interrupts and the
+// real strip driver. Each registered effect renders SELF_BENCH_FRAMES frames
+// without output, then the same number again sent to the strip as fast as
+// the loop can go.
+//
+// The render loop calls step() in place of its own frame while a run is in
+// progress, one frame per call, so the network is still serviced between
+// frames and counts against the frame rate as it does in normal running.
+// Frames draw the whole strip and go through the power limiter, the worst
+// case for every stage. Wire time comes from the output task's totals over
+// the pass, flushed at both ends, so it covers exactly the pass's frames.
+//
+// Results are written by the render loop and read by the web handler, so
+// they are copied in and out under a lock.
+class SelfBenchmark {
+public:
+    enum State : uint8_t { IDLE, RUNNING, DONE };
+
+    struct Result {
+        const char* name;
+        uint32_t renderUs, renderP99Us;   // Effect plus upscale, without output
+        uint32_t showUs, showP99Us;       // output.show(): waiting for the previous frame and handing over this one
+        uint32_t wireUs;                  // Mean send time of the pass's frames in the output task
+        uint32_t frameUs;                 // Mean frame interval with output, unthrottled
+    };
+
+    static const int MAX_EFFECTS = 16;
+
+private:
+    int numLeds;
+    volatile bool requested = false;
+    volatile State state = IDLE;
+    volatile int effectIndex = 0;
+    uint8_t pass = 0;   // 0 render only, 1 with output
+    int frame = 0;
+    uint32_t passStart = 0;
+    uint32_t wireStart = 0;     // Output task totals when the output pass began
+    uint32_t sentStart = 0;
+    uint32_t renderSamples[SELF_BENCH_FRAMES];
+    uint32_t showSamples[SELF_BENCH_FRAMES];
+
+    Result results[MAX_EFFECTS];
+    int numResults = 0;
+    uint32_t cpuMhz = 0;
+    portMUX_TYPE resultsLock = portMUX_INITIALIZER_UNLOCKED;
+
+    static uint32_t mean(const uint32_t* samples) {
+        uint64_t total = 0;
+        for (int i = 0; i < SELF_BENCH_FRAMES; i++) total += samples[i];
+        return total / SELF_BENCH_FRAMES;
+    }
+
+    // Sorts the samples in place
+    static uint32_t p99(uint32_t* samples) {
+        std::sort(samples, samples + SELF_BENCH_FRAMES);
+        return samples[SELF_BENCH_FRAMES * 99 / 100];
+    }
+
+    // Call with the output flushed, so the pass's last frame is counted
+    void finishEffect(const EffectInfo* effect, const AsyncOutput& output) {
+        Result r;
+        r.name = effect->name;
+        r.frameUs = (micros() - passStart) / SELF_BENCH_FRAMES;
+        uint32_t sent = output.sentFrames() - sentStart;
+        r.wireUs = sent ? (output.sentFrameUs() - wireStart) / sent : 0;
+        r.renderUs = mean(renderSamples);
+        r.renderP99Us = p99(renderSamples);
+        r.showUs = mean(showSamples);
+        r.showP99Us = p99(showSamples);
+        portENTER_CRITICAL(&resultsLock);
+        results[numResults++] = r;
+        portEXIT_CRITICAL(&resultsLock);
+        Serial.printf("Benchmark: %-8s render %lu us (p99 %lu), show %lu us (p99 %lu), wire %lu us, %lu fps\n",
+                      r.name, r.renderUs, r.renderP99Us, r.showUs, r.showP99Us, r.wireUs, maxFps(r));
+    }
+
+public:
+    explicit SelfBenchmark(int numLeds) : numLeds(numLeds) {
+    }
+
+    // Ask the render loop to start a run; safe from any task. False if one is already under way.
+    bool request() {
+        if (requested || state == RUNNING) return false;
+        requested = true;
+        return true;
+    }
+
+    // Render loop: true while step() should replace the normal frame
+    bool running() {
+        if (requested) {
+            requested = false;
+            portENTER_CRITICAL(&resultsLock);
+            numResults = 0;
+            portEXIT_CRITICAL(&resultsLock);
+            effectIndex = 0;
+            pass = 0;
+            frame = 0;
+            cpuMhz = getCpuFrequencyMhz();
+            state = RUNNING;
+            Serial.printf("Benchmark: %d frames per effect at %d LEDs\n", SELF_BENCH_FRAMES, numLeds);
+        }
+        return state == RUNNING;
+    }
+
+    // Render and possibly send one frame; true once the run is complete, after
+    // which the caller's effects must start again from scratch
+    bool step(Effects& effects, Presenter& presenter, AsyncOutput& output, PowerModel& power, CRGB color,
+              uint8_t brightness) {
+        int count;
+        const EffectInfo* effect = &Effects::registry(count)[effectIndex];
+        if (frame == 0) {
+            if (pass == 0) {
+                effects.setPalette(0);
+                effects.invalidate();
+                effects.start(effect);
+            }
+            if (pass == 1) {
+                // Start the wire totals with nothing of the render-only pass or the normal loop in flight
+                output.flush();
+                wireStart = output.sentFrameUs();
+                sentStart = output.sentFrames();
+            }
+            passStart = micros();
+        }
+
+        uint32_t renderStart = micros();
+        effects.render(effect, color);
+        presenter.upscale(effects.output(effect), effects.outputSize(effect), effect->upscale);
+        uint32_t rendered = micros();
+        if (pass == 0) {
+            renderSamples[frame] = rendered - renderStart;
+        } else {
+            power.update(0, numLeds);
+            output.show(power.limit(brightness));
+            showSamples[frame] = micros() - rendered;
+        }
+
+        if (++frame < SELF_BENCH_FRAMES) return false;
+        frame = 0;
+        if (pass == 0) {
+            pass = 1;
+            return false;
+        }
+        output.flush();
+        finishEffect(effect, output);
+        pass = 0;
+        if (++effectIndex < count && effectIndex < MAX_EFFECTS) return false;
+        state = DONE;
+        Serial.println("Benchmark complete");
+        return true;
+    }
+
+    State status() const {
+        return state;
+    }
+
+    // Effects finished so far in the current run
+    int progress() const {
+        return effectIndex;
+    }
+
+    // Copy the results finished so far into out (MAX_EFFECTS long); returns how many.
+    // Safe from any task; complete once status() is DONE.
+    int copyResults(Result* out) {
+        portENTER_CRITICAL(&resultsLock);
+        int count = numResults;
+        memcpy(out, results, count * sizeof(Result));
+        portEXIT_CRITICAL(&resultsLock);
+        return count;
+    }
+
+    int leds() const {
+        return numLeds;
+    }
+
+    // Clock speed the run was made at
+    uint32_t mhz() const {
+        return cpuMhz;
+    }
+
+    // Highest frame rate the loop kept up with output enabled
+    static uint32_t maxFps(const Result& r) {
+        return r.frameUs ? 1000000 / r.frameUs : 0;
+    }
+};
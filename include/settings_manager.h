@@ -1,6 +1,7 @@
 #pragma once
 #include <EEPROM.h>
 #include "config.h"
+#include "event_trace.h"
 
 class SettingsManager {
 private:
@@ -46,7 +47,7 @@ public:
             settings.colorR = 255;  // Default to white
             settings.colorG = 255;
             settings.colorB = 255;
-            strcpy(settings.effect, "solid");
+            strcpy(settings.effect, "water");
             settings.lastWrite = 0;
             
             // Force immediate save of defaults
@@ -75,6 +76,7 @@ public:
         
         // Only write if forced or enough time has passed since last write
         if (force || (now - settings.lastWrite >= MIN_WRITE_INTERVAL)) {
+            TRACE_SCOPE("settings_commit", EventTrace::latestCommand());   // Logging, commit and read-back
             Serial.println("Saving settings to EEPROM...");
             dumpSettings("Settings to save");
             
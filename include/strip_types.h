@@ -0,0 +1,129 @@
+#pragma once
+#include <Arduino.h>
+#include <FastLED.h>
+#include <EEPROM.h>
+#include "config.h"
+
+#define STRIP_STRINGIFY(x) #x
+#define STRIP_NAME(x) STRIP_STRINGIFY(x)
+
+// LED chipset, color order and data pin, picked at boot from EEPROM instead
+// of being fixed at build time. FastLED only takes these as template
+// arguments, so every supported combination is instantiated up front and
+// the table holds a pointer to each addLeds<> specialization. Choosing one
+// costs a single call at boot; each still runs FastLED's compile-time
+// specialized output code.
+//
+// Build with -D STRIP_FIXED_TYPE to keep only the config.h default, e.g. to
+// measure what the table costs in flash (esp32dev-fixed-strip).
+//
+// Flash cost: the table itself is 24 16-byte entries and 7 names, 425 bytes
+// of rodata. On top of that each entry brings one addLeds<> instantiation
+// with its own controller; tools/strip_flash_cost.sh measures the two
+// together. That number is not recorded yet; if it runs past a few tens of
+// KB, drop the second pin first, which halves it.
+class StripTypes {
+public:
+    typedef CLEDController& (*AddFunction)(CRGB* leds, int numLeds);
+
+    struct Entry {
+        const char* chipset;
+        const char* order;
+        uint8_t pin;
+        AddFunction add;
+    };
+
+    // Persisted by name, so reordering the table never changes an installation
+    struct Stored {
+        uint16_t magic;
+        char chipset[12];
+        char order[4];
+        uint8_t pin;
+    };
+
+private:
+    template<template<uint8_t, EOrder> class CHIPSET, uint8_t PIN, EOrder ORDER>
+    static CLEDController& add(CRGB* leds, int numLeds) {
+        return FastLED.addLeds<CHIPSET, PIN, ORDER>(leds, numLeds);
+    }
+
+public:
+    // Entries in table(), for sizing replies that list them
+#ifdef STRIP_FIXED_TYPE
+    static constexpr int COUNT = 1;
+#else
+    static constexpr int COUNT = 24;   // 4 chipsets, 2 pins, 3 orders
+#endif
+
+    static const Entry* table(int& count) {
+#ifdef STRIP_FIXED_TYPE
+        static constexpr Entry entries[] = {
+            { STRIP_NAME(LED_TYPE), STRIP_NAME(COLOR_ORDER), LED_PIN, &add<LED_TYPE, LED_PIN, COLOR_ORDER> },
+        };
+#else
+#define STRIP_ORDERS(chipset, pin) \
+            { #chipset, "RGB", pin, &add<chipset, pin, RGB> }, \
+            { #chipset, "GRB", pin, &add<chipset, pin, GRB> }, \
+            { #chipset, "BRG", pin, &add<chipset, pin, BRG> },
+#define STRIP_PINS(chipset) STRIP_ORDERS(chipset, 13) STRIP_ORDERS(chipset, 16)
+        static constexpr Entry entries[] = {
+            STRIP_PINS(WS2811)
+            STRIP_PINS(WS2812B)
+            STRIP_PINS(WS2813)
+            STRIP_PINS(SK6812)
+        };
+#undef STRIP_PINS
+#undef STRIP_ORDERS
+#endif
+        static_assert(sizeof(entries) / sizeof(entries[0]) == COUNT, "COUNT must match the table");
+        count = COUNT;
+        return entries;
+    }
+
+    // pin is an int so a value that does not fit a GPIO number never matches a truncated one
+    static const Entry* find(const char* chipset, const char* order, int pin) {
+        int count;
+        const Entry* entries = table(count);
+        for (int i = 0; i < count; i++) {
+            if (strcmp(entries[i].chipset, chipset) == 0 && strcmp(entries[i].order, order) == 0 &&
+                entries[i].pin == pin) {
+                return &entries[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // The config.h strip, used until another one is saved
+    static const Entry* fallback() {
+        const Entry* entry = find(STRIP_NAME(LED_TYPE), STRIP_NAME(COLOR_ORDER), LED_PIN);
+        if (entry) return entry;
+        int count;
+        return table(count);   // Default not in the table; first entry keeps the strip usable
+    }
+
+    // Strip saved in EEPROM, or the default when none is saved or it is no longer supported
+    static const Entry* load() {
+        Stored stored;
+        EEPROM.get(STRIP_ADDR, stored);
+        if (stored.magic == STRIP_MAGIC) {
+            stored.chipset[sizeof(stored.chipset) - 1] = '\0';
+            stored.order[sizeof(stored.order) - 1] = '\0';
+            const Entry* entry = find(stored.chipset, stored.order, stored.pin);
+            if (entry) return entry;
+            Serial.printf("Saved strip %s/%s on pin %u not supported by this build\n",
+                          stored.chipset, stored.order, stored.pin);
+        }
+        return fallback();
+    }
+
+    static bool save(const Entry* entry) {
+        Stored stored;
+        memset(&stored, 0, sizeof(stored));
+        stored.magic = STRIP_MAGIC;
+        strncpy(stored.chipset, entry->chipset, sizeof(stored.chipset) - 1);
+        strncpy(stored.order, entry->order, sizeof(stored.order) - 1);
+        stored.pin = entry->pin;
+        EEPROM.put(STRIP_ADDR, stored);
+        return EEPROM.commit();
+    }
+};
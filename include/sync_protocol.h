@@ -0,0 +1,201 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// Shared clock for controllers on one LAN, so their animations run in step.
+// Plain C++ without Arduino dependencies: the caller moves packets (UDP
+// multicast on the device, see net_clock.h; loopback sockets in
+// tools/sync_loopback.cpp) and supplies its local clock in microseconds.
+//
+// Leader election: the node with the lowest id that is still announcing
+// wins. A node that hears no announce from a lower id for TIMEOUT_US takes
+// over and keeps its own view of network time, so the clock does not jump
+// when a leader drops out. A node joining a running network follows
+// whichever leader it hears, even one with a higher id, and only announces
+// itself once a round trip has given it that leader's time; the network
+// clock carries on from where it was instead of restarting from the
+// newcomer's uptime.
+//
+// Followers estimate their offset NTP-style: REQUEST carries the local send
+// time t1, the leader's REPLY adds its network time t2 on receipt, and on
+// arrival at t4 the offset is t2 - (t1 + t4) / 2. Of the last few samples
+// the one with the shortest round trip wins, which filters out WiFi
+// retransmissions and queueing.
+class SyncProtocol {
+public:
+    enum Type : uint8_t { ANNOUNCE = 1, REQUEST = 2, REPLY = 3 };
+
+    struct Packet {
+        char magic[3];     // "LTS"
+        uint8_t type;
+        uint32_t node;     // Sender
+        uint32_t target;   // Node a REQUEST or REPLY is meant for, 0 for ANNOUNCE
+        uint32_t reserved;
+        int64_t t1;        // REQUEST send time, echoed in the REPLY (sender's local clock)
+        int64_t t2;        // Network time: when sent (ANNOUNCE) or when the REQUEST arrived (REPLY)
+    };
+
+    static_assert(sizeof(Packet) == 32, "Sync packet must match the wire layout");
+
+    static const int64_t INTERVAL_US = 500000;       // Announce and request period
+    static const int64_t TIMEOUT_US = 3 * INTERVAL_US;   // Leader considered gone after this
+    static const int SAMPLES = 8;                    // Round trips kept for the offset filter
+
+private:
+    uint32_t self;
+    uint32_t leaderId = 0;          // 0 while no leader is known
+    bool leading = false;
+    int64_t offset = 0;             // Network time minus local time
+    bool synced = false;
+    int64_t startedAt = 0;
+    int64_t lastLeaderHeard = 0;
+    int64_t nextSend = 0;
+    int64_t pendingT1 = 0;          // Local send time of the outstanding REQUEST, 0 if none
+
+    int64_t sampleOffset[SAMPLES];
+    int64_t sampleRtt[SAMPLES];
+    int samples = 0;
+    int nextSample = 0;
+    int64_t rtt = 0;
+
+    void fill(Packet& p, Type type, uint32_t target) const {
+        memcpy(p.magic, "LTS", 3);
+        p.type = type;
+        p.node = self;
+        p.target = target;
+        p.reserved = 0;
+        p.t1 = 0;
+        p.t2 = 0;
+    }
+
+    void follow(uint32_t node, int64_t localUs) {
+        if (leaderId != node) {
+            leaderId = node;
+            samples = 0;
+            nextSample = 0;   // Old leader's samples are never looked at again
+            pendingT1 = 0;
+            nextSend = localUs;   // Measure the new leader straight away
+        }
+        leading = false;
+        lastLeaderHeard = localUs;
+    }
+
+    void addSample(int64_t sample, int64_t roundTrip) {
+        sampleOffset[nextSample] = sample;
+        sampleRtt[nextSample] = roundTrip;
+        nextSample = (nextSample + 1) % SAMPLES;
+        if (samples < SAMPLES) samples++;
+
+        int best = 0;
+        for (int i = 1; i < samples; i++) {
+            if (sampleRtt[i] < sampleRtt[best]) best = i;
+        }
+        offset = sampleOffset[best];
+        rtt = sampleRtt[best];
+        synced = true;
+    }
+
+public:
+    SyncProtocol(uint32_t nodeId) : self(nodeId) {
+    }
+
+    void begin(int64_t localUs) {
+        startedAt = localUs;
+        lastLeaderHeard = localUs;
+        nextSend = localUs;
+        leaderId = 0;
+        leading = false;
+        samples = 0;
+        nextSample = 0;
+        pendingT1 = 0;
+    }
+
+    // Handle a received packet; returns true with reply filled when one must be sent
+    bool receive(const Packet& p, int64_t localUs, Packet& reply) {
+        if (memcmp(p.magic, "LTS", 3) != 0 || p.node == self) return false;
+
+        switch (p.type) {
+            case ANNOUNCE:
+                // Lower ids lead; a higher one is followed only to pick up the time before taking over
+                if ((p.node < self || !leading) &&
+                    (leaderId == 0 || leading || p.node <= leaderId || localUs - lastLeaderHeard >= TIMEOUT_US)) {
+                    follow(p.node, localUs);
+                    if (!synced) {
+                        offset = p.t2 - localUs;   // Coarse until the first round trip
+                        synced = true;
+                    }
+                }
+                return false;
+
+            case REQUEST:
+                if (!leading || p.target != self) return false;
+                fill(reply, REPLY, p.node);
+                reply.t1 = p.t1;
+                reply.t2 = localUs + offset;
+                return true;
+
+            case REPLY:
+                if (leading || p.node != leaderId || p.target != self || p.t1 != pendingT1) return false;
+                pendingT1 = 0;
+                addSample(p.t2 - (p.t1 + localUs) / 2, localUs - p.t1);
+                return false;
+        }
+        return false;
+    }
+
+    // Periodic work; returns true with out filled when a packet is due
+    bool poll(int64_t localUs, Packet& out) {
+        // Take over when no lower node has been heard from for a while, or
+        // from a higher one once its time has been measured
+        bool leaderGone = localUs - lastLeaderHeard >= TIMEOUT_US && localUs - startedAt >= TIMEOUT_US;
+        bool outranked = leaderId > self && samples > 0;
+        if (!leading && (leaderGone || outranked)) {
+            leading = true;
+            leaderId = self;
+            synced = true;   // Our own clock is the reference now
+            nextSend = localUs;
+        }
+        if (localUs - nextSend < 0) return false;
+        nextSend = localUs + INTERVAL_US;
+
+        if (leading) {
+            fill(out, ANNOUNCE, 0);
+            out.t2 = localUs + offset;
+            return true;
+        }
+        if (leaderId == 0) return false;
+        fill(out, REQUEST, leaderId);
+        out.t1 = localUs;
+        pendingT1 = localUs;
+        return true;
+    }
+
+    int64_t networkTime(int64_t localUs) const {
+        return localUs + offset;
+    }
+
+    bool isLeader() const {
+        return leading;
+    }
+
+    bool isSynced() const {
+        return synced;
+    }
+
+    uint32_t leader() const {
+        return leaderId;
+    }
+
+    uint32_t node() const {
+        return self;
+    }
+
+    int64_t offsetUs() const {
+        return offset;
+    }
+
+    // Round trip of the sample the offset came from
+    int64_t roundTripUs() const {
+        return rtt;
+    }
+};
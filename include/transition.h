@@ -0,0 +1,93 @@
+#pragma once
+#include <FastLED.h>
+#include "config.h"
+#include "effects.h"
+#include "presenter.h"
+#include "pixel_kernels.h"
+
+// Crossfade from the previous effect to the current one. The incoming effect
+// renders into the strip buffer as usual; while the fade runs, the outgoing
+// effect keeps rendering into one spare frame which is blended over it with
+// a fixed-point ramp that starts at exactly the outgoing frame and ends at
+// exactly the incoming one. Once the fade completes the outgoing effect is
+// dropped. Switching again mid-fade fades out the blend on the strip at that
+// moment, held still, instead of cutting away from it.
+class Transition {
+private:
+    CRGB* leds;
+    int numLeds;
+    CRGB* outgoingLeds = nullptr;
+    Presenter* outgoingPresenter = nullptr;
+
+    const EffectInfo* outgoing = nullptr;
+    uint8_t outgoingPalette = 0;
+    bool still = false;   // outgoingLeds holds a snapshot of an interrupted fade, not an effect
+    uint32_t startTime = 0;
+    uint32_t lastRender = 0;
+
+public:
+    Transition(CRGB* ledArray, int numLeds) : leds(ledArray), numLeds(numLeds) {
+    }
+
+    ~Transition() {
+        delete outgoingPresenter;
+        delete[] outgoingLeds;
+    }
+
+    void begin() {
+        outgoingLeds = new CRGB[numLeds];
+        outgoingPresenter = new Presenter(outgoingLeds, numLeds);
+    }
+
+    // Start fading out an effect; it keeps its current state and palette and carries on animating
+    void start(const EffectInfo* from, uint8_t fromPalette, uint32_t now) {
+        if (active() && now - startTime < EFFECT_TRANSITION_MS) {
+            // The strip buffer still holds the last blended frame
+            memcpy(outgoingLeds, leds, numLeds * sizeof(CRGB));
+            outgoing = nullptr;
+            still = true;
+        } else {
+            outgoing = from;
+            outgoingPalette = fromPalette;
+            still = false;
+        }
+        startTime = now;
+        lastRender = 0;
+    }
+
+    bool active() const {
+        return outgoing != nullptr || still;
+    }
+
+    // Blend the outgoing effect over the freshly rendered strip buffer. Returns
+    // true when the whole strip differs from what the incoming effect reported
+    // as changed, including the first frame after the fade ends.
+    bool apply(Effects& effects, CRGB color, uint32_t now) {
+        if (!active()) return false;
+
+        uint32_t elapsed = now - startTime;
+        if (elapsed >= EFFECT_TRANSITION_MS) {
+            outgoing = nullptr;
+            still = false;
+            return true;
+        }
+        // 255 on the first frame shows only the outgoing frame; it reaches 0 as the fade ends
+        uint8_t amount = 255 - elapsed * 255 / EFFECT_TRANSITION_MS;
+
+        // Keep the outgoing effect at its own frame rate, reusing the spare frame in between
+        if (outgoing != nullptr && (lastRender == 0 || now - lastRender >= outgoing->frameMs)) {
+            lastRender = now;
+            uint8_t incomingPalette = effects.palette();
+            effects.setTarget(outgoingLeds);
+            effects.setPalette(outgoingPalette);
+            effects.render(outgoing, color);
+            outgoingPresenter->upscale(effects.output(outgoing), effects.outputSize(outgoing), outgoing->upscale);
+            effects.setPalette(incomingPalette);
+            effects.setTarget(leds);
+        }
+
+        PixelKernels::blend(leds, outgoingLeds, numLeds, amount);
+        effects.invalidate();
+        return true;
+    }
+};
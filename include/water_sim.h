@@ -0,0 +1,67 @@
+#pragma once
+#include <Arduino.h>
+
+// Damped 1D wave equation on a closed loop of cells (the strip runs all the
+// way around the planter, so the ends are joined). Integer only, O(N) per
+// step, using two int16 height buffers that swap roles every step.
+class WaterSim {
+private:
+    int numCells = 0;
+    int16_t* current = nullptr;
+    int16_t* previous = nullptr;
+
+    static const int16_t MAX_HEIGHT = 8192;   // Keeps neighbour sums inside int16 headroom
+    static const uint8_t DAMPING_SHIFT = 5;   // Lose 1/32 of the energy each step
+
+public:
+    ~WaterSim() {
+        delete[] current;
+        delete[] previous;
+    }
+
+    void begin(int cells) {
+        numCells = cells;
+        current = new int16_t[numCells];
+        previous = new int16_t[numCells];
+        reset();
+    }
+
+    void reset() {
+        memset(current, 0, numCells * sizeof(int16_t));
+        memset(previous, 0, numCells * sizeof(int16_t));
+    }
+
+    int getNumCells() const {
+        return numCells;
+    }
+
+    // Add an impulse at a cell; negative values push the surface down like a droplet
+    void drop(int cell, int16_t strength) {
+        int32_t h = (int32_t)current[cell] + strength;
+        current[cell] = constrain(h, -MAX_HEIGHT, MAX_HEIGHT);
+    }
+
+    // Advance one step: next = cur + (left + right) / 2 - prev, then damp.
+    // This is the leapfrog scheme with c^2 = 1/2, comfortably inside the
+    // stability limit. The result is written over the previous buffer.
+    void step() {
+        int16_t* cur = current;
+        int16_t* next = previous;
+        int last = numCells - 1;
+
+        for (int i = 0; i < numCells; i++) {
+            int32_t left = cur[i == 0 ? last : i - 1];
+            int32_t right = cur[i == last ? 0 : i + 1];
+            int32_t h = cur[i] + ((left + right) >> 1) - next[i];
+            h -= h >> DAMPING_SHIFT;
+            next[i] = constrain(h, -MAX_HEIGHT, MAX_HEIGHT);
+        }
+
+        previous = current;
+        current = next;
+    }
+
+    int16_t height(int cell) const {
+        return current[cell];
+    }
+};
@@ -95,6 +95,17 @@ const char index_html[] PROGMEM = R"rawliteral(
             <option value="ripple">Water Ripple</option>
             <option value="twinkle">Twinkle</option>
             <option value="wave">Color Wave</option>
+            <option value="water">Water</option>
+            <option value="scene">Planter Scene</option>
+            <option value="clip">Prerendered Clip</option>
+            <option value="program">Uploaded Program</option>
+        </select>
+        <select id="palette-list">
+            <option value="none">Current Color</option>
+            <option value="ocean">Ocean</option>
+            <option value="lava">Lava</option>
+            <option value="forest">Forest</option>
+            <option value="sunset">Sunset</option>
         </select>
         <button class="button" onclick="applyEffect()">Apply Effect</button>
     </div>
@@ -160,12 +171,19 @@ const char index_html[] PROGMEM = R"rawliteral(
                 fetch('/effect?name=' + effect);
             }
             if (effect) {
-                document.getElementById('effects-list').value = effect;
+                // Rainbow, wave and water take a palette after a colon, "water:ocean"
+                var parts = effect.split(':');
+                document.getElementById('effects-list').value = parts[0];
+                document.getElementById('palette-list').value = parts[1] || 'none';
             }
         }
 
         function applyEffect() {
             var effect = document.getElementById('effects-list').value;
+            var palette = document.getElementById('palette-list').value;
+            if (palette != 'none' && ['rainbow', 'wave', 'water'].includes(effect)) {
+                effect += ':' + palette;
+            }
             updateEffect(effect);
         }
 
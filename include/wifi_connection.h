@@ -0,0 +1,229 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_netif.h>
+#include "config.h"
+
+// Keeps the station link to the stored network up. Reconnects are driven
+// from loop() with exponential backoff and jitter, so nothing blocks the
+// render loop. If the network stays away the config AP is brought up
+// alongside the station (AP+STA) and retries carry on in the background;
+// the AP is dropped again once the network is back.
+//
+// The WiFi event handler only calls onConnected()/onDisconnected(), which
+// record the link state for the next update().
+class WiFiConnection {
+public:
+    enum State { OFF, WAITING, CONNECTING, CONNECTED };
+
+private:
+    char ssid[32] = "";
+    char password[64] = "";
+
+    State state = OFF;
+    volatile bool linkUp = false;
+    volatile uint32_t linkDrops = 0;   // Disconnect events, counted by the event task
+    uint32_t seenDrops = 0;
+
+    bool apActive = false;
+    uint8_t attempt = 0;           // Failed attempts in the current outage
+    uint32_t attemptStart = 0;
+    uint32_t nextAttempt = 0;
+    uint32_t outageStart = 0;
+    bool inOutage = false;
+
+    uint32_t outages = 0;
+    uint32_t lastReconnectMs = 0;   // Outage start to IP, for the last outage
+
+    bool reconfiguring = false;
+    uint32_t reconfigureStart = 0;
+    uint32_t lastReconfigureMs = 0;   // New settings applied to IP, for the last change
+
+    void startAP() {
+        if (apActive) return;
+        WiFi.mode(ssid[0] ? WIFI_AP_STA : WIFI_AP);
+        WiFi.softAP(AP_SSID, AP_PASSWORD);
+        apActive = true;
+        Serial.print("Config AP up at ");
+        Serial.println(WiFi.softAPIP());
+    }
+
+    void stopAP() {
+        if (!apActive) return;
+        WiFi.softAPdisconnect(true);
+        WiFi.mode(WIFI_STA);
+        apActive = false;
+        Serial.println("Config AP down");
+    }
+
+    // Exponential backoff with equal jitter: half the step fixed, half random
+    uint32_t backoff() const {
+        uint32_t step = WIFI_RETRY_MIN_MS << min<uint8_t>(attempt, 16);
+        if (step > WIFI_RETRY_MAX_MS) step = WIFI_RETRY_MAX_MS;
+        return step / 2 + random(step / 2 + 1);
+    }
+
+    void retryLater(uint32_t now) {
+        attempt++;
+        state = WAITING;
+        nextAttempt = now + backoff();
+    }
+
+    void connect(uint32_t now) {
+        seenDrops = linkDrops;   // Drops from before this attempt are stale
+        WiFi.begin(ssid, password);
+        state = CONNECTING;
+        attemptStart = now;
+    }
+
+    void updateStatusLed() {
+        digitalWrite(WIFI_STATUS_LED_PIN, (state == CONNECTED || apActive) ? HIGH : LOW);
+    }
+
+public:
+    // Start with the stored credentials; an empty SSID serves only the config AP.
+    // Called again with new credentials (or the same, to rejoin after a hostname
+    // change) it drops the link and reconnects; only loop() may do that.
+    void begin(const char* newSsid, const char* newPassword) {
+        strncpy(ssid, newSsid, sizeof(ssid) - 1);
+        ssid[sizeof(ssid) - 1] = '\0';
+        strncpy(password, newPassword, sizeof(password) - 1);
+        password[sizeof(password) - 1] = '\0';
+
+        WiFi.setAutoReconnect(false);   // Retries are ours
+        bool restarting = state != OFF;
+        if (restarting) {
+            WiFi.disconnect();
+            linkUp = false;
+            reconfiguring = true;
+            reconfigureStart = millis();
+        }
+        attempt = 0;
+        inOutage = false;
+        outageStart = millis();
+
+        if (ssid[0] == '\0') {
+            Serial.println("No stored WiFi credentials");
+            state = OFF;
+            startAP();
+        } else if (restarting) {
+            // Let the disconnect event from the old link arrive before trying
+            state = WAITING;
+            nextAttempt = millis() + WIFI_RETRY_MIN_MS;
+        } else {
+            Serial.printf("Attempting to connect to WiFi: %s\n", ssid);
+            if (!apActive) WiFi.mode(WIFI_STA);
+            connect(millis());
+        }
+        updateStatusLed();
+    }
+
+    // Name the station gives DHCP. WiFi.setHostname() only takes effect when
+    // the station interface next starts, so a running one is renamed directly;
+    // begin() then rejoins to announce it.
+    void setHostname(const char* name) {
+        WiFi.setHostname(name);
+        esp_netif_t* netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+        if (netif != nullptr) esp_netif_set_hostname(netif, name);
+    }
+
+    // Called from the WiFi event task
+    void onConnected() {
+        linkUp = true;
+    }
+
+    void onDisconnected() {
+        linkUp = false;
+        linkDrops = linkDrops + 1;
+    }
+
+    void update(uint32_t now) {
+        if (state == OFF) return;
+
+        bool dropped = linkDrops != seenDrops;
+        seenDrops = linkDrops;
+
+        if (state == CONNECTED) {
+            if (linkUp) return;
+            // Link lost: retry straight away, then back off
+            Serial.println("WiFi lost, reconnecting");
+            outages++;
+            inOutage = true;
+            outageStart = now;
+            attempt = 0;
+            state = WAITING;
+            nextAttempt = now;
+        }
+
+        if (state == CONNECTING) {
+            if (linkUp) {
+                state = CONNECTED;
+                if (inOutage) {
+                    lastReconnectMs = now - outageStart;
+                    Serial.printf("WiFi back after %lu ms, %u attempts\n", (unsigned long)lastReconnectMs, attempt + 1);
+                }
+                if (reconfiguring) {
+                    lastReconfigureMs = now - reconfigureStart;
+                    Serial.printf("WiFi reconfigured, back after %lu ms\n", (unsigned long)lastReconfigureMs);
+                }
+                reconfiguring = false;
+                inOutage = false;
+                attempt = 0;
+                stopAP();
+            } else if (dropped || now - attemptStart >= WIFI_CONNECT_TIMEOUT_MS) {
+                if (!inOutage) {
+                    inOutage = true;   // Never connected since begin()
+                    outageStart = attemptStart;
+                }
+                WiFi.disconnect();
+                retryLater(now);
+            }
+        }
+
+        if (state == WAITING && (int32_t)(now - nextAttempt) >= 0) {
+            // Serve the config AP while the network stays away
+            if (!apActive && now - outageStart >= WIFI_AP_FALLBACK_MS) {
+                Serial.println("WiFi still down, starting config AP");
+                startAP();
+            }
+            connect(now);
+        }
+        updateStatusLed();
+    }
+
+    State getState() const {
+        return state;
+    }
+
+    bool connected() const {
+        return state == CONNECTED;
+    }
+
+    bool apRunning() const {
+        return apActive;
+    }
+
+    uint32_t outageCount() const {
+        return outages;
+    }
+
+    uint32_t lastReconnectLatency() const {
+        return lastReconnectMs;
+    }
+
+    uint32_t lastReconfigureDowntime() const {
+        return lastReconfigureMs;
+    }
+
+    const char* network() const {
+        return ssid;
+    }
+
+    const char* passphrase() const {
+        return password;
+    }
+
+    uint8_t attempts() const {
+        return attempt;
+    }
+};
@@ -6,39 +6,86 @@
 #include <ArduinoJson.h>
 #include <EEPROM.h>
 #include <Update.h>
+#include <LittleFS.h>
 #include "config.h"
 #include "web_interface.h"
 #include "effects.h"
-#include "mqtt_handler.h"
+#include "mqtt_session.h"
 #include "settings_manager.h"
+#include "planter_layout.h"
+#include "presenter.h"
+#include "async_output.h"
+#include "strip_types.h"
+#include "compositor.h"
+#include "transition.h"
+#include "interpolator.h"
+#include "power_model.h"
+#include "clip_player.h"
+#include "effect_vm.h"
+#include "benchmarks.h"
+#include "fixed_string.h"
+#include "wifi_connection.h"
+#include "net_clock.h"
+#include "frame_fanout.h"
+#include "alloc_counter.h"
+#include "idle_mode.h"
+#include "event_trace.h"
+#include "light_command.h"
+#include "light_control.h"
+#include "json_buffer.h"
+#include "self_benchmark.h"
 
 // LED strip configuration
-CRGB leds[NUM_LEDS];
+CRGB leds[LOGICAL_LEDS];   // The whole logical strip; this controller drives the first NUM_LEDS
 uint8_t brightness = 255;
 CRGB currentColor = CRGB::White;
-String currentEffect = "solid";
+FixedString<31> currentEffect("water");
 
 // WiFi credentials
-String ssid;
-String password;
+FixedString<31> ssid;
+FixedString<63> password;
 
 // Global variables for MQTT settings
-String mqtt_host;
+FixedString<63> mqtt_host;
 uint16_t mqtt_port;
-String mqtt_user;
-String mqtt_pass;
+FixedString<31> mqtt_user;
+FixedString<31> mqtt_pass;
 
 // Global variables
-String hostname;
-uint8_t wifiConnectionAttempts = 0;
-const uint8_t MAX_WIFI_ATTEMPTS = 3;
+FixedString<31> hostname;   // Written only by loop(); other tasks read hostnameSnapshot()
+portMUX_TYPE hostnameLock = portMUX_INITIALIZER_UNLOCKED;
+WiFiConnection wifi;
+NetClock netClock;   // Shared with the other controllers on the LAN
+FrameFanout fanout;   // Leader or follower when one logical strip spans several controllers
+
+// Settings saved by a web handler and applied live by loop(), so only the
+// affected connection restarts. Bits of CONFIG_*.
+enum { CONFIG_WIFI = 1, CONFIG_MQTT = 2, CONFIG_HOSTNAME = 4 };
+uint8_t pendingConfig = 0;
+uint32_t pendingConfigSince = 0;
+portMUX_TYPE configLock = portMUX_INITIALIZER_UNLOCKED;
 
 // Create objects
 AsyncWebServer server(80);
 AsyncMqttClient mqttClient;
+MQTTSession mqttSession(mqttClient);
+void storeCommand(const LightCommand& light, bool saveNow);
+LightControl lightControl(brightness, currentColor, currentEffect, mqttSession, storeCommand);   // Applies commands to the state above
+PlanterLayout layout;
 Effects* effects;
+Presenter presenter(leds, LOGICAL_LEDS);
+AsyncOutput output(leds, NUM_LEDS);   // Sends from the front buffer while leds renders the next frame
+const StripTypes::Entry* strip = nullptr;   // Chipset, color order and pin driving the strip
+Compositor compositor(leds, LOGICAL_LEDS, &layout);
+Transition transition(leds, LOGICAL_LEDS);
+Interpolator interpolator;   // In-between frames for effects rendering keyframes
+IdleMode idle;   // Parks the render loop while the light is off
+const EffectInfo* activeEffect = nullptr;   // Effect drawn last frame, null while the scene runs
+PowerModel power(leds, NUM_LEDS);
+SelfBenchmark selfBenchmark(NUM_LEDS);   // Effect capacity measured on this controller, started from /benchmark
+uint32_t lastPowerReport = 0;
+uint32_t frameAllocations = 0;   // Heap allocations made by the last frame (TRACK_ALLOCATIONS builds)
 SettingsManager settingsManager;
-MQTTHandler* mqtt;
 
 // HTML for update page
 const char* updateHTML = R"(
@@ -199,62 +246,60 @@ void handleDoUpdate(AsyncWebServerRequest *request, String filename, size_t inde
 
 // Function declarations
 void setupWiFi();
+void loadWiFiCredentials(char (&ssid)[32], char (&password)[64]);
+void requestConfig(uint8_t changed);
 void setupWebServer();
 void setupMQTT();
 void handleWiFiSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
-void applyEffect(String effect);
-void publishState();
+void applyEffect(const char* effect);
+void publishPower();
+void publishDiscovery();
 void handleRequests();
 void loadMQTTSettings();
 void handleMQTTSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
 void handleGetSettings(AsyncWebServerRequest *request);
 void handleGetState(AsyncWebServerRequest *request);
 void loadHostname();
+FixedString<31> hostnameSnapshot();
 void handleHostnameSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+void handleStripSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+void handleGetStrips(AsyncWebServerRequest *request);
+void handleFanoutSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+void handleGetFanout(AsyncWebServerRequest *request);
+void handleSceneSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+void handleGetScene(AsyncWebServerRequest *request);
+void handleGetMetrics(AsyncWebServerRequest *request);
+void handleGetTrace(AsyncWebServerRequest *request);
+void handleBenchmark(AsyncWebServerRequest *request);
+void handleClipUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);
+void handleGetClips(AsyncWebServerRequest *request);
+void handleProgramUpload(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+void handleGetProgram(AsyncWebServerRequest *request);
+void loadProgram();
 
 // MQTT callbacks
-void onMqttBrightness(uint8_t value) {
-    brightness = value;
-    FastLED.setBrightness(brightness);
-}
-
-void onMqttColor(uint32_t color) {
-    currentColor = CRGB((color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
-    if (currentEffect == "solid") {
-        effects->solid(currentColor);
-    }
-}
-
-void onMqttEffect(const char* effect) {
-    currentEffect = effect;
-    applyEffect(currentEffect);
-}
-
 void onMqttConnect(bool sessionPresent) {
     Serial.println("Connected to MQTT.");
     digitalWrite(MQTT_STATUS_LED_PIN, HIGH);  // Turn on MQTT status LED
-    
-    // Subscribe to topics
-    uint16_t packetIdSub = mqttClient.subscribe(MQTT_BASE_TOPIC "/set", 2);
-    Serial.print("Subscribing at QoS 2, packetId: ");
-    Serial.println(packetIdSub);
-    
-    // Publish initial state
-    publishState();
+    mqttSession.onConnected();  // Resubscribed from loop()
 }
 
 void onMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
     Serial.println("Disconnected from MQTT.");
     digitalWrite(MQTT_STATUS_LED_PIN, LOW);  // Turn off MQTT status LED
+    mqttSession.onDisconnected();  // Reconnected from loop() with backoff
 }
 
-void startAPMode() {
-    Serial.println("Starting AP Mode");
-    WiFi.mode(WIFI_AP);
-    WiFi.softAP(AP_SSID, AP_PASSWORD);
-    Serial.print("AP IP address: ");
-    Serial.println(WiFi.softAPIP());
-    digitalWrite(WIFI_STATUS_LED_PIN, HIGH);  // Turn on WiFi LED in AP mode
+// Runs from loop() each time the session comes up
+void onMqttReady() {
+    // Subscribe to topics
+    uint16_t packetIdSub = mqttClient.subscribe(MQTT_BASE_TOPIC "/set", 2);
+    Serial.print("Subscribing at QoS 2, packetId: ");
+    Serial.println(packetIdSub);
+    
+    // Announce the light to Home Assistant, then its current state
+    publishDiscovery();
+    lightControl.publish();
 }
 
 void WiFiEvent(WiFiEvent_t event) {
@@ -270,21 +315,11 @@ void WiFiEvent(WiFiEvent_t event) {
             Serial.println("WiFi connected");
             Serial.print("IP address: ");
             Serial.println(WiFi.localIP());
-            wifiConnectionAttempts = 0;  // Reset attempt counter on successful connection
-            digitalWrite(WIFI_STATUS_LED_PIN, HIGH);  // Turn on WiFi status LED
+            wifi.onConnected();
             break;
         case SYSTEM_EVENT_STA_DISCONNECTED:
             Serial.println("WiFi lost connection");
-            digitalWrite(WIFI_STATUS_LED_PIN, LOW);  // Turn off WiFi status LED
-            
-            if (++wifiConnectionAttempts < MAX_WIFI_ATTEMPTS) {
-                Serial.printf("Retrying connection, attempt %d/%d\n", 
-                    wifiConnectionAttempts, MAX_WIFI_ATTEMPTS);
-                WiFi.begin();  // Retry connection
-            } else {
-                Serial.println("Maximum connection attempts reached");
-                startAPMode();  // Switch to AP mode
-            }
+            wifi.onDisconnected();  // Reconnected from loop() with backoff
             break;
         default:
             break;
@@ -308,56 +343,105 @@ void setup() {
         ESP.restart();
     }
 
+    // Clips live in LittleFS; format it on first boot
+    if (!LittleFS.begin(true)) {
+        Serial.println("Failed to mount LittleFS, clips unavailable");
+    } else {
+        if (!LittleFS.exists(CLIP_DIRECTORY)) {
+            LittleFS.mkdir(CLIP_DIRECTORY);
+        }
+        loadProgram();
+    }
+
     // Initialize LED strip
-    FastLED.addLeds<LED_TYPE, LED_PIN, COLOR_ORDER>(leds, NUM_LEDS);
+    output.begin();
+    strip = StripTypes::load();
+    strip->add(output.frontBuffer(), NUM_LEDS);
+    Serial.printf("Strip: %s, %s order, pin %u\n", strip->chipset, strip->order, strip->pin);
+    FastLED.setDither(output.dithering() ? DISABLE_DITHER : BINARY_DITHER);
     FastLED.setBrightness(brightness);
-    effects = new Effects(leds, NUM_LEDS);
+    layout.begin(LOGICAL_LEDS);
+    effects = new Effects(leds, LOGICAL_LEDS, &layout);
+    fanout.begin(NUM_LEDS);
+    compositor.begin();
+    transition.begin();
+    interpolator.begin(effects->interpolatedSize());
+    idle.begin();
+    power.begin();
+
+#ifdef RUN_BENCHMARKS
+    Benchmarks::runAll();
+#endif
 
     // Load saved settings
     loadHostname();
     loadMQTTSettings();
     
     // Set up WiFi event handlers and start WiFi
-    WiFi.onEvent(WiFiEvent);
     setupWiFi();
     
-    // Wait for WiFi connection before proceeding with MQTT setup
-    uint8_t wifiWaitAttempts = 0;
-    while (WiFi.status() != WL_CONNECTED && wifiWaitAttempts < 20) {
-        delay(500);
-        wifiWaitAttempts++;
-    }
-    
-    if (WiFi.status() == WL_CONNECTED) {
-        setupMQTT();
-        mqttClient.connect();
-    }
+    // MQTT connects from loop() once WiFi is up, and reconnects after outages
+    setupMQTT();
     
     // Set up web server (this works in both AP and STA modes)
     setupWebServer();
 }
 
-void publishState() {
-    StaticJsonDocument<200> doc;
-    doc["state"] = (brightness > 0) ? "ON" : "OFF";
-    doc["brightness"] = brightness;
+void publishPower() {
+    StaticJsonDocument<128> doc;
+    doc["current_ma"] = power.estimatedMa();
+    doc["budget_ma"] = power.budgetMa();
+    doc["limited"] = power.isLimiting();
     
-    JsonObject color = doc.createNestedObject("color");
-    // Use raw color values for state reporting
-    color["r"] = currentColor.r;
-    color["g"] = currentColor.g;
-    color["b"] = currentColor.b;
+    char output[128];
+    if (!serializeJsonComplete(doc, output, sizeof(output))) {
+        Serial.println("Power update too large to publish");
+        return;
+    }
+    mqttSession.publish(MQTT_BASE_TOPIC "/power", output, false);
+}
+
+// Home Assistant MQTT discovery, retained so HA picks the light up after its own restarts
+void publishDiscovery() {
+    StaticJsonDocument<1536> doc;
+    doc["~"] = MQTT_BASE_TOPIC;
+    doc["name"] = DEVICE_NAME;
+    doc["unique_id"] = DEVICE_ID;
+    doc["cmd_t"] = "~/set";
+    doc["stat_t"] = "~/state";
+    doc["avty_t"] = "~/availability";
+    doc["schema"] = "json";
+    doc["brightness"] = true;
+    doc["rgb"] = true;
+    doc["effect"] = true;
     
-    if (currentEffect.length() > 0) {
-        doc["effect"] = currentEffect;
+    JsonArray effect_list = doc.createNestedArray("effect_list");
+    int count;
+    const EffectInfo* table = Effects::registry(count);
+    for (int i = 0; i < count; i++) {
+        effect_list.add(table[i].name);
     }
+    effect_list.add("scene");
     
-    String output;
-    serializeJson(doc, output);
+    // Every palette on every effect that takes one, "water:ocean"
+    int paletteCount;
+    const Palettes::Info* palettes = Palettes::registry(paletteCount);
+    for (int i = 0; i < count; i++) {
+        if (!table[i].palette) continue;
+        for (int p = 0; p < paletteCount; p++) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s:%s", table[i].name, palettes[p].name);
+            effect_list.add(name);   // Copied into the document
+        }
+    }
     
-    char state_topic[64];
-    snprintf(state_topic, sizeof(state_topic), "%s/state", MQTT_BASE_TOPIC);
-    mqttClient.publish(state_topic, 0, true, output.c_str());
+    // Sent straight away: discovery is too large for the queue and only matters while connected
+    char output[1024];
+    if (!serializeJsonComplete(doc, output, sizeof(output))) {
+        Serial.printf("Discovery config too large to publish: %u bytes\n", (unsigned)measureJson(doc));
+        return;
+    }
+    mqttClient.publish("homeassistant/light/" DEVICE_ID "/config", 0, true, output);
 }
 
 void setupWiFi() {
@@ -365,37 +449,70 @@ void setupWiFi() {
     WiFi.onEvent(WiFiEvent);
     
     // Load WiFi credentials from EEPROM
-    char ssid[32] = {0};  // Initialize with zeros
-    char password[64] = {0};  // Initialize with zeros
-    char hostname[32] = {0};  // Initialize with zeros
+    char ssid[32];
+    char password[64];
+    loadWiFiCredentials(ssid, password);
+    wifi.setHostname(hostname.c_str());
     
-    // Read credentials from EEPROM
+    // Connect to the stored network, or serve the config AP if there is none
+    wifi.begin(ssid, password);
+}
+
+void loadWiFiCredentials(char (&ssid)[32], char (&password)[64]) {
     EEPROM.get(WIFI_SSID_ADDR, ssid);
     EEPROM.get(WIFI_PASS_ADDR, password);
-    EEPROM.get(HOSTNAME_ADDR, hostname);
     
     // Ensure null termination
     ssid[31] = '\0';
     password[63] = '\0';
-    hostname[31] = '\0';
+}
+
+// Called by web handlers once the new settings are in EEPROM
+void requestConfig(uint8_t changed) {
+    portENTER_CRITICAL(&configLock);
+    pendingConfig |= changed;
+    pendingConfigSince = millis();
+    portEXIT_CRITICAL(&configLock);
+}
+
+// Apply saved settings from loop(), restarting only what they affect
+void applyConfigChanges(uint32_t now) {
+    portENTER_CRITICAL(&configLock);
+    uint8_t changed = pendingConfig;
+    // WiFi changes wait a moment so the handler's response leaves over the old link
+    bool linkChange = changed & (CONFIG_WIFI | CONFIG_HOSTNAME);
+    if (linkChange && now - pendingConfigSince < CONFIG_APPLY_DELAY_MS) {
+        changed &= ~(CONFIG_WIFI | CONFIG_HOSTNAME);
+    }
+    pendingConfig &= ~changed;
+    portEXIT_CRITICAL(&configLock);
+    if (changed == 0) return;
     
-    // Set hostname (use default if empty)
-    if (strlen(hostname) == 0) {
-        strcpy(hostname, DEFAULT_HOSTNAME);
+    if (changed & CONFIG_MQTT) {
+        // Only the broker session restarts; WiFi and the strip carry on
+        mqttSession.restart(now);
+        loadMQTTSettings();
+        mqttClient.setServer(mqtt_host.c_str(), mqtt_port);
+        if (!mqtt_user.empty()) {
+            mqttClient.setCredentials(mqtt_user.c_str(), mqtt_pass.c_str());
+        } else {
+            mqttClient.setCredentials(nullptr, nullptr);
+        }
+        Serial.printf("MQTT settings applied, connecting to %s:%u\n", mqtt_host.c_str(), mqtt_port);
     }
-    WiFi.setHostname(hostname);
     
-    // Check if we have stored credentials
-    if (strlen(ssid) > 0) {
-        // Try to connect to stored WiFi
-        Serial.printf("Attempting to connect to WiFi: %s\n", ssid);
-        WiFi.mode(WIFI_STA);
-        WiFi.begin(ssid, password);
-        wifiConnectionAttempts = 0;  // Reset attempt counter
-    } else {
-        // No stored credentials, start in AP mode immediately
-        Serial.println("No stored WiFi credentials");
-        startAPMode();
+    if (changed & CONFIG_HOSTNAME) {
+        loadHostname();
+        wifi.setHostname(hostname.c_str());
+        Serial.printf("Hostname set to %s\n", hostname.c_str());
+    }
+    
+    if (changed & (CONFIG_WIFI | CONFIG_HOSTNAME)) {
+        // A new hostname reaches DHCP by rejoining with the same credentials
+        char ssid[32];
+        char password[64];
+        loadWiFiCredentials(ssid, password);
+        wifi.begin(ssid, password);
     }
 }
 
@@ -428,11 +545,56 @@ void setupWebServer() {
         handleHostnameSetup
     );
     
+    // Handle strip type setup
+    server.on("/setup-strip", HTTP_POST, 
+        [](AsyncWebServerRequest *request){},
+        NULL,
+        handleStripSetup
+    );
+    server.on("/strips", HTTP_GET, handleGetStrips);
+    
+    // Handle frame fan-out setup
+    server.on("/setup-fanout", HTTP_POST, 
+        [](AsyncWebServerRequest *request){},
+        NULL,
+        handleFanoutSetup
+    );
+    server.on("/fanout", HTTP_GET, handleGetFanout);
+    
+    // Handle layered scene setup
+    server.on("/scene", HTTP_POST, 
+        [](AsyncWebServerRequest *request){},
+        NULL,
+        handleSceneSetup
+    );
+    server.on("/scene", HTTP_GET, handleGetScene);
+    
+    // Handle prerendered clip upload and listing
+    server.on("/clips", HTTP_POST, [](AsyncWebServerRequest *request) {}, handleClipUpload);
+    server.on("/clips", HTTP_GET, handleGetClips);
+    
+    // Handle user effect program upload
+    server.on("/program", HTTP_POST, 
+        [](AsyncWebServerRequest *request){},
+        NULL,
+        handleProgramUpload
+    );
+    server.on("/program", HTTP_GET, handleGetProgram);
+    
     // Handle settings retrieval
     server.on("/get-settings", HTTP_GET, handleGetSettings);
     
     // Handle state retrieval
     server.on("/get-state", HTTP_GET, handleGetState);
+    
+    // Route for runtime metrics
+    server.on("/metrics", HTTP_GET, handleGetMetrics);
+    
+    // Route for the command trace (esp32dev-trace builds)
+    server.on("/trace", HTTP_GET, handleGetTrace);
+    
+    // Route for the on-device benchmark: ?run starts one, without it reports the last
+    server.on("/benchmark", HTTP_GET, handleBenchmark);
 
     // Handle OTA Update
     server.on("/update", HTTP_GET, handleUpdate);
@@ -447,64 +609,228 @@ void setupWebServer() {
 
 void handleRequests() {
     server.on("/brightness", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint16_t command = TRACE_COMMAND("http");
+        TRACE_SCOPE("http_request", command);
         if (request->hasParam("value")) {
-            brightness = request->getParam("value")->value().toInt();
-            FastLED.setBrightness(brightness);
-            settingsManager.setBrightness(brightness, true);  // Save immediately
-            publishState();
+            LightCommand light;
+            light.setBrightness(request->getParam("value")->value().toInt());
+            lightControl.apply(light, true);  // Save immediately
             request->send(200, "text/plain", "OK");
         }
     });
 
     server.on("/color", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint16_t command = TRACE_COMMAND("http");
+        TRACE_SCOPE("http_request", command);
         if (request->hasParam("value")) {
-            String colorStr = request->getParam("value")->value();
-            uint32_t number = (uint32_t) strtol(colorStr.c_str(), NULL, 16);
-            currentColor = CRGB(number >> 16, (number >> 8) & 0xFF, number & 0xFF);
-            
-            Serial.printf("Setting color to R:%d G:%d B:%d\n", currentColor.r, currentColor.g, currentColor.b);
-            settingsManager.setColor(currentColor, true);  // Force immediate save
-            
-            if (currentEffect == "solid") {
-                effects->solid(currentColor);
-            }
-            FastLED.show();
-            publishState();
+            LightCommand light;
+            light.setColor(request->getParam("value")->value().c_str());
+            lightControl.apply(light, true);  // Force immediate save
             request->send(200, "text/plain", "OK");
         }
     });
 
+    server.on("/clip", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint16_t command = TRACE_COMMAND("http");
+        TRACE_SCOPE("http_request", command);
+        if (!request->hasParam("name") || !ClipPlayer::validName(request->getParam("name")->value().c_str())) {
+            request->send(400, "text/plain", "Invalid clip name");
+            return;
+        }
+        const String& name = request->getParam("name")->value();
+        char path[48];
+        if (!LittleFS.exists(ClipPlayer::path(name.c_str(), path, sizeof(path)))) {
+            request->send(404, "text/plain", "Clip not found");
+            return;
+        }
+        // Optional frame rate and looping overrides
+        uint16_t frameMs = 0;
+        if (request->hasParam("fps")) {
+            long fps = request->getParam("fps")->value().toInt();
+            frameMs = fps > 0 ? max(1L, 1000 / fps) : 0;
+        }
+        int8_t loop = request->hasParam("loop") ? (request->getParam("loop")->value().toInt() != 0) : -1;
+        
+        // The loop picks the selection up on its next frame; the effect goes the way every command does
+        ClipPlayer::select(name.c_str(), frameMs, loop);
+        LightCommand light;
+        light.setEffect("clip");
+        lightControl.apply(light, true);  // Save immediately
+        request->send(200, "text/plain", "OK");
+    });
+    
     server.on("/effect", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint16_t command = TRACE_COMMAND("http");
+        TRACE_SCOPE("http_request", command);
         if (request->hasParam("name")) {
-            currentEffect = request->getParam("name")->value();
-            settingsManager.setEffect(currentEffect.c_str(), true);  // Save immediately
-            applyEffect(currentEffect);
-            publishState();
+            LightCommand light;
+            light.setEffect(request->getParam("name")->value().c_str());
+            lightControl.apply(light, true);  // Save immediately
             request->send(200, "text/plain", "OK");
         }
     });
+    
+    // Palette for the current effect, by name; "none" goes back to the current color
+    server.on("/palette", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint16_t command = TRACE_COMMAND("http");
+        TRACE_SCOPE("http_request", command);
+        if (!request->hasParam("name")) {
+            request->send(400, "text/plain", "Missing palette name");
+            return;
+        }
+        const EffectInfo* effect = Effects::find(currentEffect.c_str());
+        if (effect == nullptr || !effect->palette) {
+            request->send(400, "text/plain", "Effect takes no palette");
+            return;
+        }
+        String name = request->getParam("name")->value();
+        char selected[32];
+        if (name == "none") {
+            snprintf(selected, sizeof(selected), "%s", effect->name);
+        } else if (Palettes::find(name.c_str())) {
+            snprintf(selected, sizeof(selected), "%s:%s", effect->name, name.c_str());
+        } else {
+            request->send(400, "text/plain", "Unknown palette");
+            return;
+        }
+        LightCommand light;
+        light.setEffect(selected);
+        lightControl.apply(light, true);
+        request->send(200, "text/plain", "OK");
+    });
+}
+
+// Reply with a document serialized into the caller's buffer, or a 500 if it did not fit
+void sendJson(AsyncWebServerRequest *request, const JsonDocument& doc, char* buffer, size_t size) {
+    if (!serializeJsonComplete(doc, buffer, size)) {
+        Serial.printf("Reply for %s too large: %u bytes, buffer %u\n", request->url().c_str(),
+                      (unsigned)measureJson(doc), (unsigned)size);
+        request->send(500, "text/plain", "Reply too large");
+        return;
+    }
+    request->send(200, "application/json", buffer);
 }
 
 void handleGetState(AsyncWebServerRequest *request) {
-    StaticJsonDocument<200> doc;
-    doc["brightness"] = brightness;
-    doc["effect"] = currentEffect;
+    char response[256];
+    if (!LightCommand::encodeWebState(response, sizeof(response), brightness, currentColor.r, currentColor.g,
+                                      currentColor.b, currentEffect.c_str())) {
+        request->send(500, "text/plain", "Reply too large");
+        return;
+    }
+    request->send(200, "application/json", response);
+}
+
+void handleGetMetrics(AsyncWebServerRequest *request) {
+    StaticJsonDocument<512> doc;
+    doc["power_ma"] = power.estimatedMa();
+    doc["power_unlimited_ma"] = power.unlimitedMa();
+    doc["power_budget_ma"] = power.budgetMa();
+    doc["power_limited"] = power.isLimiting();
+    doc["output_brightness"] = power.outputBrightness();
+    doc["output_wait_us"] = output.meanWait();
+    doc["sketch_bytes"] = ESP.getSketchSize();
+    doc["wifi_connected"] = wifi.connected();
+    doc["wifi_ap"] = wifi.apRunning();
+    doc["wifi_outages"] = wifi.outageCount();
+    doc["wifi_reconnect_ms"] = wifi.lastReconnectLatency();
+    doc["mqtt_connected"] = mqttSession.connected();
+    doc["mqtt_reconnects"] = mqttSession.reconnectCount();
+    doc["mqtt_reconnect_ms"] = mqttSession.lastReconnectLatency();
+    doc["mqtt_dropped_updates"] = mqttSession.droppedUpdates();
+    doc["wifi_reconfigure_ms"] = wifi.lastReconfigureDowntime();
+    doc["mqtt_reconfigure_ms"] = mqttSession.lastReconfigureDowntime();
+    doc["sync_node"] = netClock.node();
+    doc["sync_leader"] = netClock.leader();
+    doc["sync_is_leader"] = netClock.isLeader();
+    doc["sync_offset_ms"] = netClock.offsetMs();
+    doc["sync_rtt_us"] = netClock.roundTripUs();
+    doc["idle"] = idle.parked();
+    doc["cpu_mhz"] = getCpuFrequencyMhz();
+    doc["wake_latency_us"] = idle.wakeLatency();
+    doc["idle_seconds"] = idle.idleSeconds(millis());
+    doc["palette_expansions"] = Palettes::expansions();
+    if (AllocCounter::enabled()) {
+        doc["allocations"] = AllocCounter::count();
+        doc["frame_allocations"] = frameAllocations;
+    }
+    
+    char response[768];
+    sendJson(request, doc, response, sizeof(response));
+}
+
+void handleBenchmark(AsyncWebServerRequest *request) {
+    if (request->hasParam("run")) {
+        // Needs the render loop: not while following a leader or parked with the light off
+        if (fanout.following(millis()) || brightness == 0) {
+            request->send(409, "text/plain", "Light must be on and rendering its own effects");
+        } else if (!selfBenchmark.request()) {
+            request->send(409, "text/plain", "Benchmark already running");
+        } else if (fanout.leading()) {
+            request->send(202, "text/plain", "Benchmark started; followers only get keepalive frames until it ends");
+        } else {
+            request->send(202, "text/plain", "Benchmark started");
+        }
+        return;
+    }
     
-    // Convert RGB values to hex color
-    char colorHex[8];
-    sprintf(colorHex, "#%02X%02X%02X", currentColor.r, currentColor.g, currentColor.b);
-    doc["color"] = colorHex;
+    DynamicJsonDocument doc(2048);
+    static const char* states[] = { "idle", "running", "done" };
+    SelfBenchmark::State state = selfBenchmark.status();
+    doc["state"] = states[state];
+    doc["firmware"] = FIRMWARE_VERSION;
+    doc["leds"] = selfBenchmark.leds();
+    doc["frames"] = SELF_BENCH_FRAMES;
+    if (state == SelfBenchmark::RUNNING) {
+        doc["completed"] = selfBenchmark.progress();
+    } else if (state == SelfBenchmark::DONE) {
+        doc["cpu_mhz"] = selfBenchmark.mhz();
+        JsonArray list = doc.createNestedArray("effects");
+        SelfBenchmark::Result results[SelfBenchmark::MAX_EFFECTS];
+        int count = selfBenchmark.copyResults(results);
+        for (int i = 0; i < count; i++) {
+            const SelfBenchmark::Result& r = results[i];
+            JsonObject entry = list.createNestedObject();
+            entry["name"] = r.name;
+            entry["render_us"] = r.renderUs;
+            entry["render_p99_us"] = r.renderP99Us;
+            entry["show_us"] = r.showUs;
+            entry["show_p99_us"] = r.showP99Us;
+            entry["wire_us"] = r.wireUs;
+            entry["frame_us"] = r.frameUs;
+            entry["max_fps"] = SelfBenchmark::maxFps(r);
+        }
+    }
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    char response[1536];
+    sendJson(request, doc, response, sizeof(response));
+}
+
+void handleGetTrace(AsyncWebServerRequest *request) {
+#ifdef TRACE_EVENTS
+    // Streamed straight from the ring; recording pauses until the download ends
+    if (!EventTrace::beginExport()) {
+        request->send(409, "text/plain", "Trace download already running");
+        return;
+    }
+    request->onDisconnect([]() {
+        EventTrace::endExport();
+    });
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+        [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            return EventTrace::read(buffer, maxLen);
+        });
+    response->addHeader("Content-Disposition", "attachment; filename=\"trace.json\"");
+    request->send(response);
+#else
+    request->send(404, "text/plain", "Tracing is not built in (use the esp32dev-trace environment)");
+#endif
 }
 
 void handleWiFiSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
     if (index == 0) {
-        String json = String((char*)data);
         StaticJsonDocument<200> doc;
-        DeserializationError error = deserializeJson(doc, json);
+        DeserializationError error = deserializeJson(doc, (const char*)data, len);
         
         if (!error) {
             // Clear old credentials in EEPROM
@@ -513,32 +839,31 @@ void handleWiFiSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len,
             }
             
             // Store new credentials
-            String newSsid = doc["ssid"].as<String>();
-            String newPassword = doc["password"].as<String>();
+            FixedString<31> newSsid(doc["ssid"] | "");
+            FixedString<63> newPassword(doc["password"] | "");
             
             // Validate SSID is not empty
-            if (newSsid.length() == 0) {
+            if (newSsid.empty()) {
                 request->send(400, "text/plain", "SSID cannot be empty");
                 return;
             }
             
             Serial.print("Saving new WiFi credentials - SSID: ");
-            Serial.println(newSsid);
+            Serial.println(newSsid.c_str());
             
             // Write SSID
             for (size_t i = 0; i < newSsid.length(); i++) {
-                EEPROM.write(WIFI_SSID_ADDR + i, newSsid[i]);
+                EEPROM.write(WIFI_SSID_ADDR + i, newSsid.c_str()[i]);
             }
             
             // Write Password
             for (size_t i = 0; i < newPassword.length(); i++) {
-                EEPROM.write(WIFI_PASS_ADDR + i, newPassword[i]);
+                EEPROM.write(WIFI_PASS_ADDR + i, newPassword.c_str()[i]);
             }
             
             if (EEPROM.commit()) {
-                request->send(200, "text/plain", "WiFi settings saved successfully. Rebooting...");
-                delay(500);  // Give time for the response to be sent
-                ESP.restart();
+                request->send(200, "text/plain", "WiFi settings saved, reconnecting");
+                requestConfig(CONFIG_WIFI);
             } else {
                 request->send(500, "text/plain", "Failed to save WiFi settings");
             }
@@ -550,9 +875,8 @@ void handleWiFiSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len,
 
 void handleMQTTSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
     if (index == 0) {
-        String json = String((char*)data);
         StaticJsonDocument<200> doc;
-        DeserializationError error = deserializeJson(doc, json);
+        DeserializationError error = deserializeJson(doc, (const char*)data, len);
         
         if (!error) {
             // Clear old settings in EEPROM
@@ -561,20 +885,20 @@ void handleMQTTSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len,
             }
             
             // Store new settings
-            String newHost = doc["host"].as<String>();
+            FixedString<63> newHost(doc["host"] | "");
             uint16_t newPort = doc["port"] | DEFAULT_MQTT_PORT;
-            String newUser = doc["user"].as<String>();
-            String newPass = doc["password"].as<String>();
+            FixedString<31> newUser(doc["user"] | "");
+            FixedString<31> newPass(doc["password"] | "");
             
             // Validate host is not empty
-            if (newHost.length() == 0) {
+            if (newHost.empty()) {
                 request->send(400, "text/plain", "MQTT host cannot be empty");
                 return;
             }
             
             // Write host
             for (size_t i = 0; i < newHost.length(); i++) {
-                EEPROM.write(MQTT_HOST_ADDR + i, newHost[i]);
+                EEPROM.write(MQTT_HOST_ADDR + i, newHost.c_str()[i]);
             }
             
             // Write port
@@ -583,18 +907,17 @@ void handleMQTTSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len,
             
             // Write username
             for (size_t i = 0; i < newUser.length(); i++) {
-                EEPROM.write(MQTT_USER_ADDR + i, newUser[i]);
+                EEPROM.write(MQTT_USER_ADDR + i, newUser.c_str()[i]);
             }
             
             // Write password
             for (size_t i = 0; i < newPass.length(); i++) {
-                EEPROM.write(MQTT_PASS_ADDR + i, newPass[i]);
+                EEPROM.write(MQTT_PASS_ADDR + i, newPass.c_str()[i]);
             }
             
             if (EEPROM.commit()) {
-                request->send(200, "text/plain", "MQTT settings saved successfully. Rebooting...");
-                delay(500);  // Give time for the response to be sent
-                ESP.restart();
+                request->send(200, "text/plain", "MQTT settings saved, reconnecting to the broker");
+                requestConfig(CONFIG_MQTT);
             } else {
                 request->send(500, "text/plain", "Failed to save MQTT settings");
             }
@@ -607,28 +930,30 @@ void handleMQTTSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len,
 void handleGetSettings(AsyncWebServerRequest *request) {
     StaticJsonDocument<512> doc;
     JsonObject mqtt = doc.createNestedObject("mqtt");
-    mqtt["host"] = mqtt_host;
+    mqtt["host"] = mqtt_host.c_str();
     mqtt["port"] = mqtt_port;
-    mqtt["user"] = mqtt_user;
-    doc["hostname"] = hostname;
+    mqtt["user"] = mqtt_user.c_str();
+    FixedString<31> name = hostnameSnapshot();
+    doc["hostname"] = name.c_str();
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    char response[256];
+    sendJson(request, doc, response, sizeof(response));
 }
 
 void handleHostnameSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
     if (index == 0) {
-        String json = String((char*)data);
         StaticJsonDocument<200> doc;
-        DeserializationError error = deserializeJson(doc, json);
+        DeserializationError error = deserializeJson(doc, (const char*)data, len);
         
         if (!error) {
-            String newHostname = doc["hostname"].as<String>();
+            const char* newHostname = doc["hostname"] | "";
             
             // Validate hostname
-            if (newHostname.length() == 0 || newHostname.length() > 32) {
-                request->send(400, "text/plain", "Hostname must be between 1 and 32 characters");
+            if (strlen(newHostname) == 0 || strlen(newHostname) > hostname.capacity()) {
+                char message[64];
+                snprintf(message, sizeof(message), "Hostname must be between 1 and %u characters",
+                         (unsigned)hostname.capacity());
+                request->send(400, "text/plain", message);
                 return;
             }
             
@@ -638,31 +963,393 @@ void handleHostnameSetup(AsyncWebServerRequest *request, uint8_t *data, size_t l
             }
             
             // Write new hostname
-            for (size_t i = 0; i < newHostname.length(); i++) {
+            for (size_t i = 0; i < strlen(newHostname); i++) {
                 EEPROM.write(HOSTNAME_ADDR + i, newHostname[i]);
             }
             
             if (EEPROM.commit()) {
-                request->send(200, "text/plain", "Hostname saved successfully. Rebooting...");
+                request->send(200, "text/plain", "Hostname saved, rejoining WiFi");
+                requestConfig(CONFIG_HOSTNAME);
+            } else {
+                request->send(500, "text/plain", "Failed to save hostname");
+            }
+            return;
+        }
+    }
+    request->send(400, "text/plain", "Invalid request format");
+}
+
+void handleStripSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (index == 0) {
+        StaticJsonDocument<200> doc;
+        DeserializationError error = deserializeJson(doc, (const char*)data, len);
+        
+        if (!error) {
+            // Read wide, so 269 is rejected rather than narrowed to pin 13
+            int pin = doc["pin"] | -1;
+            if (pin < 0 || pin > UINT8_MAX) {
+                request->send(400, "text/plain", "Invalid pin");
+                return;
+            }
+            const StripTypes::Entry* entry = StripTypes::find(doc["chipset"] | "", doc["order"] | "", pin);
+            if (entry == nullptr) {
+                request->send(400, "text/plain", "Unsupported strip type, see /strips");
+                return;
+            }
+            
+            // FastLED cannot swap drivers at runtime, so the new strip takes effect on reboot
+            if (StripTypes::save(entry)) {
+                request->send(200, "text/plain", "Strip type saved successfully. Rebooting...");
                 delay(500);  // Give time for the response to be sent
                 ESP.restart();
             } else {
-                request->send(500, "text/plain", "Failed to save hostname");
+                request->send(500, "text/plain", "Failed to save strip type");
+            }
+            return;
+        }
+    }
+    request->send(400, "text/plain", "Invalid request format");
+}
+
+void handleGetStrips(AsyncWebServerRequest *request) {
+    StaticJsonDocument<JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(StripTypes::COUNT) +
+                       StripTypes::COUNT * JSON_OBJECT_SIZE(3)> doc;
+    JsonObject current = doc.createNestedObject("current");
+    current["chipset"] = strip->chipset;
+    current["order"] = strip->order;
+    current["pin"] = strip->pin;
+    
+    JsonArray supported = doc.createNestedArray("supported");
+    int count;
+    const StripTypes::Entry* entries = StripTypes::table(count);
+    for (int i = 0; i < count; i++) {
+        JsonObject entry = supported.createNestedObject();
+        entry["chipset"] = entries[i].chipset;
+        entry["order"] = entries[i].order;
+        entry["pin"] = entries[i].pin;
+    }
+    
+    char response[1536];
+    sendJson(request, doc, response, sizeof(response));
+}
+
+void handleFanoutSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (index == 0) {
+        StaticJsonDocument<768> doc;
+        DeserializationError error = deserializeJson(doc, (const char*)data, len);
+        
+        if (!error) {
+            FrameFanout::Stored stored;
+            memset(&stored, 0, sizeof(stored));
+            stored.magic = FANOUT_MAGIC;
+            const char* role = doc["role"] | "off";
+            if (strcmp(role, "leader") == 0) {
+                stored.role = FrameFanout::LEADER;
+            } else if (strcmp(role, "follower") == 0) {
+                stored.role = FrameFanout::FOLLOWER;
+            } else {
+                stored.role = FrameFanout::OFF;
+            }
+            
+            JsonArray followers = doc["followers"];
+            bool valid = stored.role != FrameFanout::LEADER || followers.size() <= FANOUT_MAX_FOLLOWERS;
+            if (stored.role == FrameFanout::LEADER) {
+                for (JsonObject follower : followers) {
+                    if (!valid) break;
+                    FrameFanout::Target& target = stored.targets[stored.targetCount++];
+                    IPAddress ip;
+                    valid = ip.fromString(follower["ip"] | "");
+                    for (int i = 0; i < 4; i++) target.ip[i] = ip[i];
+                    target.start = follower["start"] | 0;
+                    target.count = follower["count"] | 0;
+                }
             }
+            if (!valid || !FrameFanout::valid(stored)) {
+                request->send(400, "text/plain", "Invalid followers; each needs ip, start and count within the logical strip");
+                return;
+            }
+            
+            if (FrameFanout::save(stored)) {
+                request->send(200, "text/plain", "Fan-out saved successfully. Rebooting...");
+                delay(500);  // Give time for the response to be sent
+                ESP.restart();
+            } else {
+                request->send(500, "text/plain", "Failed to save fan-out settings");
+            }
+            return;
+        }
+    }
+    request->send(400, "text/plain", "Invalid request format");
+}
+
+void handleGetFanout(AsyncWebServerRequest *request) {
+    DynamicJsonDocument doc(2048);
+    const FrameFanout::Stored& settings = fanout.settings();
+    static const char* roles[] = { "off", "leader", "follower" };
+    doc["role"] = roles[settings.role];
+    doc["logical_leds"] = LOGICAL_LEDS;
+    doc["local_leds"] = NUM_LEDS;
+    doc["following"] = fanout.following(millis());
+    
+    uint32_t now = millis();
+    JsonArray followers = doc.createNestedArray("followers");
+    for (int i = 0; i < settings.targetCount; i++) {
+        const FrameFanout::Target& target = settings.targets[i];
+        const FrameFanout::Link& link = fanout.link(i);
+        JsonObject follower = followers.createNestedObject();
+        char ip[16];
+        snprintf(ip, sizeof(ip), "%u.%u.%u.%u", target.ip[0], target.ip[1], target.ip[2], target.ip[3]);
+        follower["ip"] = ip;
+        follower["start"] = target.start;
+        follower["count"] = target.count;
+        follower["frames_sent"] = link.frames;
+        follower["bytes_per_second"] = link.bytesPerSecond;
+        
+        // The rest is the follower's own view, from its last status report
+        if (link.statusAt == 0) continue;
+        const DDP::Status& status = link.status;
+        uint32_t expected = status.packets + status.lost;
+        follower["status_age_ms"] = now - link.statusAt;
+        follower["frames_received"] = status.frames;
+        follower["frames_incomplete"] = status.incomplete;
+        follower["frames_late"] = status.late;
+        follower["packet_loss"] = expected ? (float)status.lost / expected : 0.0f;
+        follower["latency_us"] = status.latencyUs;
+        follower["latency_max_us"] = status.latencyMaxUs;
+    }
+    
+    char response[1536];
+    sendJson(request, doc, response, sizeof(response));
+}
+
+void handleSceneSetup(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (index == 0) {
+        StaticJsonDocument<512> doc;
+        DeserializationError error = deserializeJson(doc, (const char*)data, len);
+        
+        if (!error && doc.containsKey("layers")) {
+            Compositor::LayerConfig configs[Compositor::MAX_LAYERS];
+            int count = 0;
+            
+            for (JsonObject layer : doc["layers"].as<JsonArray>()) {
+                if (count >= Compositor::MAX_LAYERS) break;
+                Compositor::LayerConfig& config = configs[count++];
+                const char* effect = layer["effect"] | "";
+                if (Effects::find(effect) == nullptr || strlen(effect) >= sizeof(config.effect)) {
+                    request->send(400, "text/plain", "Unknown layer effect");
+                    return;
+                }
+                const char* segment = layer["segment"] | "all";
+                if (!compositor.hasSegment(segment)) {
+                    request->send(400, "text/plain", "Unknown layer segment");
+                    return;
+                }
+                const char* blend = layer["blend"] | "normal";
+                if (strcmp(blend, "normal") != 0 && strcmp(blend, "add") != 0) {
+                    request->send(400, "text/plain", "Layer blend must be normal or add");
+                    return;
+                }
+                int opacity = layer["opacity"] | 255;
+                if (opacity < 0 || opacity > 255) {
+                    request->send(400, "text/plain", "Layer opacity must be 0-255");
+                    return;
+                }
+                
+                strcpy(config.effect, effect);
+                strcpy(config.segment, segment);   // Segment names fit, or hasSegment would have failed
+                config.blend = strcmp(blend, "add") == 0 ? BlendMode::ADD : BlendMode::NORMAL;
+                config.opacity = opacity;
+            }
+            
+            compositor.setLayers(configs, count);
+            request->send(200, "text/plain", "OK");
             return;
         }
     }
     request->send(400, "text/plain", "Invalid request format");
 }
 
+void handleGetScene(AsyncWebServerRequest *request) {
+    StaticJsonDocument<512> doc;
+    JsonArray layers = doc.createNestedArray("layers");
+    for (int i = 0; i < compositor.getNumLayers(); i++) {
+        JsonObject layer = layers.createNestedObject();
+        layer["effect"] = compositor.layerEffect(i);
+        layer["segment"] = compositor.layerSegment(i);
+        layer["blend"] = compositor.layerBlend(i) == BlendMode::ADD ? "add" : "normal";
+        layer["opacity"] = compositor.layerOpacity(i);
+    }
+    
+    char response[512];
+    sendJson(request, doc, response, sizeof(response));
+}
+
+// One clip upload, kept in the request so an abandoned one can be cleaned up when it disconnects
+struct ClipUpload {
+    File file;
+    bool finished;   // Installed or rejected; nothing left to clean up
+    char name[ClipPlayer::NAME_LENGTH];
+};
+
+void handleClipUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
+    char tempPath[48];
+    ClipPlayer::uploadPath(tempPath, sizeof(tempPath));
+    
+    if (!index) {
+        if (!request->hasParam("name") || !ClipPlayer::validName(request->getParam("name")->value().c_str())) {
+            return request->send(400, "text/plain", "Invalid clip name");
+        }
+        if (!ClipPlayer::beginUpload()) {
+            return request->send(409, "text/plain", "Another clip upload is in progress");
+        }
+        File file = LittleFS.open(tempPath, FILE_WRITE);
+        if (!file) {
+            ClipPlayer::abandonUpload();
+            return request->send(500, "text/plain", "Failed to open clip file");
+        }
+        
+        // The server releases _tempObject with free(), so the File is destroyed by hand on disconnect
+        ClipUpload* upload = new (malloc(sizeof(ClipUpload))) ClipUpload();
+        upload->file = file;
+        upload->finished = false;
+        strcpy(upload->name, request->getParam("name")->value().c_str());
+        request->_tempObject = upload;
+        request->onDisconnect([request]() {
+            ClipUpload* upload = (ClipUpload*)request->_tempObject;
+            if (!upload->finished) {
+                char tempPath[48];
+                upload->file.close();
+                LittleFS.remove(ClipPlayer::uploadPath(tempPath, sizeof(tempPath)));
+                ClipPlayer::abandonUpload();
+                Serial.printf("Clip upload abandoned: %s\n", upload->name);
+            }
+            upload->~ClipUpload();
+        });
+        Serial.printf("Clip upload started: %s\n", upload->name);
+    }
+    
+    ClipUpload* upload = (ClipUpload*)request->_tempObject;
+    if (upload == nullptr || upload->finished) return;   // Upload already rejected
+    if (upload->file.write(data, len) != len) {
+        upload->file.close();
+        LittleFS.remove(tempPath);
+        upload->finished = true;
+        ClipPlayer::abandonUpload();
+        return request->send(507, "text/plain", "Not enough space for clip");
+    }
+    
+    if (final) {
+        upload->file.close();
+        upload->finished = true;
+        
+        // Only keep clips this strip can play
+        File check = LittleFS.open(tempPath, FILE_READ);
+        ClipPlayer::Header header;
+        bool valid = check && ClipPlayer::readHeader(check, header, LOGICAL_LEDS);
+        check.close();
+        if (!valid) {
+            LittleFS.remove(tempPath);
+            ClipPlayer::abandonUpload();
+            return request->send(400, "text/plain", "Not a clip for this strip");
+        }
+        
+        // Swapped in by the loop, which first closes the clip if it is playing
+        ClipPlayer::finishUpload(upload->name);
+        Serial.printf("Clip upload complete: %s, %u frames\n", upload->name, header.frameCount);
+        request->send(200, "text/plain", "Clip uploaded");
+    }
+}
+
+void handleGetClips(AsyncWebServerRequest *request) {
+    DynamicJsonDocument doc(1024);
+    doc["selected"] = ClipPlayer::selected();
+    doc["free_bytes"] = LittleFS.totalBytes() - LittleFS.usedBytes();
+    JsonArray clips = doc.createNestedArray("clips");
+    
+    File dir = LittleFS.open(CLIP_DIRECTORY);
+    if (dir && dir.isDirectory()) {
+        for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+            const char* name = entry.name();
+            const char* ext = strrchr(name, '.');
+            ClipPlayer::Header header;
+            if (!ext || strcmp(ext, ".clp") != 0 || ext - name >= ClipPlayer::NAME_LENGTH ||
+                !ClipPlayer::readHeader(entry, header, LOGICAL_LEDS)) continue;
+            
+            JsonObject clip = clips.createNestedObject();
+            char clipName[ClipPlayer::NAME_LENGTH];
+            memcpy(clipName, name, ext - name);   // Drop ".clp"
+            clipName[ext - name] = '\0';
+            clip["name"] = clipName;   // Non-const, so the document keeps a copy
+            clip["frames"] = header.frameCount;
+            clip["frame_ms"] = header.frameMs;
+            clip["loop"] = (header.flags & ClipPlayer::FLAG_LOOP) != 0;
+            clip["bytes"] = entry.size();
+        }
+    }
+    
+    char response[1024];
+    sendJson(request, doc, response, sizeof(response));
+}
+
+void handleProgramUpload(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    static uint8_t program[EffectVM::MAX_IMAGE];
+    
+    if (total > EffectVM::MAX_IMAGE) {
+        if (index == 0) request->send(413, "text/plain", "Program too large");
+        return;
+    }
+    memcpy(program + index, data, len);
+    if (index + len < total) return;   // Wait for the rest of the body
+    
+    const char* error;
+    if (!EffectVM::load(program, total, error)) {
+        char message[64];
+        snprintf(message, sizeof(message), "Program rejected: %s", error);
+        request->send(400, "text/plain", message);
+        return;
+    }
+    
+    // Keep it for the next boot
+    File file = LittleFS.open(VM_PROGRAM_PATH, FILE_WRITE);
+    if (file) {
+        file.write(program, total);
+        file.close();
+    }
+    Serial.printf("Effect program loaded: %u bytes\n", total);
+    request->send(200, "text/plain", "OK");
+}
+
+void handleGetProgram(AsyncWebServerRequest *request) {
+    StaticJsonDocument<64> doc;
+    doc["loaded"] = EffectVM::loadedSize() > 0;
+    doc["bytes"] = EffectVM::loadedSize();
+    
+    char response[96];
+    sendJson(request, doc, response, sizeof(response));
+}
+
+void loadProgram() {
+    File file = LittleFS.open(VM_PROGRAM_PATH, FILE_READ);
+    if (!file) return;
+    
+    uint8_t program[EffectVM::MAX_IMAGE];
+    int size = file.read(program, sizeof(program));
+    file.close();
+    
+    const char* error;
+    if (!EffectVM::load(program, size, error)) {
+        Serial.printf("Saved effect program rejected: %s\n", error);
+    }
+}
+
 void handleWiFiConfig(AsyncWebServerRequest *request) {
     if (request->hasParam("ssid", true) && request->hasParam("password", true)) {
         char ssid[32] = {0};
         char password[64] = {0};
         
         // Get the new credentials
-        String newSSID = request->getParam("ssid", true)->value();
-        String newPassword = request->getParam("password", true)->value();
+        const String& newSSID = request->getParam("ssid", true)->value();
+        const String& newPassword = request->getParam("password", true)->value();
         
         // Copy with length limits and ensure null termination
         strncpy(ssid, newSSID.c_str(), 31);
@@ -679,11 +1366,8 @@ void handleWiFiConfig(AsyncWebServerRequest *request) {
             Serial.printf("SSID: %s\n", ssid);
             // Don't print password for security
             
-            // Attempt to connect with new credentials
-            WiFi.disconnect();
-            delay(1000);
-            WiFi.begin(ssid, password);
-            wifiConnectionAttempts = 0;  // Reset attempt counter
+            // Connect with the new credentials from loop()
+            requestConfig(CONFIG_WIFI);
             
             request->send(200, "text/plain", "WiFi credentials updated");
         } else {
@@ -695,14 +1379,14 @@ void handleWiFiConfig(AsyncWebServerRequest *request) {
 }
 
 void loadMQTTSettings() {
-    mqtt_host = "";
-    mqtt_user = "";
-    mqtt_pass = "";
+    mqtt_host.clear();
+    mqtt_user.clear();
+    mqtt_pass.clear();
     
     // Read MQTT host
     for (int i = MQTT_HOST_ADDR; i < MQTT_HOST_ADDR + 64; i++) {
         char c = EEPROM.read(i);
-        if (c != 0) mqtt_host += c;
+        if (c != 0) mqtt_host.append(c);
     }
     
     // Read MQTT port
@@ -712,60 +1396,84 @@ void loadMQTTSettings() {
     // Read MQTT username
     for (int i = MQTT_USER_ADDR; i < MQTT_USER_ADDR + 32; i++) {
         char c = EEPROM.read(i);
-        if (c != 0) mqtt_user += c;
+        if (c != 0) mqtt_user.append(c);
     }
     
     // Read MQTT password
     for (int i = MQTT_PASS_ADDR; i < MQTT_PASS_ADDR + 32; i++) {
         char c = EEPROM.read(i);
-        if (c != 0) mqtt_pass += c;
+        if (c != 0) mqtt_pass.append(c);
     }
     
     // Use defaults if no values stored
-    if (mqtt_host.length() == 0) mqtt_host = DEFAULT_MQTT_HOST;
-    if (mqtt_user.length() == 0) mqtt_user = DEFAULT_MQTT_USER;
-    if (mqtt_pass.length() == 0) mqtt_pass = DEFAULT_MQTT_PASS;
+    if (mqtt_host.empty()) mqtt_host = DEFAULT_MQTT_HOST;
+    if (mqtt_user.empty()) mqtt_user = DEFAULT_MQTT_USER;
+    if (mqtt_pass.empty()) mqtt_pass = DEFAULT_MQTT_PASS;
 }
 
 void loadHostname() {
-    hostname = "";
+    // Built aside and swapped in, so web handlers never see it half written
+    FixedString<31> loaded;
     for (int i = HOSTNAME_ADDR; i < HOSTNAME_ADDR + 32; i++) {
         char c = EEPROM.read(i);
-        if (c != 0) hostname += c;
+        if (c != 0) loaded.append(c);
     }
     
-    if (hostname.length() == 0) {
-        hostname = DEFAULT_HOSTNAME;
+    if (loaded.empty()) {
+        loaded = DEFAULT_HOSTNAME;
     }
+    portENTER_CRITICAL(&hostnameLock);
+    hostname = loaded;
+    portEXIT_CRITICAL(&hostnameLock);
 }
 
-void applyEffect(String effect) {
-    if (effect == "solid") {
-        effects->solid(currentColor);
-    } else if (effect == "rainbow") {
-        effects->rainbow();
-    } else if (effect == "ripple") {
-        effects->ripple(currentColor);
-    } else if (effect == "twinkle") {
-        effects->twinkle(currentColor);
-    } else if (effect == "wave") {
-        effects->colorWave(currentColor);
+// Copy of the hostname for tasks other than loop()
+FixedString<31> hostnameSnapshot() {
+    portENTER_CRITICAL(&hostnameLock);
+    FixedString<31> name = hostname;
+    portEXIT_CRITICAL(&hostnameLock);
+    return name;
+}
+
+// The render loop picks up the new effect on its next frame
+void applyEffect(const char* effect) {
+    if (strcmp(effect, "scene") != 0 && Effects::find(effect) == nullptr) {
+        Serial.printf("Unknown effect: %s\n", effect);
+    } else if (strchr(effect, ':') && Palettes::fromEffect(effect) == 0) {
+        Serial.printf("Unknown palette: %s\n", effect);
+    }
+}
+
+// Store what a command changed and wake the strip for it; the state itself is taken over by lightControl
+void storeCommand(const LightCommand& light, bool saveNow) {
+    if (light.fields & LightCommand::BRIGHTNESS) {
+        settingsManager.setBrightness(brightness, saveNow);
     }
+    if (light.fields & LightCommand::COLOR) {
+        settingsManager.setColor(currentColor, saveNow);
+    }
+    if (light.fields & LightCommand::EFFECT) {
+        settingsManager.setEffect(currentEffect.c_str(), saveNow);
+        applyEffect(currentEffect.c_str());
+    }
+    
+    FastLED.setBrightness(brightness);
+    if (brightness > 0) idle.wake();
 }
 
 void setupMQTT() {
     Serial.println("Setting up MQTT...");
     Serial.print("MQTT Host: ");
-    Serial.println(mqtt_host);
+    Serial.println(mqtt_host.c_str());
     Serial.print("MQTT Port: ");
     Serial.println(mqtt_port);
     Serial.print("MQTT User: ");
-    Serial.println(mqtt_user);
+    Serial.println(mqtt_user.c_str());
     
     mqttClient.setServer(mqtt_host.c_str(), mqtt_port);
     
     // Set credentials if provided
-    if (strlen(mqtt_user.c_str()) > 0) {
+    if (!mqtt_user.empty()) {
         Serial.println("Using MQTT authentication");
         mqttClient.setCredentials(mqtt_user.c_str(), mqtt_pass.c_str());
     } else {
@@ -774,83 +1482,198 @@ void setupMQTT() {
     
     mqttClient.onConnect(onMqttConnect);
     mqttClient.onDisconnect(onMqttDisconnect);
+    mqttSession.begin(onMqttReady);
     
     mqttClient.onMessage([](char* topic, char* payload, 
         AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
         
-        String message = String(payload);
-        StaticJsonDocument<200> doc;
-        DeserializationError error = deserializeJson(doc, message);
+        uint16_t command = TRACE_COMMAND("mqtt");
+        TRACE_SCOPE("mqtt_message", command);
         
-        if (!error) {
-            bool stateChanged = false;
-            
-            if (doc.containsKey("state")) {
-                String state = doc["state"].as<String>();
-                if (state == "ON") {
-                    if (doc.containsKey("brightness")) {
-                        brightness = doc["brightness"].as<int>();
-                        settingsManager.setBrightness(brightness);
-                        stateChanged = true;
-                    }
-                } else {
-                    brightness = 0;
-                    settingsManager.setBrightness(brightness);
-                    stateChanged = true;
-                }
+        // The payload is not NUL-terminated; parse it in place
+        LightCommand light;
+        bool parsed;
+        {
+            TRACE_SCOPE("json_parse", command);
+            parsed = light.parseJson(payload, len);
+        }
+        if (parsed) {
+            lightControl.apply(light, false);
+        }
+    });
+}
+
+// Follower: show the leader's frames at their timestamps instead of rendering
+void presentFollowed() {
+    int32_t due = fanout.dueInUs();
+    if (due < 0 || due >= 2000) {
+        delay(1);
+        return;
+    }
+    delayMicroseconds(due);
+    uint8_t level;
+    if (fanout.present(leds, NUM_LEDS, level)) {
+        // Pixels arrive at full scale: brightness goes through our own limiter and dithering
+        power.update(0, NUM_LEDS);
+        output.show(power.limit(level));
+        
+        // Redraw from scratch once the leader goes quiet
+        activeEffect = nullptr;
+        compositor.invalidate();
+    }
+}
+
+void loop() {
+    uint32_t frameStart = millis();
+    int64_t frameStartUs = NetClock::micros();
+    wifi.update(frameStart);
+    mqttSession.update(frameStart, wifi.connected());
+    applyConfigChanges(frameStart);
+    ClipPlayer::service();
+    netClock.update(wifi.connected());
+    fanout.update(frameStart, wifi.connected());
+    if (fanout.following(frameStart)) {
+        presentFollowed();
+        return;
+    }
+    if (idle.parked()) {
+        if (brightness == 0) {
+            // Off: keep followers dark and sleep until a command or the next network poll
+            if (fanout.leading()) {
+                fanout.send(leds, 0, 0, 0, NetClock::micros() + FANOUT_PRESENT_DELAY_MS * 1000, frameStart);
             }
-            
-            if (doc.containsKey("brightness") && !doc.containsKey("state")) {
-                brightness = doc["brightness"].as<int>();
-                settingsManager.setBrightness(brightness);
-                stateChanged = true;
+            idle.wait(IDLE_POLL_MS);
+            return;
+        }
+        idle.resume(frameStart);
+        output.park(false);
+    }
+    if (selfBenchmark.running()) {
+        // The benchmark takes over the strip one frame at a time, then the selected effect starts afresh
+        if (selfBenchmark.step(*effects, presenter, output, power, currentColor, brightness)) {
+            activeEffect = nullptr;
+            compositor.invalidate();
+        }
+        if (fanout.leading()) {
+            // Keepalives only, so followers don't time out and streaming adds little to the measurement
+            fanout.send(leds, 0, 0, brightness, NetClock::micros() + FANOUT_PRESENT_DELAY_MS * 1000, frameStart);
+        }
+        return;
+    }
+    // Effect to render, or nullptr for the scene
+    const EffectInfo* effect = nullptr;
+    if (currentEffect != "scene") {
+        effect = Effects::find(currentEffect.c_str());
+        if (effect == nullptr) {
+            delay(20);
+            return;
+        }
+    }
+    
+    // Only now is this frame certain to be shown, so a waiting command's slice ends with it
+    uint16_t command = TRACE_TAKE_COMMAND();   // First frame to show a command that just arrived
+    uint32_t allocationsBefore = AllocCounter::count();
+    uint16_t frameMs;
+    int changedStart, changedEnd;   // LEDs that changed this frame
+    
+    {
+        TRACE_SCOPE("render", command);
+        if (effect == nullptr) {
+            // Layered scene: the compositor draws straight into the strip buffer.
+            // Switching to and from the scene is instant.
+            if (activeEffect != nullptr) {
+                compositor.invalidate();
+                activeEffect = nullptr;
             }
-            
-            if (doc.containsKey("color")) {
-                JsonObject color = doc["color"];
-                if (color.containsKey("r") && color.containsKey("g") && color.containsKey("b")) {
-                    currentColor.r = color["r"].as<int>();
-                    currentColor.g = color["g"].as<int>();
-                    currentColor.b = color["b"].as<int>();
-                    settingsManager.setColor(currentColor);
-                    stateChanged = true;
+            compositor.render(currentColor, frameStart);
+            compositor.dirtyRange(changedStart, changedEnd);
+            frameMs = compositor.frameMs();
+        } else {
+            if (effect != activeEffect) {
+                // Fade out of the previous effect, or redraw from scratch after the scene
+                if (activeEffect != nullptr) {
+                    transition.start(activeEffect, effects->palette(), frameStart);
+                } else {
+                    effects->invalidate();
                 }
+                effects->start(effect);
+                interpolator.reset();
+                activeEffect = effect;
             }
-            
-            if (doc.containsKey("effect")) {
-                currentEffect = doc["effect"].as<String>();
-                settingsManager.setEffect(currentEffect.c_str());
-                stateChanged = true;
-            }
-            
-            if (stateChanged) {
-                FastLED.setBrightness(brightness);
-                if (currentEffect == "solid") {
-                    fill_solid(leds, NUM_LEDS, currentColor);
+            // A palette change on the same effect takes over on the next frame
+            effects->setPalette(Palettes::fromEffect(currentEffect.c_str()));
+        
+            // Render the current effect and blend in the outgoing one while fading
+            if (effect->interpolate) {
+                // Keyframes on the effect's network tick, blended up to the output rate
+                int size = effects->outputSize(effect);
+                uint32_t netMs = NetClock::millis();
+                if (interpolator.due(netMs, effect->frameMs)) {
+                    effects->render(effect, currentColor);
+                    interpolator.keyframe(effects->output(effect), size, netMs, effect->frameMs);
                 }
-                FastLED.show();
-                
-                // Publish the current state back to Home Assistant
-                publishState();
+                changedStart = 0;
+                changedEnd = size;
+                presenter.stripRange(effect->upscale, changedStart, changedEnd);
+                presenter.upscale(interpolator.frame(netMs), size, effect->upscale);
+                frameMs = INTERPOLATED_FRAME_MS;
+            } else {
+                effects->render(effect, currentColor);
+                effects->dirtyRange(changedStart, changedEnd);
+                presenter.stripRange(effect->upscale, changedStart, changedEnd);
+                presenter.upscale(effects->output(effect), effects->outputSize(effect), effect->upscale);
+                frameMs = effect->frameMs;
+            }
+            if (transition.apply(*effects, currentColor, frameStart)) {
+                changedStart = 0;
+                changedEnd = LOGICAL_LEDS;
             }
         }
-    });
-}
-
-void loop() {
-    // Update LED animations based on current effect
-    if (currentEffect == "solid") {
-        effects->solid(currentColor);
-    } else if (currentEffect == "rainbow") {
-        effects->rainbow();
-    } else if (currentEffect == "ripple") {
-        effects->ripple(currentColor);
-    } else if (currentEffect == "twinkle") {
-        effects->twinkle(currentColor);
-    } else if (currentEffect == "wave") {
-        effects->colorWave(currentColor);
-    }
-    
-    FastLED.show();
-    delay(20);
+    }
+    
+    // Brightness, or the fade to black once the light is turned off
+    uint8_t level = idle.level(brightness, frameStart);
+    
+    // Stream the followers' slices; our own part goes on the wire at the moment
+    // they show theirs, while the next frame renders
+    if (fanout.leading()) {
+        int64_t presentUs = NetClock::micros() + FANOUT_PRESENT_DELAY_MS * 1000;
+        fanout.send(leds, changedStart, changedEnd, level, presentUs, frameStart);
+        output.schedule(micros() + (uint32_t)(presentUs - NetClock::micros()));
+    }
+    if (changedEnd > NUM_LEDS) changedEnd = NUM_LEDS;
+    
+    // Keep the estimated draw inside the supply budget, then send the frame
+    power.update(changedStart, changedEnd);
+    {
+        TRACE_SCOPE("show", command);   // Includes waiting for the previous frame to leave
+        output.show(power.limit(level), changedStart, changedEnd);
+    }
+    TRACE_END_COMMAND(command);
+    idle.frameShown();
+    frameAllocations = AllocCounter::count() - allocationsBefore;
+    
+    // That was the final black frame: stop rendering until the light comes back on
+    if (idle.faded(frameStart)) {
+        output.flush();
+        output.park(true);
+        idle.park(frameStart);
+        return;
+    }
+    
+    if (mqttSession.connected() && frameStart - lastPowerReport >= POWER_REPORT_MS) {
+        publishPower();
+        lastPowerReport = frameStart;
+    }
+    
+    // Hold the frame rate; when synced, start the next frame on a network clock
+    // boundary so every controller renders the same instant
+    uint32_t elapsed = millis() - frameStart;
+    if (netClock.synced()) {
+        uint32_t wait = NetClock::untilNextBoundary(frameStartUs, frameMs);
+        delay(wait / 1000);
+        delayMicroseconds(wait % 1000);
+    } else if (elapsed < frameMs) {
+        delay(frameMs - elapsed);
+    }
 }
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Encode prerendered LED frames into a .clp clip for the controller.
+
+Input is raw RGB24: every frame is NUM_LEDS * 3 bytes in strip order, frames
+back to back, which is what the offline renderer writes (or e.g.
+`ffmpeg -i show.mp4 -vf scale=120:1 -pix_fmt rgb24 -f rawvideo show.rgb`).
+
+    tools/clip_encoder.py show.rgb show.clp --leds 120 --fps 30 --loop
+    curl -F "file=@show.clp" "http://led-planter.local/clips?name=show"
+    curl "http://led-planter.local/clip?name=show"
+
+The format is described in include/clip_player.h.
+"""
+import argparse
+import struct
+import sys
+
+VERSION = 1
+FLAG_LOOP = 0x01
+OP_SKIP = 0x00
+OP_RUN = 0x40
+OP_LITERAL = 0x80
+MAX_COUNT = 64
+
+
+def pixels(frame):
+    return [frame[i:i + 3] for i in range(0, len(frame), 3)]
+
+
+def encode_frame(current, previous):
+    """Ops turning `previous` into `current`; previous=None encodes a keyframe."""
+    out = bytearray()
+    n = len(current)
+    i = 0
+    while i < n:
+        if previous is not None and current[i] == previous[i]:
+            j = i
+            while j < n and j - i < MAX_COUNT and current[j] == previous[j]:
+                j += 1
+            out.append(OP_SKIP | (j - i - 1))
+            i = j
+            continue
+
+        j = i
+        while j < n and j - i < MAX_COUNT and current[j] == current[i]:
+            j += 1
+        if j - i >= 2:
+            out.append(OP_RUN | (j - i - 1))
+            out += current[i]
+            i = j
+            continue
+
+        # Literal until the next unchanged pixel or run of two
+        j = i + 1
+        while j < n and j - i < MAX_COUNT:
+            if previous is not None and current[j] == previous[j]:
+                break
+            if j + 1 < n and current[j] == current[j + 1]:
+                break
+            j += 1
+        out.append(OP_LITERAL | (j - i - 1))
+        for pixel in current[i:j]:
+            out += pixel
+        i = j
+
+    if len(out) > 0xFFFF:
+        raise ValueError("frame too large to encode")
+    return struct.pack("<H", len(out)) + out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="raw RGB24 frames")
+    parser.add_argument("output", help="clip file to write")
+    parser.add_argument("--leds", type=int, required=True, help="LEDs per frame (must match NUM_LEDS)")
+    parser.add_argument("--fps", type=float, default=30.0, help="playback frame rate")
+    parser.add_argument("--loop", action="store_true", help="loop by default")
+    args = parser.parse_args()
+
+    frame_bytes = args.leds * 3
+    with open(args.input, "rb") as f:
+        data = f.read()
+    if len(data) == 0 or len(data) % frame_bytes:
+        sys.exit(f"{args.input}: size is not a whole number of {args.leds}-LED frames")
+    frame_count = len(data) // frame_bytes
+    if frame_count > 0xFFFF:
+        sys.exit("too many frames for one clip")
+
+    frame_ms = max(1, round(1000 / args.fps))
+    header = struct.pack("<4sBBHHH", b"LCLP", VERSION, FLAG_LOOP if args.loop else 0,
+                         args.leds, frame_count, frame_ms)
+
+    body = bytearray()
+    previous = None
+    for index in range(frame_count):
+        current = pixels(data[index * frame_bytes:(index + 1) * frame_bytes])
+        body += encode_frame(current, previous)
+        previous = current
+
+    with open(args.output, "wb") as f:
+        f.write(header)
+        f.write(body)
+
+    print(f"{frame_count} frames at {frame_ms} ms: {len(data)} bytes raw, "
+          f"{len(header) + len(body)} bytes encoded")
+
+
+if __name__ == "__main__":
+    main()
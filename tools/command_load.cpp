@@ -0,0 +1,292 @@
+// Replays Home Assistant style traffic through the controller's command path
+// on the host: the same parsing and state encoding (include/light_command.h),
+// applying and publishing (include/light_control.h) and MQTT publish queue
+// (include/mqtt_session.h) as the firmware, with stubs
+// from tools/host for the Arduino core and AsyncMqttClient. A network thread
+// handles each command when it arrives, like the AsyncTCP task, and a render
+// loop picks up the result at 60 fps, like loop() in main.cpp.
+//
+// The traffic repeats a ten second pattern: a scene change, a color wheel
+// drag, a brightness slider drag, automation bursts, off and on, and a few
+// web UI requests. speedup compresses it to stress the path; the send
+// buffer limits what the MQTT client takes per frame, as a slow link would.
+//
+// Reports commands per second, handler time, the latency from arrival to
+// the first frame showing a command, commands coalesced into a frame with a
+// later one, state updates replaced or dropped in the publish queue, and the
+// heap the command path allocates: parsing, applying, encoding the MQTT
+// state and the web UI's state reply. Allocations are counted at malloc,
+// calloc and realloc, so ArduinoJson's and the C library's count as well as
+// new. Exits non-zero if the command path allocates at all, if a reply did
+// not fit its buffer, or if the 99th percentile latency exceeds two frames.
+//
+// Built by the native PlatformIO environment, which fetches ArduinoJson:
+//
+//     pio run -e native
+//     .pio/build/native/program [seconds] [speedup] [send buffer bytes per frame]
+//
+// or by hand against any ArduinoJson 6 checkout:
+//
+//     g++ -O2 -std=c++17 -pthread -Itools/host -Iinclude -I<ArduinoJson>/src tools/command_load.cpp -o command_load
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "light_command.h"
+#include "light_control.h"
+
+static const int64_t FRAME_US = 16667;
+
+static int64_t nowUs() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Heap use of the command path: allocations made while a handler runs.
+// glibc's own entry points do the work; new goes through malloc.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+static thread_local bool inCommandPath = false;
+static std::atomic<uint32_t> pathAllocations(0);
+static std::atomic<uint64_t> pathBytes(0);
+
+static void recordAllocation(size_t size) {
+    if (!inCommandPath) return;
+    pathAllocations++;
+    pathBytes += size;
+}
+
+extern "C" void* malloc(size_t size) {
+    recordAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    recordAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    recordAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+// One command as it reaches the controller
+struct Command {
+    int64_t at;          // Arrival, microseconds from the start
+    bool http;
+    char path;           // HTTP: 'b'rightness, 'c'olor, 'e'ffect or 's'tate poll
+    char payload[160];   // MQTT JSON, or the HTTP parameter value
+};
+
+// path 0 for MQTT
+static void add(std::vector<Command>& out, int64_t at, char path, const char* value) {
+    Command command = {};
+    command.at = at;
+    command.http = path != 0;
+    command.path = path;
+    snprintf(command.payload, sizeof(command.payload), "%s", value);
+    out.push_back(command);
+}
+
+static void mqtt(std::vector<Command>& out, int64_t at, const char* payload) {
+    add(out, at, 0, payload);
+}
+
+static void http(std::vector<Command>& out, int64_t at, char path, const char* value) {
+    add(out, at, path, value);
+}
+
+// Ten seconds of traffic starting at t
+static void pattern(std::vector<Command>& out, int64_t t) {
+    static const char* effects[] = { "rainbow", "wave", "ripple", "water" };
+    const int64_t S = 1000000;
+    char json[160];
+
+    // Scene: everything in one message
+    snprintf(json, sizeof(json),
+             "{\"state\":\"ON\",\"brightness\":%d,\"color\":{\"r\":255,\"g\":%d,\"b\":%d},\"effect\":\"%s\"}",
+             150 + rand() % 100, rand() % 256, rand() % 256, effects[rand() % 4]);
+    mqtt(out, t, json);
+
+    // Color wheel drag: a command every 50 ms for a second
+    for (int i = 0; i < 20; i++) {
+        snprintf(json, sizeof(json), "{\"state\":\"ON\",\"color\":{\"r\":%d,\"g\":%d,\"b\":%d}}", 255 - i * 12,
+                 i * 12, rand() % 64);
+        mqtt(out, t + S + i * 50000 + rand() % 5000, json);   // Sent as the pointer moves, not on a clock
+    }
+
+    // Automation burst: several automations firing on the same trigger
+    for (int i = 0; i < 8; i++) {
+        if (i % 4 == 3) {
+            snprintf(json, sizeof(json), "{\"effect\":\"%s\"}", effects[rand() % 4]);
+        } else {
+            snprintf(json, sizeof(json), "{\"state\":\"ON\",\"brightness\":%d}", 64 + rand() % 192);
+        }
+        mqtt(out, t + 3 * S + i * 200, json);
+    }
+
+    // Brightness slider drag
+    for (int i = 0; i < 12; i++) {
+        snprintf(json, sizeof(json), "{\"brightness\":%d}", 255 - i * 16);
+        mqtt(out, t + 4 * S + i * 50000 + rand() % 5000, json);
+    }
+
+    // Web UI
+    http(out, t + 5 * S, 'e', effects[rand() % 4]);
+    http(out, t + 5 * S + S / 2, 'c', "FF8800");
+    http(out, t + 6 * S, 'b', "180");
+    http(out, t + 6 * S + S / 4, 's', "");   // The page refreshing its controls
+
+    // Off and back on, then a burst of conflicting automations
+    mqtt(out, t + 7 * S, "{\"state\":\"OFF\"}");
+    mqtt(out, t + 8 * S, "{\"state\":\"ON\",\"brightness\":200}");
+    for (int i = 0; i < 8; i++) {
+        mqtt(out, t + 9 * S + i * 300, i % 2 ? "{\"state\":\"OFF\"}" : "{\"state\":\"ON\",\"brightness\":255}");
+    }
+}
+
+// The controller's state, written by the network thread through the same
+// LightControl as main.cpp; the render loop only counts what was applied
+static uint8_t brightness = 255;
+static CRGB color = CRGB::White;
+static FixedString<31> effect("water");
+
+static AsyncMqttClient mqttClient;
+static MQTTSession mqttSession(mqttClient);
+static LightControl lightControl(brightness, color, effect, mqttSession);   // No settings to store
+static uint32_t truncated = 0;   // Web replies that did not fit their buffer
+
+static int64_t percentile(std::vector<int64_t>& values, int p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * p / 100)];
+}
+
+int main(int argc, char** argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 30;
+    double speedup = argc > 2 ? atof(argv[2]) : 1.0;
+    long sendBuffer = argc > 3 ? atol(argv[3]) : -1;
+    if (seconds <= 0 || speedup <= 0) {
+        fprintf(stderr, "usage: %s [seconds] [speedup] [send buffer bytes per frame]\n", argv[0]);
+        return 2;
+    }
+
+    srand(1);
+    std::vector<Command> commands;
+    for (int64_t t = 0; t < (int64_t)(seconds * speedup) * 1000000; t += 10000000) {
+        pattern(commands, t);
+    }
+    std::stable_sort(commands.begin(), commands.end(),
+                     [](const Command& a, const Command& b) { return a.at < b.at; });
+    for (Command& c : commands) c.at = (int64_t)(c.at / speedup);
+    commands.erase(std::remove_if(commands.begin(), commands.end(),
+                                  [&](const Command& c) { return c.at >= seconds * 1000000LL; }),
+                   commands.end());
+    size_t count = commands.size();
+
+    std::vector<int64_t> arrived(count), handlerUs(count), latencyUs;
+    latencyUs.reserve(count);
+    std::atomic<size_t> applied(0);
+    std::atomic<bool> running(true);
+    uint32_t rejected = 0;
+    uint32_t stateQueued = 0;   // Commands that set something, each publishing the state once
+    uint32_t coalesced = 0;
+
+    mqttSession.begin(nullptr);
+    mqttSession.update(millis(), true);
+    mqttSession.onConnected();
+    mqttSession.update(millis(), true);
+    uint32_t publishedBefore = mqttClient.published;
+
+    int64_t start = nowUs();
+
+    // Network task: handles each command as it arrives, or at once when behind
+    std::thread network([&]() {
+        for (size_t i = 0; i < count; i++) {
+            const Command& c = commands[i];
+            int64_t wait = start + c.at - nowUs();
+            if (wait > 0) std::this_thread::sleep_for(std::chrono::microseconds(wait));
+            arrived[i] = start + c.at;
+
+            int64_t begin = nowUs();
+            inCommandPath = true;
+            LightCommand light;
+            if (c.http && c.path == 's') {
+                // handleGetState()
+                char response[256];
+                if (!LightCommand::encodeWebState(response, sizeof(response), brightness, color.r, color.g, color.b,
+                                                  effect.c_str())) {
+                    truncated++;
+                }
+            } else if (c.http) {
+                if (c.path == 'b') light.setBrightness(atoi(c.payload));
+                if (c.path == 'c') light.setColor(c.payload);
+                if (c.path == 'e') light.setEffect(c.payload);
+                if (lightControl.apply(light, true)) stateQueued++;
+            } else if (light.parseJson(c.payload, strlen(c.payload))) {
+                if (lightControl.apply(light, false)) stateQueued++;
+            } else {
+                rejected++;
+            }
+            inCommandPath = false;
+            handlerUs[i] = nowUs() - begin;
+            applied.store(i + 1, std::memory_order_release);
+        }
+    });
+
+    // Render loop: each frame shows every command applied since the last one
+    size_t shown = 0;
+    int64_t nextFrame = start + rand() % FRAME_US;   // Frames keep their own phase
+    while (running) {
+        size_t upTo = applied.load(std::memory_order_acquire);
+        int64_t frameAt = nowUs();
+        if (upTo > shown) {
+            for (size_t i = shown; i < upTo; i++) latencyUs.push_back(frameAt - arrived[i]);
+            coalesced += upTo - shown - 1;
+            shown = upTo;
+        }
+        mqttClient.sendBuffer = sendBuffer < 0 ? SIZE_MAX : (size_t)sendBuffer;
+        mqttSession.update(millis(), true);
+
+        if (shown == count) running = false;
+        nextFrame += FRAME_US;
+        int64_t wait = nextFrame - nowUs();
+        if (wait > 0) std::this_thread::sleep_for(std::chrono::microseconds(wait));
+    }
+    network.join();
+    double elapsed = (nowUs() - start) / 1e6;
+
+    // Let the queue drain, then count what never went out
+    mqttClient.sendBuffer = SIZE_MAX;
+    mqttSession.update(millis(), true);
+    truncated += lightControl.unpublished();
+    stateQueued -= lightControl.unpublished();
+    uint32_t statePublished = mqttClient.published - publishedBefore;
+    uint32_t replaced = stateQueued - statePublished - mqttSession.droppedUpdates();
+
+    int64_t latencyP99 = percentile(latencyUs, 99);
+    printf("%zu commands in %.1f s: %.1f commands/s (%.1fx Home Assistant pace)\n", count, elapsed, count / elapsed,
+           speedup);
+    printf("handler        p50 %6lld us, p99 %6lld us, max %6lld us\n", (long long)percentile(handlerUs, 50),
+           (long long)percentile(handlerUs, 99), (long long)percentile(handlerUs, 100));
+    printf("apply latency  p50 %6.1f ms, p99 %6.1f ms, max %6.1f ms (arrival to the first frame showing it)\n",
+           percentile(latencyUs, 50) / 1000.0, latencyP99 / 1000.0, percentile(latencyUs, 100) / 1000.0);
+    printf("coalesced      %u commands shown only together with a later one\n", coalesced);
+    printf("rejected       %u malformed payloads\n", rejected);
+    printf("state updates  %u queued, %u published, %u replaced by newer, %u dropped, %u refused by the client\n",
+           stateQueued, statePublished, replaced, mqttSession.droppedUpdates(), mqttClient.refused);
+    printf("heap           %u allocations in the command path, %llu bytes\n", pathAllocations.load(),
+           (unsigned long long)pathBytes.load());
+    printf("replies        %u did not fit their buffer\n", truncated);
+
+    bool pass = pathAllocations == 0 && truncated == 0 && latencyP99 <= 2 * FRAME_US;
+    return pass ? 0 : 1;
+}
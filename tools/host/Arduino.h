@@ -0,0 +1,264 @@
+#pragma once
+// Just enough of the Arduino core and FreeRTOS to build headers from include/
+// on the host (tools/command_load.cpp, tools/output_overlap.cpp). Not used by
+// the firmware.
+//
+// With HOST_SIMULATED_TIME defined the clock is simulated: it stands still
+// while any thread runs and, once every thread is blocked in delay() or on a
+// semaphore, jumps to the earliest wake-up. Code takes no time, only waits
+// do, so timing checks give the same result on every run and under any host
+// load.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::max;
+using std::min;
+
+#ifdef HOST_SIMULATED_TIME
+struct HostSemaphore;
+
+// A blocked thread, until its deadline passes or, if it waits on a semaphore, it is given one
+struct HostWaiter {
+    uint64_t deadline;
+    HostSemaphore* semaphore;
+    bool woken;
+    bool taken;
+};
+
+// The clock and the scheduler state behind it, all under one mutex
+struct HostClock {
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint64_t nowUs = 0;
+    int running = 1;   // Threads not blocked; the main thread to begin with
+    std::vector<HostWaiter*> waiters;
+};
+inline HostClock hostClock;
+static const uint64_t HOST_FOREVER = UINT64_MAX;
+
+// The waker counts the thread as running again, so the clock cannot move on before it gets to run
+inline void hostWake(HostWaiter* waiter, bool taken) {
+    waiter->woken = true;
+    waiter->taken = taken;
+    hostClock.running++;
+}
+
+// With every thread blocked, move the clock to the earliest deadline and wake what is due
+inline void hostAdvance() {
+    if (hostClock.running > 0) return;
+    uint64_t next = HOST_FOREVER;
+    for (HostWaiter* waiter : hostClock.waiters) {
+        if (!waiter->woken) next = min(next, waiter->deadline);
+    }
+    if (next == HOST_FOREVER) {
+        fprintf(stderr, "Simulated time: every thread is waiting forever\n");
+        abort();
+    }
+    hostClock.nowUs = next;
+    for (HostWaiter* waiter : hostClock.waiters) {
+        if (!waiter->woken && waiter->deadline <= next) hostWake(waiter, false);
+    }
+    hostClock.changed.notify_all();
+}
+
+// Block until deadline or until given semaphore; true if it was given. Caller holds the clock's mutex.
+inline bool hostBlock(std::unique_lock<std::mutex>& lock, uint64_t deadline, HostSemaphore* semaphore) {
+    HostWaiter waiter = { deadline, semaphore, false, false };
+    hostClock.waiters.push_back(&waiter);
+    hostClock.running--;
+    hostAdvance();
+    hostClock.changed.wait(lock, [&waiter] { return waiter.woken; });
+    hostClock.waiters.erase(std::find(hostClock.waiters.begin(), hostClock.waiters.end(), &waiter));
+    return waiter.taken;
+}
+
+inline uint32_t micros() {
+    std::lock_guard<std::mutex> lock(hostClock.mutex);
+    return (uint32_t)hostClock.nowUs;
+}
+
+inline uint32_t millis() {
+    std::lock_guard<std::mutex> lock(hostClock.mutex);
+    return (uint32_t)(hostClock.nowUs / 1000);
+}
+
+inline void delayMicroseconds(unsigned int us) {
+    std::unique_lock<std::mutex> lock(hostClock.mutex);
+    hostBlock(lock, hostClock.nowUs + us, nullptr);
+}
+
+inline void delay(unsigned long ms) {
+    delayMicroseconds(ms * 1000);
+}
+#else
+// 32-bit like the ESP32's, so differences wrap the same way
+inline uint32_t micros() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t millis() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void delayMicroseconds(unsigned int us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+#endif
+
+inline long random(long howBig) {
+    return howBig > 0 ? rand() % howBig : 0;
+}
+
+struct HostSerial {
+    template <typename... Args>
+    void printf(const char* format, Args... args) {
+        ::printf(format, args...);
+    }
+    void println(const char* text) {
+        puts(text);
+    }
+};
+inline HostSerial Serial;
+
+// Critical sections become a mutex
+struct portMUX_TYPE {
+    std::mutex mutex;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL(mux) (mux)->mutex.unlock()
+
+// FreeRTOS: ticks are milliseconds, as on the ESP32 Arduino core
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// Binary semaphore: one token, taken with an optional timeout
+struct HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool available = false;
+};
+typedef HostSemaphore* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return new HostSemaphore();
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+#ifdef HOST_SIMULATED_TIME
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(hostClock.mutex);
+    if (semaphore->available) {
+        semaphore->available = false;
+        return pdTRUE;
+    }
+    if (ticks == 0) return pdFALSE;
+    uint64_t deadline = ticks == portMAX_DELAY ? HOST_FOREVER : hostClock.nowUs + ticks * 1000ull;
+    return hostBlock(lock, deadline, semaphore) ? pdTRUE : pdFALSE;
+}
+
+// Straight to the longest waiting taker if there is one, as FreeRTOS does
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(hostClock.mutex);
+    if (semaphore->available) return pdFALSE;
+    for (HostWaiter* waiter : hostClock.waiters) {
+        if (!waiter->woken && waiter->semaphore == semaphore) {
+            hostWake(waiter, true);
+            hostClock.changed.notify_all();
+            return pdTRUE;
+        }
+    }
+    semaphore->available = true;
+    return pdTRUE;
+}
+#else
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    auto ready = [semaphore] { return semaphore->available; };
+    if (ticks == portMAX_DELAY) {
+        semaphore->changed.wait(lock, ready);
+    } else if (!semaphore->changed.wait_for(lock, std::chrono::milliseconds(ticks), ready)) {
+        return pdFALSE;
+    }
+    semaphore->available = false;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->available) return pdFALSE;
+    semaphore->available = true;
+    semaphore->changed.notify_one();
+    return pdTRUE;
+}
+#endif
+
+// Tasks are detached threads. Every task in include/ ends with
+// vTaskDelete(nullptr) as its last statement, so the thread simply returns.
+struct HostTask {
+    const char* name;
+};
+typedef HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+inline HostTask hostMainTask = { "main" };
+inline thread_local TaskHandle_t hostCurrentTask = &hostMainTask;
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t, void* arg, int,
+                                          TaskHandle_t* handle, int) {
+    TaskHandle_t task = new HostTask{ name };   // Kept for the life of the program, like a task control block
+    if (handle) *handle = task;
+#ifdef HOST_SIMULATED_TIME
+    {
+        std::lock_guard<std::mutex> lock(hostClock.mutex);
+        hostClock.running++;
+    }
+#endif
+    std::thread([task, function, arg] {
+        hostCurrentTask = task;
+        function(arg);
+#ifdef HOST_SIMULATED_TIME
+        std::lock_guard<std::mutex> lock(hostClock.mutex);
+        hostClock.running--;
+        hostAdvance();
+#endif
+    }).detach();
+    return pdTRUE;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return hostCurrentTask;
+}
+
+inline const char* pcTaskGetTaskName(TaskHandle_t task) {
+    return task->name;
+}
+
+inline void vTaskDelete(TaskHandle_t) {
+}
+
+inline uint32_t getCpuFrequencyMhz() {
+    return 240;
+}
@@ -0,0 +1,42 @@
+#pragma once
+// Host stand-in for AsyncMqttClient, for mqtt_session.h in the host tools.
+// publish() accepts payloads while the simulated TCP send buffer has room;
+// the tool refills it once per frame, as the network drains it on the device.
+#include <Arduino.h>
+
+class AsyncMqttClient {
+public:
+    size_t sendBuffer = SIZE_MAX;   // Bytes publish() may still queue
+    uint32_t published = 0;
+    uint32_t refused = 0;
+    bool linked = false;
+
+    void setKeepAlive(uint16_t) {
+    }
+
+    void setWill(const char*, uint8_t, bool, const char*) {
+    }
+
+    void connect() {
+        linked = true;
+    }
+
+    void disconnect(bool) {
+        linked = false;
+    }
+
+    bool connected() const {
+        return linked;
+    }
+
+    uint16_t publish(const char* topic, uint8_t, bool, const char* payload) {
+        size_t bytes = strlen(topic) + strlen(payload) + 5;
+        if (bytes > sendBuffer) {
+            refused++;
+            return 0;
+        }
+        sendBuffer -= bytes;
+        published++;
+        return (uint16_t)(published % 65535 + 1);
+    }
+};
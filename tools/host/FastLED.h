@@ -0,0 +1,86 @@
+#pragma once
+// The parts of FastLED 3.6 the pixel kernels and output path use, for host
+// tools (tools/kernel_check.cpp, tools/output_overlap.cpp). The arithmetic is
+// FastLED's own with FASTLED_SCALE8_FIXED and FASTLED_BLEND_FIXED, the
+// defaults, so the tools check the firmware kernels against it.
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t fract8;
+
+inline uint8_t scale8(uint8_t i, fract8 scale) {
+    return ((uint16_t)i * (1 + (uint16_t)scale)) >> 8;
+}
+
+inline uint8_t qadd8(uint8_t i, uint8_t j) {
+    unsigned t = i + j;
+    return t > 255 ? 255 : t;
+}
+
+struct CRGB {
+    union {
+        struct {
+            uint8_t r, g, b;
+        };
+        uint8_t raw[3];
+    };
+
+    enum HTMLColorCode { Black = 0x000000, White = 0xFFFFFF };
+
+    CRGB() : r(0), g(0), b(0) {
+    }
+    CRGB(uint8_t red, uint8_t green, uint8_t blue) : r(red), g(green), b(blue) {
+    }
+    CRGB(HTMLColorCode code) : r((code >> 16) & 0xFF), g((code >> 8) & 0xFF), b(code & 0xFF) {
+    }
+
+    CRGB& nscale8(uint8_t scale) {
+        r = scale8(r, scale);
+        g = scale8(g, scale);
+        b = scale8(b, scale);
+        return *this;
+    }
+
+    CRGB& fadeToBlackBy(uint8_t fade) {
+        return nscale8(255 - fade);
+    }
+
+    CRGB& operator+=(const CRGB& rhs) {
+        r = qadd8(r, rhs.r);
+        g = qadd8(g, rhs.g);
+        b = qadd8(b, rhs.b);
+        return *this;
+    }
+
+    explicit operator bool() const {
+        return r || g || b;
+    }
+
+    bool operator==(const CRGB& rhs) const {
+        return r == rhs.r && g == rhs.g && b == rhs.b;
+    }
+
+    bool operator!=(const CRGB& rhs) const {
+        return !(*this == rhs);
+    }
+};
+
+inline CRGB& nblend(CRGB& existing, const CRGB& overlay, fract8 amountOfOverlay) {
+    if (amountOfOverlay == 0) return existing;
+    if (amountOfOverlay == 255) {
+        existing = overlay;
+        return existing;
+    }
+    fract8 amountOfKeep = 255 - amountOfOverlay;
+    existing.r = scale8(existing.r, amountOfKeep) + scale8(overlay.r, amountOfOverlay);
+    existing.g = scale8(existing.g, amountOfKeep) + scale8(overlay.g, amountOfOverlay);
+    existing.b = scale8(existing.b, amountOfKeep) + scale8(overlay.b, amountOfOverlay);
+    return existing;
+}
+
+// The controller object; output goes to the send function the tools install
+struct CFastLED {
+    void show(uint8_t) {
+    }
+};
+inline CFastLED FastLED;
@@ -0,0 +1,12 @@
+#pragma once
+// Host stand-in for the ESP-IDF high-resolution timer
+#include <Arduino.h>
+
+inline int64_t esp_timer_get_time() {
+#ifdef HOST_SIMULATED_TIME
+    std::lock_guard<std::mutex> lock(hostClock.mutex);
+    return hostClock.nowUs;
+#endif
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,201 @@
+// Checks the pixel kernels (include/pixel_kernels.h) against FastLED's
+// per-pixel methods on random buffers of every length and alignment up to a
+// few vectors, then times each kernel against the per-pixel loop it
+// replaces. The output task's dithering has no FastLED counterpart: it is
+// checked against its byte-at-a-time definition over a run of frames, for
+// averaging out to the 16-bit level, and timed against the plain copy it
+// replaces. Build once per path; each should print "parity ok":
+//
+//     g++ -O2 -std=c++17 -Itools/host -Iinclude tools/kernel_check.cpp -o kernel_check && ./kernel_check
+//     g++ -O2 -std=c++17 -Itools/host -Iinclude -DPIXEL_KERNELS_SWAR tools/kernel_check.cpp -o kernel_check && ./kernel_check
+//     g++ -O2 -std=c++17 -Itools/host -Iinclude -DPIXEL_KERNELS_SCALAR tools/kernel_check.cpp -o kernel_check && ./kernel_check
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include "pixel_kernels.h"
+
+static const int MAX_PIXELS = 80;   // Several 16-byte vectors and a ragged tail
+static const int OFFSETS = 4;       // Byte offsets, so the SWAR path sees every alignment
+
+static int failures = 0;
+
+static uint8_t randomByte() {
+    // Edge values more often than chance would give them
+    int r = rand() % 8;
+    return r == 0 ? 0 : r == 1 ? 255 : rand() & 0xFF;
+}
+
+struct Buffers {
+    std::vector<uint8_t> storeA, storeB;
+    CRGB *a, *b;
+
+    Buffers(int count, int offsetA, int offsetB) :
+        storeA(count * 3 + OFFSETS), storeB(count * 3 + OFFSETS) {
+        a = (CRGB*)(storeA.data() + offsetA);
+        b = (CRGB*)(storeB.data() + offsetB);
+        for (auto& v : storeA) v = randomByte();
+        for (auto& v : storeB) v = randomByte();
+    }
+};
+
+static void expect(bool same, const char* kernel, int count, int offset, int param) {
+    if (same) return;
+    if (failures++ < 10) {
+        printf("  mismatch: %s, %d pixels, offset %d, parameter %d\n", kernel, count, offset, param);
+    }
+}
+
+static bool equal(const CRGB* x, const CRGB* y, int count) {
+    return memcmp(x, y, count * sizeof(CRGB)) == 0;
+}
+
+static void checkParity() {
+    for (int count = 0; count <= MAX_PIXELS; count++) {
+        for (int offsetA = 0; offsetA < OFFSETS; offsetA++) {
+            for (int offsetB = 0; offsetB < OFFSETS; offsetB++) {
+                for (int param = 0; param < 256; param += (offsetB == offsetA ? 1 : 17)) {
+                    Buffers buf(count, offsetA, offsetB);
+                    std::vector<CRGB> ref(buf.a, buf.a + count);
+
+                    if (offsetB == 0) {
+                        std::vector<CRGB> got(ref);
+                        PixelKernels::scale(got.data(), count, param);
+                        for (auto& p : ref) p.nscale8(param);
+                        expect(equal(got.data(), ref.data(), count), "scale", count, offsetA, param);
+
+                        PixelKernels::fade(got.data(), count, param);
+                        for (auto& p : ref) p.fadeToBlackBy(param);
+                        expect(equal(got.data(), ref.data(), count), "fade", count, offsetA, param);
+
+                        CRGB color(param, 255 - param, param * 7);
+                        PixelKernels::add(got.data(), count, color);
+                        for (auto& p : ref) p += color;
+                        expect(equal(got.data(), ref.data(), count), "add color", count, offsetA, param);
+
+                        uint32_t total = 0;
+                        for (int i = 0; i < count; i++) total += ref[i].r + ref[i].g + ref[i].b;
+                        expect(PixelKernels::sum(got.data(), count) == total, "sum", count, offsetA, param);
+                        ref.assign(buf.a, buf.a + count);
+                    }
+
+                    // In place on the offset buffers, so src and dst alignments differ
+                    PixelKernels::blend(buf.a, buf.b, count, param);
+                    for (int i = 0; i < count; i++) nblend(ref[i], buf.b[i], param);
+                    expect(equal(buf.a, ref.data(), count), "blend", count, offsetA * OFFSETS + offsetB, param);
+
+                    PixelKernels::add(buf.a, buf.b, count);
+                    for (int i = 0; i < count; i++) ref[i] += buf.b[i];
+                    expect(equal(buf.a, ref.data(), count), "add", count, offsetA * OFFSETS + offsetB, param);
+                }
+            }
+        }
+    }
+}
+
+// One byte of scaleDither as defined: 16-bit product plus the carried fraction
+static uint8_t ditherByte(uint8_t src, uint8_t& error, uint8_t scale) {
+    uint16_t acc = src * (scale + 1) + error;
+    error = acc;
+    return acc >> 8;
+}
+
+static void checkDither() {
+    const int FRAMES = 4;   // Enough for the carried error to matter
+    for (int count = 0; count <= MAX_PIXELS; count++) {
+        for (int offset = 0; offset < OFFSETS; offset++) {
+            for (int scale = 0; scale < 256; scale += (offset == 0 ? 1 : 15)) {
+                // Destination and error at different alignments from the source
+                Buffers buf(count, offset, (offset + 1) % OFFSETS);
+                std::vector<uint8_t> errorStore(count * 3 + OFFSETS);
+                for (auto& v : errorStore) v = randomByte();
+                uint8_t* error = errorStore.data() + (OFFSETS - 1 - offset);
+                std::vector<uint8_t> refError(error, error + count * 3);
+                std::vector<uint8_t> ref(count * 3);
+
+                for (int frame = 0; frame < FRAMES; frame++) {
+                    PixelKernels::scaleDither(buf.b, buf.a, error, count, scale);
+                    const uint8_t* src = (const uint8_t*)buf.a;
+                    for (int i = 0; i < count * 3; i++) {
+                        ref[i] = scale ? ditherByte(src[i], refError[i], scale) : 0;   // Off stays off
+                    }
+                    bool same = memcmp(buf.b, ref.data(), ref.size()) == 0 &&
+                                memcmp(error, refError.data(), refError.size()) == 0;
+                    expect(same, "dither", count, offset, scale);
+                }
+            }
+        }
+    }
+
+    // Over 256 frames each level shows as its 16-bit value, within one step
+    for (int value = 0; value < 256; value++) {
+        for (int scale = 1; scale < 256; scale++) {
+            CRGB src(value, value, value), dst;
+            uint8_t error[3] = { 0, 0, 0 };
+            uint32_t total = 0;
+            for (int frame = 0; frame < 256; frame++) {
+                PixelKernels::scaleDither(&dst, &src, error, 1, scale);
+                total += dst.r;
+            }
+            int target = value * (scale + 1);
+            expect(total + 1 >= (uint32_t)target && total <= (uint32_t)target + 1, "dither mean", 1, value, scale);
+        }
+    }
+}
+
+static const int REPS = 2000;
+
+static double timeNs(const std::function<void()>& body) {
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    for (int rep = 0; rep < REPS; rep++) body();
+    return duration<double, std::nano>(steady_clock::now() - start).count() / REPS;
+}
+
+static void compare(const char* name, int count, double kernelNs, double pixelNs) {
+    printf("  %-10s %4d LEDs: kernel %7.0f ns, per-pixel %7.0f ns (%.2fx)\n", name, count, kernelNs, pixelNs,
+           pixelNs / kernelNs);
+}
+
+static void benchmark(int count) {
+    std::vector<CRGB> a(count), b(count, CRGB(40, 80, 120));
+    const CRGB color(200, 100, 50);
+    // The per-pixel loops go through a volatile pointer so they are not vectorized away
+    CRGB* volatile pa = a.data();
+
+    compare("scale", count, timeNs([&] { PixelKernels::scale(a.data(), count, 254); }),
+            timeNs([&] { for (int i = 0; i < count; i++) pa[i].nscale8(254); }));
+    compare("fade", count, timeNs([&] { PixelKernels::fade(a.data(), count, 1); }),
+            timeNs([&] { for (int i = 0; i < count; i++) pa[i].fadeToBlackBy(1); }));
+    compare("add", count, timeNs([&] { PixelKernels::add(a.data(), b.data(), count); }),
+            timeNs([&] { for (int i = 0; i < count; i++) pa[i] += b[i]; }));
+    compare("add color", count, timeNs([&] { PixelKernels::add(a.data(), count, color); }),
+            timeNs([&] { for (int i = 0; i < count; i++) pa[i] += color; }));
+    compare("blend", count, timeNs([&] { PixelKernels::blend(a.data(), b.data(), count, 128); }),
+            timeNs([&] { for (int i = 0; i < count; i++) nblend(pa[i], b[i], 128); }));
+
+    // The output task's work per frame: dithering against the copy it does without
+    std::vector<uint8_t> error(count * 3);
+    double ditherNs = timeNs([&] { PixelKernels::scaleDither(a.data(), b.data(), error.data(), count, 24); });
+    double copyNs = timeNs([&] { memcpy(pa, b.data(), count * sizeof(CRGB)); });
+    printf("  %-10s %4d LEDs: kernel %7.0f ns, memcpy %7.0f ns (%.2fx the copy)\n", "dither", count, ditherNs,
+           copyNs, ditherNs / copyNs);
+}
+
+int main() {
+    printf("Pixel kernels (%s)\n", PixelKernels::backend());
+    srand(1);
+    checkParity();
+    checkDither();
+    if (failures) {
+        printf("parity FAILED: %d mismatches\n", failures);
+        return 1;
+    }
+    printf("parity ok\n");
+
+    benchmark(120);
+    benchmark(1000);
+    return 0;
+}
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Measure how long the controller takes to come back under MQTT control
+after a broker restart.
+
+Run a local broker as a stand-in for Home Assistant's (e.g. mosquitto), point
+the controller at it through /setup-mqtt, start this probe, then restart the
+broker as often as you like. The probe acts like Home Assistant: it
+reconnects quickly, sends a command that keeps the current brightness, and
+reports the time from losing the broker to the controller's state reply.
+
+    tools/mqtt_recovery_probe.py --host localhost
+    sudo systemctl restart mosquitto
+
+Needs paho-mqtt (pip install paho-mqtt).
+"""
+import argparse
+import json
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+DEFAULT_TOPIC = "homeassistant/light/led_planter"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="localhost", help="broker address")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--topic", default=DEFAULT_TOPIC, help="controller base topic (MQTT_BASE_TOPIC)")
+    parser.add_argument("--interval", type=float, default=0.25, help="seconds between probe commands")
+    args = parser.parse_args()
+
+    lock = threading.Lock()
+    state = {"brightness": 255, "lost_at": None, "waiting": False, "available": None}
+
+    def on_connect(client, userdata, flags, rc):
+        client.subscribe(args.topic + "/state")
+        client.subscribe(args.topic + "/availability")
+        with lock:
+            state["waiting"] = state["lost_at"] is not None
+        print("probe connected to broker")
+
+    def on_disconnect(client, userdata, rc):
+        with lock:
+            if state["lost_at"] is None:
+                state["lost_at"] = time.monotonic()
+        print("broker lost")
+
+    def on_message(client, userdata, msg):
+        if msg.topic.endswith("/availability"):
+            with lock:
+                state["available"] = msg.payload.decode()
+            print(f"controller {msg.payload.decode()}")
+            return
+        try:
+            body = json.loads(msg.payload)
+        except ValueError:
+            return
+        with lock:
+            state["brightness"] = body.get("brightness", state["brightness"])
+            # Retained copies arrive on subscribe; only a live reply proves control
+            if state["waiting"] and not msg.retain:
+                elapsed = time.monotonic() - state["lost_at"]
+                print(f"controller answering {elapsed:.2f} s after the broker went away")
+                state["lost_at"] = None
+                state["waiting"] = False
+
+    client = mqtt.Client(client_id="recovery-probe")
+    client.on_connect = on_connect
+    client.on_disconnect = on_disconnect
+    client.on_message = on_message
+    client.reconnect_delay_set(min_delay=1, max_delay=1)
+    client.connect_async(args.host, args.port, keepalive=15)
+    client.loop_start()
+
+    try:
+        while True:
+            time.sleep(args.interval)
+            with lock:
+                waiting = state["waiting"]
+                command = json.dumps({"brightness": state["brightness"]})
+            if waiting and client.is_connected():
+                client.publish(args.topic + "/set", command)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        client.loop_stop()
+
+
+if __name__ == "__main__":
+    main()
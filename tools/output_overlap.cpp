@@ -0,0 +1,135 @@
+// Runs the output task (include/async_output.h) on the host against a mock
+// strip that holds the sender for WIRE_US_PER_LED per LED, as the benchmarks'
+// mockWire does on the device. FreeRTOS semaphores and tasks come from the
+// stand-ins in tools/host, on simulated time: rendering and the wire are
+// waits on that clock, so every run gives the same counts, whatever else the
+// host is doing.
+//
+// Each case renders frames with a fixed cost and sends them two ways:
+// inline, as FastLED.show() did in the loop, and through AsyncOutput, where
+// the next frame renders while the last one is on the wire. Every case runs
+// with 8-bit output and again with dithering, whose resends of a static frame
+// must not hold up the next one. Counts per case:
+//
+//   overlapped  frames whose render ran while the previous frame was on the wire
+//   held        show() calls that waited behind a dither resend
+//   resends     sends beyond one per frame
+//
+// Exits non-zero unless every frame after the first overlapped, no show()
+// was held by a resend and the slow dithered cases resent at all.
+//
+//     g++ -O2 -std=c++17 -pthread -Itools/host -Iinclude tools/output_overlap.cpp -o output_overlap && ./output_overlap
+#define HOST_SIMULATED_TIME
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+#include "async_output.h"
+
+static const int FRAMES = 60;
+
+static int failures = 0;
+
+// Sends in the order the output task made them, on the simulated clock
+struct Send {
+    uint32_t start, end;
+    bool frame;   // Carried a frame from show(); false for a dither resend
+};
+static std::vector<Send> sends;
+static const AsyncOutput* output = nullptr;
+static uint32_t framesSeen = 0;
+
+// The task counts a frame from show() once its send returns, so each call settles the send before it
+static void settleLastSend() {
+    if (!sends.empty()) sends.back().frame = output->sentFrames() != framesSeen;
+    framesSeen = output->sentFrames();
+}
+
+static void mockWire(const CRGB*, int numLeds, uint8_t) {
+    settleLastSend();
+    uint32_t start = micros();
+    delayMicroseconds(numLeds * WIRE_US_PER_LED);
+    sends.push_back({ start, micros(), false });
+}
+
+// Whether a send of the given kind was on the wire at some point in [from, to]
+static bool onWire(uint32_t from, uint32_t to, bool frame) {
+    for (const Send& send : sends) {
+        if (send.frame == frame && send.start <= to && send.end > from) return true;
+    }
+    return false;
+}
+
+// Stand-in for an effect: touches every LED, then waits out the rest of its budget
+static void render(CRGB* leds, int numLeds, int frame, uint32_t renderUs) {
+    uint32_t start = micros();
+    for (int i = 0; i < numLeds; i++) leds[i] = CRGB(frame + i, frame * 3, i);
+    uint32_t spent = micros() - start;
+    if (spent < renderUs) delayMicroseconds(renderUs - spent);
+}
+
+static void run(int numLeds, uint32_t renderUs, bool dither) {
+    std::vector<CRGB> leds(numLeds);
+    uint32_t wireUs = numLeds * WIRE_US_PER_LED;
+
+    uint32_t start = micros();
+    for (int frame = 0; frame < FRAMES; frame++) {
+        render(leds.data(), numLeds, frame, renderUs);
+        delayMicroseconds(wireUs);
+    }
+    double syncUs = (double)(micros() - start) / FRAMES;
+
+    std::vector<uint32_t> renderStart, showAt, showWait;
+    double asyncUs;
+    {
+        AsyncOutput task(leds.data(), numLeds);
+        output = &task;
+        sends.clear();
+        framesSeen = 0;
+        task.begin(mockWire, dither);
+        start = micros();
+        for (int frame = 0; frame < FRAMES; frame++) {
+            renderStart.push_back(micros());
+            render(leds.data(), numLeds, frame, renderUs);
+            showAt.push_back(micros());
+            task.show(dither ? 40 : 255);
+            showWait.push_back(task.lastWait());
+        }
+        task.flush();
+        asyncUs = (double)(micros() - start) / FRAMES;
+        settleLastSend();
+    }
+
+    int overlapped = 0, held = 0, resends = 0;
+    for (int frame = 1; frame < FRAMES; frame++) {
+        if (onWire(renderStart[frame], showAt[frame], true)) overlapped++;
+    }
+    for (int frame = 0; frame < FRAMES; frame++) {
+        if (showWait[frame] > 0 && onWire(showAt[frame], showAt[frame], false)) held++;
+    }
+    for (const Send& send : sends) resends += !send.frame;
+    bool slow = renderUs >= wireUs + OUTPUT_DITHER_REFRESH_MS * 1000 + wireUs + OUTPUT_REFRESH_MARGIN_US;
+    bool pass = overlapped == FRAMES - 1 && held == 0 && (!dither || !slow || resends > 0);
+    if (!pass) failures++;
+    printf("%4d LEDs, render %5u us, wire %5u us, %-10s inline %6.0f us, task %6.0f us (best %5u), "
+           "overlapped %2d/%d, held %d, resends %3d  %s\n",
+           numLeds, renderUs, wireUs, dither ? "dithered:" : "8-bit:", syncUs, asyncUs, std::max(renderUs, wireUs),
+           overlapped, FRAMES - 1, held, resends, pass ? "ok" : "FAIL");
+}
+
+int main() {
+    for (bool dither : { false, true }) {
+        run(120, 2000, dither);     // Wire-bound at the default length
+        run(120, 12000, dither);    // Render-bound: a resend would not fit before the next frame
+        run(120, 30000, dither);    // Slow effect: dithering resends in the gaps
+        run(1000, 8000, dither);    // Wire-bound, long strip
+        run(1000, 40000, dither);   // Render-bound, long strip: a resend would not fit
+    }
+    if (failures) {
+        printf("%d cases FAILED\n", failures);
+        return 1;
+    }
+    printf("all cases ok\n");
+    return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Flash cost of the runtime strip table (include/strip_types.h): the program
+# size of esp32dev, which builds every supported strip type, against
+# esp32dev-fixed-strip, which builds only the config.h default.
+#
+#     sh tools/strip_flash_cost.sh
+set -e
+
+program_bytes() {
+    pio run -e "$1" | sed -n 's/.*Flash:.*used \([0-9]*\) bytes.*/\1/p' | tail -n 1
+}
+
+full=$(program_bytes esp32dev)
+fixed=$(program_bytes esp32dev-fixed-strip)
+echo "esp32dev:             $full bytes"
+echo "esp32dev-fixed-strip: $fixed bytes"
+echo "strip table:          $((full - fixed)) bytes"
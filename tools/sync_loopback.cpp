@@ -0,0 +1,175 @@
+// Runs several controllers' time sync (include/sync_protocol.h) as threads
+// talking UDP multicast over loopback, each with its own skewed and drifting
+// clock, and reports how far apart their network clocks are. Halfway through
+// the leader is stopped to show the handover; three quarters through a node
+// with a lower id than any other joins, and takes over without moving the
+// network clock.
+//
+//     g++ -O2 -std=c++17 -pthread -Iinclude tools/sync_loopback.cpp -o sync_loopback
+//     ./sync_loopback [nodes] [seconds]
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sync_protocol.h"
+
+static const char* GROUP = "239.255.76.84";
+static const uint16_t PORT = 47684;
+static const int64_t FRAME_US = 16667;   // 60 fps
+
+static int64_t realMicros() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct Node {
+    SyncProtocol protocol;
+    int64_t skewUs;    // Local clock starts this far from real time
+    double drift;      // And runs this much fast or slow
+    std::atomic<bool> running{true};
+    std::mutex lock;
+
+    Node(uint32_t id, int64_t skew, double ppm) : protocol(id), skewUs(skew), drift(ppm * 1e-6) {
+    }
+
+    int64_t localMicros(int64_t real) const {
+        return skewUs + real + (int64_t)(real * drift);
+    }
+
+    int64_t networkTime(int64_t real) {
+        std::lock_guard<std::mutex> guard(lock);
+        return protocol.networkTime(localMicros(real));
+    }
+};
+
+static int openSocket() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+
+    ip_mreq membership = {};
+    inet_pton(AF_INET, GROUP, &membership.imr_multiaddr);
+    inet_pton(AF_INET, "127.0.0.1", &membership.imr_interface);
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+        perror("IP_ADD_MEMBERSHIP");
+        exit(1);
+    }
+    in_addr loopback;
+    inet_pton(AF_INET, "127.0.0.1", &loopback);
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback));
+    unsigned char loop = 1;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    return fd;
+}
+
+static void run(Node* node) {
+    int fd = openSocket();
+    sockaddr_in group = {};
+    group.sin_family = AF_INET;
+    group.sin_port = htons(PORT);
+    inet_pton(AF_INET, GROUP, &group.sin_addr);
+
+    {
+        std::lock_guard<std::mutex> guard(node->lock);
+        node->protocol.begin(node->localMicros(realMicros()));
+    }
+    while (node->running) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        SyncProtocol::Packet packet, out;
+        if (poll(&pfd, 1, 1) > 0 && recv(fd, &packet, sizeof(packet), 0) == sizeof(packet)) {
+            std::lock_guard<std::mutex> guard(node->lock);
+            if (node->protocol.receive(packet, node->localMicros(realMicros()), out)) {
+                sendto(fd, &out, sizeof(out), 0, (sockaddr*)&group, sizeof(group));
+            }
+        }
+        std::lock_guard<std::mutex> guard(node->lock);
+        if (node->protocol.poll(node->localMicros(realMicros()), out)) {
+            sendto(fd, &out, sizeof(out), 0, (sockaddr*)&group, sizeof(group));
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 4;
+    int seconds = argc > 2 ? atoi(argv[2]) : 20;
+
+    srand(1);
+    std::vector<Node*> nodes;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < count; i++) {
+        // Up to 10 s apart at boot and +-100 ppm crystal error
+        nodes.push_back(new Node(100 + i, (rand() % 20000000) - 10000000, (rand() % 200) - 100));
+        threads.emplace_back(run, nodes.back());
+    }
+
+    const int stopTick = seconds * 5;
+    const int joinTick = seconds * 15 / 2;
+    int64_t worstBefore = 0, worstAfter = 0, worstJoined = 0;
+    int64_t aheadBeforeJoin = 0;   // Network time of a survivor less real time, just before the join
+    int64_t worstJump = 0;         // Largest change of that after the join
+    for (int tick = 0; tick < seconds * 10; tick++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (tick == stopTick) {
+            printf("stopping leader %u\n", nodes[0]->protocol.node());
+            nodes[0]->running = false;
+        }
+        if (tick == joinTick) {
+            // Lowest id of all, booted much later than the others
+            nodes.push_back(new Node(1, (rand() % 20000000) + 30000000, (rand() % 200) - 100));
+            threads.emplace_back(run, nodes.back());
+            printf("node %u joins\n", nodes.back()->protocol.node());
+        }
+
+        int64_t real = realMicros();
+        int64_t lo = INT64_MAX, hi = INT64_MIN;
+        for (size_t i = (tick >= stopTick) ? 1 : 0; i < nodes.size(); i++) {
+            int64_t t = nodes[i]->networkTime(real);
+            lo = std::min(lo, t);
+            hi = std::max(hi, t);
+        }
+        int64_t spread = hi - lo;
+        int64_t ahead = nodes[1]->networkTime(real) - real;
+        if (tick == joinTick - 1) aheadBeforeJoin = ahead;
+        if (tick >= joinTick) worstJump = std::max(worstJump, std::abs(ahead - aheadBeforeJoin));
+
+        // Skip the first few seconds (election and first samples) and the handover itself
+        if (tick >= 30 && tick < stopTick) worstBefore = std::max(worstBefore, spread);
+        if (tick >= stopTick + 30 && tick < joinTick) worstAfter = std::max(worstAfter, spread);
+        if (tick >= joinTick + 30) worstJoined = std::max(worstJoined, spread);
+        if (tick % 10 == 9) {
+            printf("t=%2ds spread %6lld us (%.3f frames), leader %u\n", (tick + 1) / 10, (long long)spread,
+                   (double)spread / FRAME_US, nodes[1]->protocol.leader());
+        }
+    }
+
+    printf("worst spread: %lld us with the first leader, %lld us after handover, %lld us after the join "
+           "(frame is %lld us)\n",
+           (long long)worstBefore, (long long)worstAfter, (long long)worstJoined, (long long)FRAME_US);
+    printf("network clock moved by up to %lld us when the lower node joined\n", (long long)worstJump);
+    for (Node* node : nodes) node->running = false;
+    for (std::thread& thread : threads) thread.join();
+    return worstBefore < FRAME_US && worstAfter < FRAME_US && worstJoined < FRAME_US && worstJump < FRAME_US ? 0
+                                                                                                             : 1;
+}
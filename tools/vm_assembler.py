@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Assemble a user effect program for the controller's bytecode VM.
+
+    tools/vm_assembler.py tools/programs/wave.vms wave.lvm
+    curl --data-binary @wave.lvm "http://led-planter.local/program"
+    curl "http://led-planter.local/effect?name=program"
+
+Source is one instruction per line; ';' starts a comment. `.frame` and
+`.pixel` start the two sections, each of which must finish with `end`.
+Labels (`name:`) may only be jumped to forwards. Operands:
+
+    push <int>            -32768..32767
+    load <var>            i x y phase t n r g b g0..g7 (or a number)
+    store <global>        g0..g7
+    pal <palette>         rainbow ocean forest lava party heat cloud
+    jz/jmp <label>
+
+Opcodes are read from include/effect_vm.h, so this stays in step with the
+firmware. See that file for what each instruction does.
+"""
+import argparse
+import os
+import re
+import struct
+import sys
+
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "include", "effect_vm.h")
+VARIABLES = ["i", "x", "y", "phase", "t", "n", "r", "g", "b"] + [f"g{k}" for k in range(8)]
+GLOBAL0 = VARIABLES.index("g0")
+PALETTES = ["rainbow", "ocean", "forest", "lava", "party", "heat", "cloud"]
+
+
+def load_opcodes():
+    with open(HEADER) as f:
+        text = f.read()
+    ops = re.findall(r"X\((\w+),\s*(\d+),\s*\d+,\s*\d+\)", text)
+    return {name.lower(): (code, int(imm)) for code, (name, imm) in enumerate(ops)}
+
+
+class AsmError(Exception):
+    pass
+
+
+def parse_int(text):
+    try:
+        return int(text, 0)
+    except ValueError:
+        raise AsmError(f"expected a number, got '{text}'")
+
+
+def assemble_section(lines, opcodes):
+    # First pass: sizes and label addresses
+    labels = {}
+    instructions = []
+    pc = 0
+    for lineno, line in lines:
+        if line.endswith(":"):
+            labels[line[:-1]] = pc
+            continue
+        parts = line.split()
+        name = parts[0].lower()
+        if name not in opcodes and name != "push":
+            raise AsmError(f"line {lineno}: unknown instruction '{parts[0]}'")
+        operand = parts[1] if len(parts) > 1 else None
+        if name == "push":
+            value = parse_int(operand)
+            if not -32768 <= value <= 32767:
+                raise AsmError(f"line {lineno}: push value out of range")
+            name = "push8" if -128 <= value <= 127 else "push16"
+        code, imm = opcodes[name]
+        if imm and operand is None:
+            raise AsmError(f"line {lineno}: '{name}' needs an operand")
+        instructions.append((lineno, name, operand, pc))
+        pc += 1 + imm
+
+    # Second pass: encode
+    out = bytearray()
+    for lineno, name, operand, pc in instructions:
+        code, imm = opcodes[name]
+        out.append(code)
+        if name == "push8":
+            out += struct.pack("<b", parse_int(operand))
+        elif name == "push16":
+            out += struct.pack("<h", parse_int(operand))
+        elif name in ("load", "store"):
+            index = VARIABLES.index(operand) if operand in VARIABLES else parse_int(operand)
+            if name == "store" and index < GLOBAL0:
+                raise AsmError(f"line {lineno}: can only store to g0..g7")
+            out.append(index)
+        elif name == "pal":
+            out.append(PALETTES.index(operand) if operand in PALETTES else parse_int(operand))
+        elif name in ("jz", "jmp"):
+            if operand not in labels:
+                raise AsmError(f"line {lineno}: unknown label '{operand}'")
+            offset = labels[operand] - (pc + 2)
+            if not 0 <= offset <= 255:
+                raise AsmError(f"line {lineno}: jumps must go forwards by at most 255 bytes")
+            out.append(offset)
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    opcodes = load_opcodes()
+    sections = {"frame": [], "pixel": []}
+    current = None
+    with open(args.source) as f:
+        for lineno, raw in enumerate(f, 1):
+            line = raw.split(";", 1)[0].strip()
+            if not line:
+                continue
+            if line in (".frame", ".pixel"):
+                current = sections[line[1:]]
+                continue
+            if current is None:
+                sys.exit(f"{args.source}:{lineno}: instruction outside .frame or .pixel")
+            current.append((lineno, line))
+
+    try:
+        frame = assemble_section(sections["frame"], opcodes) if sections["frame"] else bytearray()
+        pixel = assemble_section(sections["pixel"], opcodes)
+    except AsmError as e:
+        sys.exit(f"{args.source}: {e}")
+    if not pixel:
+        sys.exit(f"{args.source}: no .pixel section")
+
+    image = b"LVM\x01" + struct.pack("<HH", len(frame), len(pixel)) + frame + pixel
+    if len(image) > 1024:
+        sys.exit(f"{args.source}: program is {len(image)} bytes, the limit is 1024")
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print(f"{len(image)} bytes ({len(frame)} frame, {len(pixel)} pixel)")
+
+
+if __name__ == "__main__":
+    main()